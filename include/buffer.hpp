@@ -1,5 +1,8 @@
 #pragma once
 #include <cassert>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
 #include <iostream>
 
 template <class T>
@@ -9,11 +12,13 @@ class Buffer {
     const T get(int i, int j) const;
     T& get(int i, int j);
     T* getRow(int j);
+    const T* getRow(int j) const;
     Buffer(int _width, int _height);
     Buffer(int _width, int _height, T initial);
     void setup(int _width, int _height);
     T max() const;
     T sum() const;
+    std::size_t size() const { return std::size_t(width)*height; }
     ~Buffer();
     void fillAll(T fillData);
     int width, height; // in pixels
@@ -26,13 +31,18 @@ class Buffer {
 
 template <class T>
 T* Buffer<T>::getRow(int j) {
-  return buffer + j*width;
+  return buffer + std::size_t(j)*width;
+}
+
+template <class T>
+const T* Buffer<T>::getRow(int j) const {
+  return buffer + std::size_t(j)*width;
 }
 
 template <class T>
 T Buffer<T>::max() const {
   T max = buffer[0];
-  for(int i=1; i<width*height; ++i) {
+  for(std::size_t i=1; i<size(); ++i) {
     if(buffer[i] > max) {
       max = buffer[i];
     }
@@ -43,7 +53,7 @@ T Buffer<T>::max() const {
 template <class T>
 T Buffer<T>::sum() const {
   T sum = buffer[0];
-  for(int i=1; i<width*height; ++i) {
+  for(std::size_t i=1; i<size(); ++i) {
     sum += buffer[i];
   }
   return sum;
@@ -56,9 +66,9 @@ Buffer<T>::Buffer(int _width, int _height) {
 
 template <class T>
 void Buffer<T>::setup(int _width, int _height) {
-  buffer = new T[_width*_height];
   width = _width;
   height = _height;
+  buffer = new T[size()];
 }
 
 template <class T>
@@ -75,18 +85,18 @@ Buffer<T>::~Buffer() {
 template <class T>
 void Buffer<T>::set(int i, int j, const T& item) {
   if((i < width and i >= 0) and (j < height and j >= 0)) {
-    buffer[j*width + i] = item;
+    buffer[std::size_t(j)*width + i] = item;
   }
 }
 
 template <class T>
 T& Buffer<T>::get(int i, int j) {
-  return buffer[j*width + i];
+  return buffer[std::size_t(j)*width + i];
 }
 
 template <class T>
 const T Buffer<T>::get(int i, int j) const {
-  return buffer[j*width + i];
+  return buffer[std::size_t(j)*width + i];
 }
 
 template <class T>
@@ -107,3 +117,89 @@ template <class t> std::ostream& operator<<(std::ostream& s, Buffer<t>& b) {
   }
   return s;
 }
+
+// Same interface as Buffer but the rows are allocated in blocks rather than
+// one contiguous array, so very large buffers (such as the dense form factor
+// matrix of 100k+ faces) never need a single multi-GB allocation. Rows are
+// still contiguous, so getRow can be used in place of Buffer::getRow.
+template <class T>
+class ChunkedBuffer {
+  public:
+    void set(int i, int j, const T&);
+    const T get(int i, int j) const;
+    T& get(int i, int j);
+    T* getRow(int j);
+    const T* getRow(int j) const;
+    ChunkedBuffer(int _width, int _height, T initial, int _rowsPerBlock=0);
+    ~ChunkedBuffer();
+    void fillAll(T fillData);
+    std::size_t size() const { return std::size_t(width)*height; }
+    int width, height; // in pixels
+    int rowsPerBlock;
+  protected:
+    std::vector<T*> blocks;
+    ChunkedBuffer();
+    ChunkedBuffer(const ChunkedBuffer&);
+};
+
+// Aim for blocks of around 64MB
+const std::size_t CHUNKED_BUFFER_BLOCK_BYTES = std::size_t(64)*1024*1024;
+
+template <class T>
+ChunkedBuffer<T>::ChunkedBuffer(int _width, int _height, T initial, int _rowsPerBlock):
+  width(_width),
+  height(_height),
+  rowsPerBlock(_rowsPerBlock)
+{
+  if(rowsPerBlock <= 0) {
+    std::size_t rowBytes = std::size_t(width)*sizeof(T);
+    rowsPerBlock = std::max(std::size_t(1), CHUNKED_BUFFER_BLOCK_BYTES/rowBytes);
+  }
+  rowsPerBlock = std::min(rowsPerBlock, std::max(height, 1));
+  for(int j=0; j<height; j+=rowsPerBlock) {
+    int nRows = std::min(rowsPerBlock, height-j);
+    blocks.push_back(new T[std::size_t(nRows)*width]);
+  }
+  fillAll(initial);
+}
+
+template <class T>
+ChunkedBuffer<T>::~ChunkedBuffer() {
+  for(int b=0; b<(int)blocks.size(); ++b) {
+    delete [] blocks[b];
+  }
+}
+
+template <class T>
+T* ChunkedBuffer<T>::getRow(int j) {
+  return blocks[j/rowsPerBlock] + std::size_t(j%rowsPerBlock)*width;
+}
+
+template <class T>
+const T* ChunkedBuffer<T>::getRow(int j) const {
+  return blocks[j/rowsPerBlock] + std::size_t(j%rowsPerBlock)*width;
+}
+
+template <class T>
+void ChunkedBuffer<T>::set(int i, int j, const T& item) {
+  if((i < width and i >= 0) and (j < height and j >= 0)) {
+    getRow(j)[i] = item;
+  }
+}
+
+template <class T>
+T& ChunkedBuffer<T>::get(int i, int j) {
+  return getRow(j)[i];
+}
+
+template <class T>
+const T ChunkedBuffer<T>::get(int i, int j) const {
+  return getRow(j)[i];
+}
+
+template <class T>
+void ChunkedBuffer<T>::fillAll(T fillData) {
+  for(int j=0; j<height; ++j) {
+    std::fill(getRow(j), getRow(j)+width, fillData);
+  }
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <cstdlib>
+#include <new>
+#include <algorithm>
+
+#include "geometry.hpp"
+#include "mesh.hpp"
+
+// Cache lines are 64 bytes
+const std::size_t CACHE_LINE = 64;
+
+// std::allocator only promises alignment for the fundamental types
+template <class T>
+class CacheAlignedAllocator {
+  public:
+    typedef T value_type;
+    CacheAlignedAllocator() {}
+    template <class U> CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+    T* allocate(std::size_t n) {
+      void* p = nullptr;
+      if(posix_memalign(&p, CACHE_LINE, n*sizeof(T)) != 0) {
+        throw std::bad_alloc();
+      }
+      return static_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) { std::free(p); }
+    template <class U> bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+    template <class U> bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+// Two to a cache line. Nodes are stored depth first, so an interior
+// node's left child is the node after it.
+struct alignas(32) BVHNode {
+  float lo[3];
+  int first;  // a leaf's first face in faces(), an interior node's right child
+  float hi[3];
+  int count;  // a leaf's number of faces, 0 for an interior node
+
+  bool leaf() const { return count > 0; }
+  Vec3f lower() const { return Vec3f(lo[0], lo[1], lo[2]); }
+  Vec3f upper() const { return Vec3f(hi[0], hi[1], hi[2]); }
+};
+
+typedef std::vector<BVHNode, CacheAlignedAllocator<BVHNode> > BVHNodes;
+
+// A face's corner and the two edges from it, for ray tests without going
+// back to the mesh
+struct BVHTriangle {
+  float v0[3];
+  float e1[3];
+  float e2[3];
+};
+
+// Moller-Trumbore: true if the line from + t*dir crosses the triangle
+// v0 + u e1 + v e2, at the t returned
+inline bool intersect(const Vec3f& from, const Vec3f& dir, const Vec3f& v0, const Vec3f& e1, const Vec3f& e2, float& t) {
+  Vec3f p = dir.cross(e2);
+  float det = e1.dot(p);
+  if(std::abs(det) < 1e-12f) {
+    return false;
+  }
+  float inverse = 1.f/det;
+  Vec3f s = from - v0;
+  float u = s.dot(p)*inverse;
+  if(u < 0.f or u > 1.f) {
+    return false;
+  }
+  Vec3f q = s.cross(e1);
+  float v = dir.dot(q)*inverse;
+  if(v < 0.f or u + v > 1.f) {
+    return false;
+  }
+  t = e2.dot(q)*inverse;
+  return true;
+}
+
+// Bounding volume hierarchy over a mesh's faces, built top down with the
+// surface area heuristic evaluated over binned centroids. Big subtrees are
+// built on their own threads. Ray queries and frustum culling, for the
+// hemicubes, ray cast visibility and clustering, all walk the same nodes.
+class FaceBVH {
+  public:
+    FaceBVH() {}
+    void build(const TriangleMesh& mesh);
+    int nnodes() const { return (int)nodes.size(); }
+    const BVHNode& node(int i) const { return nodes[i]; }
+    // Face indices, reordered so every node's are contiguous
+    const std::vector<int>& faces() const { return order; }
+
+    // The nearest face, other than those skip(face) is true for, that the
+    // ray from + t*dir crosses with t in (tMin, tMax), with its t; -1 if
+    // none does
+    template <class Skip>
+    int firstHit(const Vec3f& from, const Vec3f& dir, float tMin, float tMax, const Skip& skip, float& t) const;
+    // True if any such face does
+    template <class Skip>
+    bool anyHit(const Vec3f& from, const Vec3f& dir, float tMin, float tMax, const Skip& skip) const;
+    // Appends every face that may reach the inside (n.p + w >= 0) of all
+    // the planes (x, y, z, w): faces in leaves inside them all, and those
+    // of leaves cut by a plane that reach its inside
+    void frustumQuery(const Vec4f* planes, int nplanes, std::vector<int>& out) const;
+  private:
+    BVHNodes nodes;
+    std::vector<BVHTriangle> triangles; // in faces() order
+    std::vector<int> order;
+
+    inline bool hitsBox(const BVHNode& node, const Vec3f& from, const Vec3f& inverseDir, float tMin, float tMax, float& tNear) const;
+    template <class Skip, bool Nearest>
+    int traverse(const Vec3f& from, const Vec3f& dir, float tMin, float tMax, const Skip& skip, float& t) const;
+};
+
+// Past BVH_SAH_DEPTH levels faces are split at the median, which halves an
+// int count at most 31 more times. A walk holds at most one sibling per
+// level plus the node itself, so it never outgrows the stack.
+const int BVH_SAH_DEPTH = 32;
+const int BVH_STACK_DEPTH = BVH_SAH_DEPTH + 32;
+
+// Slab test
+inline bool FaceBVH::hitsBox(const BVHNode& node, const Vec3f& from, const Vec3f& inverseDir, float tMin, float tMax, float& tNear) const {
+  for(int a=0; a<3; ++a) {
+    float t0 = (node.lo[a] - from[a])*inverseDir[a];
+    float t1 = (node.hi[a] - from[a])*inverseDir[a];
+    if(t0 > t1) {
+      std::swap(t0, t1);
+    }
+    tMin = t0 > tMin ? t0 : tMin;
+    tMax = t1 < tMax ? t1 : tMax;
+    if(tMin > tMax) {
+      return false;
+    }
+  }
+  tNear = tMin;
+  return true;
+}
+
+// Nearer child first; with Nearest false, stops at the first hit
+template <class Skip, bool Nearest>
+int FaceBVH::traverse(const Vec3f& from, const Vec3f& dir, float tMin, float tMax, const Skip& skip, float& t) const {
+  int hit = -1;
+  t = tMax;
+  if(nodes.empty()) {
+    return hit;
+  }
+  const float huge = std::numeric_limits<float>::max();
+  Vec3f inverseDir(dir.x != 0.f ? 1.f/dir.x : huge, dir.y != 0.f ? 1.f/dir.y : huge, dir.z != 0.f ? 1.f/dir.z : huge);
+  int stack[BVH_STACK_DEPTH];
+  int top = 0;
+  float tNear;
+  if(not hitsBox(nodes[0], from, inverseDir, tMin, t, tNear)) {
+    return hit;
+  }
+  stack[top++] = 0;
+  while(top > 0) {
+    const BVHNode& node = nodes[stack[--top]];
+    assert(top + 2 <= BVH_STACK_DEPTH);
+    if(node.leaf()) {
+      for(int k=node.first; k<node.first+node.count; ++k) {
+        const BVHTriangle& tri = triangles[k];
+        float tFace;
+        if(intersect(from, dir, Vec3f(tri.v0[0], tri.v0[1], tri.v0[2]), Vec3f(tri.e1[0], tri.e1[1], tri.e1[2]), Vec3f(tri.e2[0], tri.e2[1], tri.e2[2]), tFace)
+            and tFace > tMin and tFace < t and not skip(order[k])) {
+          t = tFace;
+          hit = order[k];
+          if(not Nearest) {
+            return hit;
+          }
+        }
+      }
+      continue;
+    }
+    int left = int(&node - nodes.data()) + 1;
+    int right = node.first;
+    float tLeft, tRight;
+    bool hitLeft = hitsBox(nodes[left], from, inverseDir, tMin, t, tLeft);
+    bool hitRight = hitsBox(nodes[right], from, inverseDir, tMin, t, tRight);
+    if(hitLeft and hitRight) {
+      if(tLeft < tRight) {
+        stack[top++] = right;
+        stack[top++] = left;
+      } else {
+        stack[top++] = left;
+        stack[top++] = right;
+      }
+    } else if(hitLeft) {
+      stack[top++] = left;
+    } else if(hitRight) {
+      stack[top++] = right;
+    }
+  }
+  return hit;
+}
+
+template <class Skip>
+int FaceBVH::firstHit(const Vec3f& from, const Vec3f& dir, float tMin, float tMax, const Skip& skip, float& t) const {
+  return traverse<Skip, true>(from, dir, tMin, tMax, skip, t);
+}
+
+template <class Skip>
+bool FaceBVH::anyHit(const Vec3f& from, const Vec3f& dir, float tMin, float tMax, const Skip& skip) const {
+  float t;
+  return traverse<Skip, false>(from, dir, tMin, tMax, skip, t) >= 0;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+
+#include "geometry.hpp"
+
+// One pass of a ConvergenceTracker, per channel
+struct PassMetrics {
+  int pass;
+  Vec3f total;       // radiosity summed over faces at the end of the pass
+  Vec3f change;      // sum of |update| over the pass
+  Vec3f maxResidual; // largest |update| of any face
+  bool converged;
+
+  // max over channels of change/total
+  float relativeChange() const;
+};
+
+std::ostream& operator<<(std::ostream& s, const PassMetrics& metrics);
+
+// How an iterative solver got on: its metrics after each pass, and whether
+// it got below the cutoff within MAX_PASSES
+struct ConvergenceReport {
+  const char* method;
+  int passes;
+  bool converged;
+  std::vector<PassMetrics> history;
+
+  ConvergenceReport(const char* method): method(method), passes(0), converged(false) {}
+};
+
+std::ostream& operator<<(std::ostream& s, const ConvergenceReport& report);
+
+// Convergence of a solve kept up to date as updates are applied, so
+// finishing a pass costs O(1) rather than another sweep over the faces.
+// A pass has converged once change <= tolerance*total in every channel;
+// a channel that is black throughout converges trivially. Totals are
+// double so small updates aren't lost against them over many passes.
+// The passes are kept as the solver's report.
+class ConvergenceTracker {
+  public:
+    // DIFF_TO_TOTAL_CUTOFF in every channel
+    ConvergenceTracker(const char* method = "Solver");
+    ConvergenceTracker(const Vec3f& tolerance, const char* method = "Solver");
+    // Sums the starting radiosity, the only O(n) step
+    void start(const std::vector<Vec3f>& radiosity);
+    // Call as each face's radiosity changes by update
+    inline void apply(const Vec3f& update) {
+      for(int k=0; k<3; ++k) {
+        float size = std::abs(update[k]);
+        total[k] += update[k];
+        change[k] += size;
+        maxResidual[k] = std::max(maxResidual[k], size);
+      }
+    }
+    // Records the pass's metrics and starts the next; true if it converged
+    bool endPass();
+    const PassMetrics& last() const { return progress.history.back(); }
+    const std::vector<PassMetrics>& passes() const { return progress.history; }
+    const ConvergenceReport& report() const { return progress; }
+  private:
+    Vec3f tolerance;
+    double total[3];
+    double change[3];
+    float maxResidual[3];
+    ConvergenceReport progress;
+};
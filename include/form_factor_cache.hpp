@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "model.hpp"
+#include "sparse_matrix.hpp"
+
+const uint32_t FORM_FACTOR_CACHE_VERSION = 1;
+const char FORM_FACTOR_CACHE_MAGIC[4] = {'R', 'F', 'F', 'C'};
+
+// File layout: header | rowStart (nrows+1 x uint64) | indices (nnz x int32)
+// | values (nnz x float)
+struct FormFactorCacheHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t nrows;
+  uint64_t nonZeros;
+};
+
+// Form factors depend only on geometry and the hemicube setup, so they can
+// be reused across runs which change nothing else (materials, say). The key
+// hashes vertex positions, face indices and normals along with the grid
+// size, near plane and the renderer the build uses.
+uint64_t formFactorCacheKey(const Model& model, int gridSize, float nearPlane);
+
+// Reading maps the file and returns a view of it, failing if the file is
+// missing, truncated, has a different key, or has anything other than nrows
+// rows of in range columns.
+bool readFormFactorCache(const char* filename, uint64_t key, int nrows, SparseMatrix& formFactors);
+bool writeFormFactorCache(const char* filename, uint64_t key, const SparseMatrix& formFactors);
+
+// Writes a form factor file a row at a time, in order, so the matrix never
+// has to be held in memory. Indices go straight to the file and values to
+// a side file appended by finish(); nothing appears under filename until
+// finish() succeeds.
+class FormFactorFileWriter {
+  public:
+    FormFactorFileWriter(const char* filename, uint64_t key, int nrows);
+    ~FormFactorFileWriter();
+    void reserve(int nrows, std::size_t nonZeros) {}
+    void appendRow(const std::vector<int>& rowIndices, const std::vector<float>& rowValues);
+    void appendRow(const int* rowIndices, const float* rowValues, int size);
+    bool finish();
+  private:
+    std::string filename;
+    std::string tempFilename;
+    std::string valuesFilename;
+    FormFactorCacheHeader header;
+    std::vector<std::size_t> rowStart;
+    std::ofstream out;
+    std::ofstream valuesOut;
+    bool finished;
+
+    FormFactorFileWriter();
+    FormFactorFileWriter(const FormFactorFileWriter&);
+};
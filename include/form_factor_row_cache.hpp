@@ -0,0 +1,65 @@
+#pragma once
+
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+#include <unordered_map>
+
+#include "model.hpp"
+#include "buffer.hpp"
+#include "sparse_matrix.hpp"
+#include "hemicube_scheduler.hpp"
+
+// One face's form factors, compressed as in SparseMatrix
+struct CachedRow {
+  std::vector<int> indices;
+  std::vector<float> values;
+
+  SparseRow row() const;
+  std::size_t bytes() const;
+};
+typedef std::shared_ptr<const CachedRow> CachedRowPtr;
+
+// Form factor rows for the progressive solvers, rendered on first use and
+// then kept, least recently used first out, within budgetBytes. Rows are
+// handed out as shared pointers so an evicted row stays valid for whoever
+// is still using it. Safe to use from several threads; hemicubes are
+// rendered outside the lock.
+//
+// A solver sweeping every face in the same order each pass would always
+// find the row it wants just evicted, so sweeps should alternate direction.
+class FormFactorRowCache {
+  public:
+    FormFactorRowCache(const Model& model, int gridSize, std::size_t budgetBytes);
+    // scratch is the calling thread's own, for a hemicube of gridSize
+    CachedRowPtr getRow(int faceIdx, HemicubeScratch& scratch);
+    const Model& getModel() const { return model; }
+    int getGridSize() const { return gridSize; }
+    std::size_t hits() const { return nhits; }
+    std::size_t misses() const { return nmisses; }
+    std::size_t memoryUsage() const { return bytes; }
+  private:
+    typedef std::list<int> Recency;
+    struct Entry {
+      CachedRowPtr row;
+      Recency::iterator used;
+    };
+
+    const Model& model;
+    int gridSize;
+    Buffer<float> topFace;
+    Buffer<float> sideFace;
+
+    std::mutex mutex;
+    std::unordered_map<int, Entry> entries;
+    Recency recency;
+    std::size_t budget;
+    std::size_t bytes;
+    std::size_t nhits;
+    std::size_t nmisses;
+
+    FormFactorRowCache();
+    FormFactorRowCache(const FormFactorRowCache&);
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "sparse_matrix.hpp"
+
+// Products with one row of form factors, for solvers which work on either
+// storage. Sparse rows hold no diagonal; dense rows are indexed by item
+// buffer id, so face j is at j+1, and may have the diagonal set.
+
+// sum_j F_ij x_j
+inline Vec3f gatherRow(const std::vector<Vec3f>& x, int faceIdx, const SparseRow& formFactors) {
+  Vec3f gathered(0,0,0);
+  for(int k=0; k<formFactors.size; ++k) {
+    gathered += x[formFactors.indices[k]]*formFactors.values[k];
+  }
+  return gathered;
+}
+
+inline Vec3f gatherRow(const std::vector<Vec3f>& x, int faceIdx, const float* formFactors) {
+  Vec3f gathered(0,0,0);
+  for(int j=0; j<(int)x.size(); ++j) {
+    if(j != faceIdx) {
+      gathered += x[j]*formFactors[j+1];
+    }
+  }
+  return gathered;
+}
+
+// y_j += F_ij x_i, for products with the transpose
+inline void scatterRow(std::vector<Vec3f>& y, int faceIdx, const Vec3f& xi, const SparseRow& formFactors) {
+  for(int k=0; k<formFactors.size; ++k) {
+    y[formFactors.indices[k]] += xi*formFactors.values[k];
+  }
+}
+
+inline void scatterRow(std::vector<Vec3f>& y, int faceIdx, const Vec3f& xi, const float* formFactors) {
+  for(int j=0; j<(int)y.size(); ++j) {
+    if(j != faceIdx) {
+      y[j] += xi*formFactors[j+1];
+    }
+  }
+}
+
+// Radiosity with each channel contiguous, so products over a row vectorise
+// across faces instead of working through padded Vec3fs
+struct RadiosityChannels {
+  std::vector<float> r;
+  std::vector<float> g;
+  std::vector<float> b;
+
+  RadiosityChannels(int n): r(n, 0.f), g(n, 0.f), b(n, 0.f) {}
+  inline Vec3f get(int i) const { return Vec3f(r[i], g[i], b[i]); }
+  inline void set(int i, const Vec3f& v) { r[i] = v.r; g[i] = v.g; b[i] = v.b; }
+};
+
+// sum_j F_ij x_j over channels
+inline Vec3f gatherRow(const RadiosityChannels& x, int faceIdx, const SparseRow& formFactors) {
+  const float* r = x.r.data();
+  const float* g = x.g.data();
+  const float* b = x.b.data();
+  const int* indices = formFactors.indices;
+  const float* values = formFactors.values;
+  float sumR = 0.f, sumG = 0.f, sumB = 0.f;
+  #pragma omp simd reduction(+:sumR,sumG,sumB)
+  for(int k=0; k<formFactors.size; ++k) {
+    int j = indices[k];
+    sumR += r[j]*values[k];
+    sumG += g[j]*values[k];
+    sumB += b[j]*values[k];
+  }
+  return Vec3f(sumR, sumG, sumB);
+}
+
+// The whole row is summed and any diagonal taken off afterwards, rather
+// than testing j against faceIdx inside the loop
+inline Vec3f gatherRow(const RadiosityChannels& x, int faceIdx, const float* formFactors) {
+  const float* r = x.r.data();
+  const float* g = x.g.data();
+  const float* b = x.b.data();
+  const float* values = formFactors + 1;
+  int n = (int)x.r.size();
+  float sumR = 0.f, sumG = 0.f, sumB = 0.f;
+  #pragma omp simd reduction(+:sumR,sumG,sumB)
+  for(int j=0; j<n; ++j) {
+    sumR += r[j]*values[j];
+    sumG += g[j]*values[j];
+    sumB += b[j]*values[j];
+  }
+  return Vec3f(sumR, sumG, sumB) - x.get(faceIdx)*values[faceIdx];
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <future>
+#include <cstdint>
+#include <cstddef>
+
+#include "sparse_matrix.hpp"
+
+// A run of consecutive rows of a form factor file held in memory
+struct FormFactorBlock {
+  int firstRow;
+  int endRow;
+  std::vector<std::size_t> rowStart;
+  std::vector<int> indices;
+  std::vector<float> values;
+
+  FormFactorBlock(): firstRow(0), endRow(0) {}
+  SparseRow getRow(int i) const;
+};
+
+// Reads a form factor file (see form_factor_cache.hpp) in row blocks of
+// roughly blockBytes, for matrices which don't fit in memory. Only the row
+// offsets are kept resident. Rows must be visited in increasing order,
+// starting over from row 0 for each pass; while one block is in use the
+// next is read on another thread.
+class FormFactorStream {
+  public:
+    FormFactorStream(const char* filename, uint64_t key, std::size_t blockBytes);
+    ~FormFactorStream();
+    bool valid() const { return fd >= 0; }
+    int nrows() const { return (int)rowStart.size() - 1; }
+    std::size_t nonZeros() const { return rowStart.back(); }
+    int nblocks() const { return (int)blockStart.size() - 1; }
+    SparseRow getRow(int i);
+  private:
+    int fd;
+    std::size_t indicesOffset;
+    std::size_t valuesOffset;
+    std::vector<std::size_t> rowStart;
+    std::vector<int> blockStart;
+
+    FormFactorBlock current;
+    FormFactorBlock prefetched;
+    std::future<bool> pending;
+    int pendingBlock;
+
+    bool readBlock(int block, FormFactorBlock& out) const;
+    void prefetch(int block);
+    void advance();
+
+    FormFactorStream();
+    FormFactorStream(const FormFactorStream&);
+};
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "buffer.hpp"
+#include "sparse_matrix.hpp"
+#include "convergence.hpp"
+
+// Gathering with successive over-relaxation over precalculated form
+// factors. Each face is updated in place from the newest radiosities,
+//   B_i += omega*(E_i + rho_i sum_j F_ij B_j - B_i)
+// so omega = 1 is plain Gauss-Seidel. Passes stop once the change in a
+// pass, relative to the total radiosity, is below DIFF_TO_TOTAL_CUTOFF in
+// every channel.
+ConvergenceReport sorRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const SparseMatrix& totalFormFactors, float omega);
+ConvergenceReport sorRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const ChunkedBuffer<float>& totalFormFactors, float omega);
@@ -3,6 +3,9 @@
 #include <cmath>
 #include <ostream>
 #include <cassert>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
 
 // Forward declarations
 template <class t> struct Vec2;
@@ -15,6 +18,7 @@ typedef Vec3<float> Vec3f;
 typedef Vec3<int>   Vec3i;
 typedef Vec4<float> Vec4f;
 typedef Vec4<int>   Vec4i;
+struct Mat4;
 
 const int DEFAULT_MATRIX_SIZE = 4;
 
@@ -26,6 +30,7 @@ public:
   Matrix(const Vec2f& v);
   Matrix(const Vec3f& v);
   Matrix(const Vec4f& v);
+  Matrix(const Mat4& mat);
   Matrix(const Matrix& m);
   Matrix& operator= (const Matrix& mat);
   void init(const Matrix& mat);
@@ -35,8 +40,8 @@ public:
 
   void setAll(float f);
   static Matrix identity(int dimensions=DEFAULT_MATRIX_SIZE);
-  float get(int i, int j) const;
-  void set(int i, int j, float value);
+  inline float get(int i, int j) const {return m[j*cols + i];}
+  inline void set(int i, int j, float value) {m[j*cols + i] = value;}
   Matrix operator*(const Matrix& a) const;
   Vec2f operator*(const Vec2f& v) const;
   Vec3f operator*(const Vec3f& v) const;
@@ -49,12 +54,12 @@ public:
 Vec3f m2v(const Matrix& m);
 Matrix v2m(const Vec3f& v);
 
-Matrix formTranslation(const Vec3f& translationVector);
-Matrix viewportRelative(int x, int y, int w, int h, int depth=1.0f);
-Matrix viewportAbsolute(int x0, int y0, int x1, int y1, int depth=1.0f);
-Matrix lookAt(Vec3f eye, Vec3f centre, Vec3f up);
-Matrix formRightAngledProjection(float n, float f);
-Matrix formProjection(float l, float r, float b, float t, float n, float f);
+Mat4 formTranslation(const Vec3f& translationVector);
+Mat4 viewportRelative(int x, int y, int w, int h, int depth=1.0f);
+Mat4 viewportAbsolute(int x0, int y0, int x1, int y1, int depth=1.0f);
+Mat4 lookAt(Vec3f eye, Vec3f centre, Vec3f up);
+Mat4 formRightAngledProjection(float n, float f);
+Mat4 formProjection(float l, float r, float b, float t, float n, float f);
 float calcTriangleArea(const Vec3f& v1, const Vec3f& v2, const Vec3f& v3);
 
 template <class t> struct Vec2 {
@@ -157,6 +162,63 @@ template <class t> struct Vec4 {
   template <class > friend std::ostream& operator<<(std::ostream& s, const Vec4<t>& v);
 };
 
+// Fixed size 4x4 transform kept on the stack, for the per triangle paths
+// where Matrix's heap allocations dominate. Stored column major so a
+// transform is four broadcast multiply-adds of the columns; the sums are
+// accumulated in the same order as Matrix so results are identical.
+struct alignas(16) Mat4 {
+  float m[16];
+
+  Mat4() { for(int k=0; k<16; ++k) m[k] = 0.f; }
+  Mat4(const Matrix& mat) {
+    assert(mat.nrows() == 4 and mat.ncols() == 4);
+    for(int j=0; j<4; ++j) {
+      for(int i=0; i<4; ++i) {
+        set(i, j, mat.get(i, j));
+      }
+    }
+  }
+  static Mat4 identity() {
+    Mat4 result;
+    for(int i=0; i<4; ++i) {
+      result.set(i, i, 1.f);
+    }
+    return result;
+  }
+  inline float get(int i, int j) const {return m[j*4 + i];}
+  inline void set(int i, int j, float value) {m[j*4 + i] = value;}
+
+  inline Vec4f operator*(const Vec4f& v) const {
+#if defined(__SSE__)
+    __m128 r = _mm_mul_ps(_mm_load_ps(m), _mm_set1_ps(v.x));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m+4), _mm_set1_ps(v.y)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m+8), _mm_set1_ps(v.z)));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m+12), _mm_set1_ps(v.w)));
+    Vec4f result;
+    _mm_storeu_ps(result.raw, r);
+    return result;
+#else
+    Vec4f result;
+    for(int i=0; i<4; ++i) {
+      result[i] = m[i]*v.x + m[4+i]*v.y + m[8+i]*v.z + m[12+i]*v.w;
+    }
+    return result;
+#endif
+  }
+
+  // Column j of the product is this transform applied to column j of a
+  inline Mat4 operator*(const Mat4& a) const {
+    Mat4 result;
+    for(int j=0; j<4; ++j) {
+      Vec4f column = (*this)*Vec4f(a.m[4*j], a.m[4*j+1], a.m[4*j+2], a.m[4*j+3]);
+      for(int i=0; i<4; ++i) {
+        result.m[4*j+i] = column[i];
+      }
+    }
+    return result;
+  }
+  inline Mat4 operator*(const Matrix& a) const { return (*this)*Mat4(a); }
+};
 
 template <class t> std::ostream& operator<<(std::ostream& s, const Vec2<t>& v) {
   s << "(" << v.x << ", " << v.y << ")\n";
@@ -5,8 +5,12 @@
 #include "geometry.hpp"
 #include "model.hpp"
 #include "buffer.hpp"
+#include "sparse_matrix.hpp"
 
-Matrix formHemicubeMVP(const Vec3f& eye, const Vec3f& dir, const Vec3f& up);
+class FormFactorFileWriter;
+struct HemicubeScratch;
+
+Mat4 formHemicubeMVP(const Vec3f& eye, const Vec3f& dir, const Vec3f& up);
 
 void renderHemicube(Buffer<unsigned int>& buffer, const Model& model, int faceIdx, const Vec3f& eye, const Vec3f& dir, const Vec3f& up);
 void renderToHemicube(Buffer<unsigned int>& mainBuffer, const Model& model, int faceIdx);
@@ -15,6 +19,11 @@ void calcFormFactorPerCell(const int sideLengthInPixels, Buffer<float>& topFace,
 void calcFormFactorsFromBuffer(const Buffer<unsigned int>& itemBuffer, const Buffer<float>& factorsPerCell, float* formFactors);
 void calcFormFactorsFromSideBuffer(const Buffer<unsigned int>& itemBuffer, const Buffer<float>& factorsPerCell, float* formFactors);
 void calcFormFactorsWholeModel(const Model& model, Buffer<float>& formFactors, int gridSize);
+void calcFormFactorsWholeModel(const Model& model, ChunkedBuffer<float>& formFactors, int gridSize);
+void calcFormFactorsWholeModel(const Model& model, SparseMatrix& formFactors, int gridSize);
+void calcFormFactorsWholeModel(const Model& model, FormFactorFileWriter& formFactors, int gridSize);
 void calcFormFactorsSingleFace(const Model& model, const int faceIdx, float* formFactors, int gridSize, const Buffer<float>& topFace, const Buffer<float>& sideFace);
+// Reusing a thread's rasteriser rather than allocating one
+void calcFormFactorsSingleFace(const Model& model, const int faceIdx, float* formFactors, HemicubeScratch& scratch, const Buffer<float>& topFace, const Buffer<float>& sideFace);
 
 Vec3f getUp(const Vec3f& dir);
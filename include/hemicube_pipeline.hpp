@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "model.hpp"
+#include "sparse_matrix.hpp"
+#include "form_factor_row_cache.hpp"
+
+// Fetches form factor rows from a row cache ahead of a consumer which takes
+// them in sweep order, so missing hemicubes are drawn on every core while
+// the solver applies the rows already finished. Rows go into a ring of
+// ringSize slots; a worker only starts the row ringSize places further on
+// once the consumer has released the one before it, so memory stays
+// bounded whatever the size of the model. With no worker threads each row
+// is fetched when it is acquired. Workers are pinned as the scheduler's are.
+class HemicubeRowPipeline {
+  public:
+    HemicubeRowPipeline(FormFactorRowCache& cache, int nthreads, int ringSize);
+    ~HemicubeRowPipeline();
+    // Starts a sweep over every face, from the last face back to the first
+    // if reverse is set; the previous sweep must have been consumed
+    void beginPass(bool reverse);
+    // Blocks until the row for faceIdx is ready
+    SparseRow acquire(int faceIdx);
+    void release(int faceIdx);
+  private:
+    FormFactorRowCache& cache;
+    int nfaces;
+    bool reverse;
+    std::vector<CachedRowPtr> ring;
+    std::vector<int> ringRow;
+    std::unique_ptr<HemicubeScratch> scratch;
+
+    std::mutex mutex;
+    std::condition_variable rowReady;
+    std::condition_variable slotFree;
+    int nextPosition;
+    int released;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    int position(int faceIdx) const { return reverse ? nfaces-1-faceIdx : faceIdx; }
+    void work();
+
+    HemicubeRowPipeline();
+    HemicubeRowPipeline(const HemicubeRowPipeline&);
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "buffer.hpp"
+
+// Renders all five faces of a hemicube in a single pass over the model.
+// Each triangle is transformed once into the patch's local frame, binned to
+// the hemicube faces its bounds overlap and rasterised straight into one
+// unfolded item buffer: the top face in rows [0, gridSize) followed by the
+// four half-height side faces, each gridSize/2 rows tall.
+class HemicubeRasteriser {
+  public:
+    HemicubeRasteriser(int gridSize);
+    void render(const Model& model, int faceIdx);
+    // From eye facing n, leaving out faceIdx (-1 for none)
+    void render(const Model& model, const Vec3f& eye, const Vec3f& n, int faceIdx);
+    void accumulateFormFactors(const Buffer<float>& topFace, const Buffer<float>& sideFace, float* formFactors) const;
+    const Buffer<unsigned int>& items() const { return itemBuffer; }
+
+    // Running totals over every render, for profiling
+    long transformedVertices;
+    long rasterisedPixels;
+  private:
+    int gridSize;
+    Buffer<unsigned int> itemBuffer;
+    Buffer<float> zBuffer;
+    std::vector<int> visible;
+
+    void renderToFace(const Vec3f local[3], int hemicubeFace, unsigned int id);
+    void rasterise(const Vec3f pts[3], int rowOffset, int nRows, unsigned int id);
+    HemicubeRasteriser();
+    HemicubeRasteriser(const HemicubeRasteriser&);
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "hemicube_rasteriser.hpp"
+
+// Everything one thread needs to draw hemicubes, kept from one to the next
+// rather than allocated per face
+struct HemicubeScratch {
+  HemicubeScratch(int gridSize, int nfaces);
+
+  int gridSize;
+  HemicubeRasteriser rasteriser; // item and z buffers
+  std::vector<float> row;        // zeroed row of nfaces+1 to accumulate into
+};
+
+// One unit of work per item, run on any of the scheduler's threads
+class HemicubeJob {
+  public:
+    virtual ~HemicubeJob() {}
+    virtual void run(int item, HemicubeScratch& scratch) = 0;
+};
+
+// Threads available for drawing hemicubes; just the calling thread under
+// OPENGL, which has a single context
+int hemicubeThreads();
+
+// Binds thread to the index'th of the CPUs this process may run on, when
+// built with PIN_THREADS
+void pinThread(std::thread& thread, int index);
+
+// A fixed pool of threads, each with its own HemicubeScratch, that runs a
+// job over a range of items. The range is cut into chunks of roughly equal
+// estimated cost and dealt out in contiguous runs, one per thread. A thread
+// works through its own chunks from the front and, once they are gone,
+// steals from the back of the others', so a few expensive hemicubes don't
+// hold up the rest. The calling thread is thread 0.
+class HemicubeScheduler {
+  public:
+    HemicubeScheduler(int nthreads, int gridSize, int nfaces);
+    ~HemicubeScheduler();
+    int nthreads() const { return (int)scratch.size(); }
+    // Runs job on every item in [begin, end) and waits for them. costs is
+    // indexed by item and grown to end as needed; it gives the estimated
+    // cost of each (anything not yet measured counts as the average) and is
+    // overwritten with the seconds each item took, for the next run.
+    void run(HemicubeJob& job, int begin, int end, std::vector<float>& costs);
+  private:
+    struct Chunk {
+      int begin, end;
+    };
+    struct WorkQueue {
+      std::mutex mutex;
+      std::deque<Chunk> chunks;
+    };
+
+    std::vector<std::unique_ptr<HemicubeScratch>> scratch;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    HemicubeJob* job;
+    std::vector<float>* costs;
+    int generation;
+    int active;
+    bool stopping;
+    std::vector<std::thread> workers;
+
+    void work(int thread);
+    void drain(int thread);
+    bool take(int thread, Chunk& chunk);
+
+    HemicubeScheduler();
+    HemicubeScheduler(const HemicubeScheduler&);
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "ray_cast.hpp"
+#include "bvh.hpp"
+#include "convergence.hpp"
+
+// A face of the model, one of the four triangles an element is split into
+// at its edge midpoints, or a cluster of faces close together
+struct Element {
+  int face;       // -1 for a cluster
+  int parent;
+  int firstChild; // into the child list, -1 for a leaf
+  int nchildren;
+  Vec3f corners[3];
+  Vec3f centre;
+  float radius;   // of a sphere around the element
+  float area;     // a cluster's is the total of its faces'
+  Vec3f facingPositive, facingNegative; // area facing along +/- each axis
+  int faceBegin, faceEnd; // a cluster's faces, in the cluster order
+  Vec3f reflectivity; // a cluster's is the most of any of its faces'
+  Vec3f radiosity;
+  Vec3f gathered; // sum of F B over the element's own links
+};
+
+// receiver gathers formFactor*B from source
+struct Link {
+  int receiver;
+  int source;
+  float formFactor;
+};
+
+// Hierarchical radiosity (Hanrahan, Salzman and Aupperle) over the model's
+// faces as root elements. Every pair of faces that can see each other is
+// linked, and links carrying too much light are replaced by links to the
+// children of the larger end, so an interaction is only as fine as the
+// light crossing it needs. Link form factors are point to disc estimates
+// times the fraction of rays between the two elements that get through.
+//
+// With clustering, the faces are grouped under a bounding volume hierarchy
+// and linking starts from its root, so groups of faces far enough apart
+// (further than the sum of their radii) exchange light over one link.
+// A cluster's end of a link takes the area its faces show in the link's
+// direction, summed from the areas they show along each axis, and light
+// it receives is shared evenly between its faces.
+//
+// Refinement is BF driven: a link is split while rho F B, as a fraction of
+// the brightest emitter, is above epsilon and either end is bigger than
+// minAreaFraction of the model's area. Radiosity is gathered over the
+// links at every level and then pushed down to the leaves and pulled back
+// up, area weighted.
+class HierarchicalRadiosity {
+  public:
+    HierarchicalRadiosity(const Model& model, float epsilon, float minAreaFraction);
+    // Links every pair of faces with a non-zero form factor, refining
+    // those from the emitters straight away
+    void linkRoots();
+    // Links the clusters of a hierarchy over the faces, then refines the
+    // links from the emitters as linkRoots does
+    void linkClusters();
+    // Splits the links the oracle picks out; true if any were
+    bool refineLinks();
+    // Gathers and push-pulls until the faces' radiosity converges
+    ConvergenceReport solve(int maxPasses);
+    // The root elements' radiosity, one per face
+    void faceRadiosity(std::vector<Vec3f>& radiosity) const;
+    int nelements() const { return (int)elements.size(); }
+    int nlinks() const { return (int)links.size(); }
+    const Link& linkAt(int k) const { return links[k]; }
+    int nleaves() const;
+    const Element& element(int i) const { return elements[i]; }
+    int child(int e, int c) const { return children[elements[e].firstChild + c]; }
+    // The top cluster, -1 without clustering
+    int rootCluster() const { return root; }
+  private:
+    const Model& model;
+    RayCaster rays;
+    float epsilon;
+    float minArea;
+    float maxEmission;
+    std::vector<Element> elements;
+    std::vector<int> children;
+    std::vector<int> clusterFaces;
+    std::vector<int> clusterRank; // each face's place in clusterFaces
+    int root;
+    std::vector<Link> links;
+
+    int buildCluster(const FaceBVH& bvh, int node);
+    Vec3f samplePoint(int e, int k) const;
+    float formFactor(int receiver, int source) const;
+    bool splittable(int e) const;
+    bool overlap(int receiver, int source) const;
+    bool shouldSplit(int receiver, int source, float formFactor) const;
+    void subdivide(int e);
+    void link(int receiver, int source);
+    void linkWithin(int e);
+    void split(int receiver, int source);
+    void refine(int receiver, int source, float formFactor);
+    Vec3f pushPull(int e, const Vec3f& down);
+
+    HierarchicalRadiosity();
+};
+
+// Links the faces (or with CLUSTERING their clusters), then solves and
+// refines up to HIERARCHICAL_REFINEMENTS times, leaving each face's
+// radiosity in radiosity
+ConvergenceReport hierarchicalRadiosity(std::vector<Vec3f>& radiosity, const Model& model, float epsilon = HIERARCHICAL_EPSILON);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "buffer.hpp"
+#include "sparse_matrix.hpp"
+#include "convergence.hpp"
+
+// Krylov solvers for the gathering system (I - RF)B = E, with the three
+// channels solved side by side. Each stops once its residual relative to
+// the right hand side is below KRYLOV_TOLERANCE in every channel, or after
+// MAX_PASSES iterations; the report holds the residual after each one. A
+// breakdown (an inner product the next step divides by vanishing while
+// residual is left) stops the solve early, reported as not converged.
+
+// Conjugate gradient on the area weighted system
+//   (A/R - S)B = (A/R)E,  S = (AF + (AF)^T)/2
+// which is symmetric, and positive definite for reflectivities below 1.
+// S equals AF when the form factors are reciprocal (A_i F_ij = A_j F_ji),
+// which hemicube form factors are only approximately, so the answer is
+// close to but not exactly the gathering fixed point. Faces which reflect
+// nothing in a channel keep B = E there. Jacobi preconditioned.
+ConvergenceReport conjugateGradientRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const SparseMatrix& totalFormFactors);
+ConvergenceReport conjugateGradientRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const ChunkedBuffer<float>& totalFormFactors);
+
+// BiCGSTAB on (I - RF)B = E itself, which needs no symmetry
+ConvergenceReport biCGStabRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const SparseMatrix& totalFormFactors);
+ConvergenceReport biCGStabRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const ChunkedBuffer<float>& totalFormFactors);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. valid() is false if the file
+// could not be opened; an empty file maps to a valid, empty range.
+class MappedFile {
+  public:
+    MappedFile(const char* filename);
+    ~MappedFile();
+    bool valid() const { return isValid; }
+    const char* data() const { return begin; }
+    std::size_t size() const { return length; }
+  private:
+    bool isValid;
+    const char* begin;
+    std::size_t length;
+
+    MappedFile();
+    MappedFile(const MappedFile&);
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "face.hpp"
+
+// Flat triangle soup view of a model, for loops over every face. Vertex
+// positions and per face data are stored as separate float arrays rather
+// than Vec3f (which carries a padding float), and faces are three
+// contiguous vertex indices. Built once when the model is loaded.
+struct TriangleMesh {
+  std::vector<int> indices;
+  std::vector<float> vx, vy, vz;
+  // Per face: normal (that of the first vertex, as Model::norm(i, 0)),
+  // centroid, plane offset so that n.p + planeD = 0 on the face, and area
+  std::vector<float> nx, ny, nz;
+  std::vector<float> cx, cy, cz;
+  std::vector<float> planeD;
+  std::vector<float> areas;
+
+  void build(const std::vector<Vec3f>& verts, const std::vector<Vec3f>& norms, const std::vector<Face>& faces);
+  int nfaces() const { return (int)areas.size(); }
+  int nverts() const { return (int)vx.size(); }
+
+  inline Vec3f vert(int i) const { return Vec3f(vx[i], vy[i], vz[i]); }
+  inline Vec3f corner(int face, int j) const { return vert(indices[3*face+j]); }
+  inline Vec3f normal(int face) const { return Vec3f(nx[face], ny[face], nz[face]); }
+  inline Vec3f centroid(int face) const { return Vec3f(cx[face], cy[face], cz[face]); }
+};
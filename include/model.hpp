@@ -5,6 +5,8 @@
 #include "geometry.hpp"
 #include "material.hpp"
 #include "face.hpp"
+#include "mesh.hpp"
+#include "bvh.hpp"
 #include "tgaimage.hpp"
 
 class Model {
@@ -14,8 +16,12 @@ private:
   std::vector<Vec3f> uv_;
   std::vector<Material> materials_;
   std::vector<Face> faces_;
+  TriangleMesh mesh_;
+  FaceBVH bvh_;
 public:
-  Model(const char *objFilename, const char *mtlFilename = "");
+  // With a cacheFilename the model is read from that scene cache when it
+  // is up to date with both sources, and otherwise parsed and cached there
+  Model(const char *objFilename, const char *mtlFilename = "", const char *cacheFilename = nullptr);
   ~Model();
   // TODO fix names
   const int nverts() const;
@@ -33,4 +39,6 @@ public:
   float area(int faceIdx) const;
   Vec3f getFaceReflectivity(int faceIdx) const;
   Vec3f getFaceEmissivity(int faceIdx) const;
+  const TriangleMesh& mesh() const { return mesh_; }
+  const FaceBVH& bvh() const { return bvh_; }
 };
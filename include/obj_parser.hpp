@@ -0,0 +1,32 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <istream>
+#include <unordered_map>
+
+#include "geometry.hpp"
+#include "material.hpp"
+#include "face.hpp"
+
+typedef std::unordered_map<std::string, int> MaterialTable;
+
+struct ObjData {
+  std::vector<Vec3f> verts;
+  std::vector<Vec3f> norms;
+  std::vector<Vec3f> uvs;
+  std::vector<Face> faces;
+};
+
+// Wavefront MTL: newmtl, Kd (reflectivity) and Ke (emissivity)
+void parseMtl(const char* begin, const char* end, std::vector<Material>& materials, MaterialTable& materialsTable);
+
+// Wavefront OBJ: v, vt, vn, usemtl and f with v, v/vt, v//vn or v/vt/vn
+// corners (missing indices are -1, negative indices count back from the
+// latest element). The text is split at line boundaries into chunks which
+// are parsed in parallel and then concatenated in order.
+void parseObj(const char* begin, const char* end, const MaterialTable& materialsTable, ObjData& out);
+
+// The original line by line istringstream parser, kept as a reference for
+// tests and throughput comparisons
+void parseObjLegacy(std::istream& in, const MaterialTable& materialsTable, ObjData& out);
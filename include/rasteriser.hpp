@@ -0,0 +1,273 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "geometry.hpp"
+#include "buffer.hpp"
+
+// Edge function rasteriser. Vertices are snapped to a fixed point grid so
+// the edge functions can be stepped exactly in integers, the bounding box is
+// walked row-major in 8x8 tiles which are rejected (or accepted without
+// per-pixel edge tests) from their corners, and each tile row is depth
+// tested 8 pixels at a time with AVX2 or SSE2 lanes where available.
+//
+// Coverage matches renderTriangle: pixels are sampled at integer positions
+// and all three edges are inclusive.
+
+const int RASTER_SUBPIXEL_BITS = 4;
+const int RASTER_SUBPIXEL_SCALE = 1 << RASTER_SUBPIXEL_BITS;
+const int RASTER_TILE_SIZE = 8;
+// Beyond this the fixed point edge functions of partially covered tiles no
+// longer fit in 32 bit lanes, so those triangles take the float path
+const float RASTER_GUARD_BAND = 131072.f;
+
+// Depth is interpolated from barycentric weights in the same order of
+// operations as getBarycentricCoords, so that the depths written match
+// renderTriangle bit for bit rather than just to within rounding
+struct RasterDepth {
+  float area;
+  float z0, z1, z2;
+
+  inline float at(float e1, float e2) const {
+    float z = 0.f;
+    z += z0*(1.f - (e1+e2)/area);
+    z += z1*(e1/area);
+    z += z2*(e2/area);
+    return z;
+  }
+};
+
+// Depth tests the 8 pixels from zRow[0], writing the ones which pass. The
+// first nEdges edge functions start at edgeValues and increase by edgeSteps
+// per pixel; pixels with any negative value are outside. The unnormalised
+// barycentric weights of vertices 1 and 2 start at bary and step by
+// baryStep. Returns one bit per pixel written.
+inline int depthTestSpan(float* zRow, const RasterDepth& depth, const float bary[2], const float baryStep[2], const int32_t* edgeValues, const int32_t* edgeSteps, int nEdges) {
+#if defined(__AVX2__)
+  const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  __m256i inside = _mm256_set1_epi32(-1);
+  for(int e=0; e<nEdges; ++e) {
+    __m256i value = _mm256_add_epi32(_mm256_set1_epi32(edgeValues[e]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(edgeSteps[e])));
+    inside = _mm256_and_si256(inside, _mm256_cmpgt_epi32(value, _mm256_set1_epi32(-1)));
+  }
+  __m256 laneF = _mm256_cvtepi32_ps(lane);
+  __m256 area = _mm256_set1_ps(depth.area);
+  __m256 e1 = _mm256_add_ps(_mm256_set1_ps(bary[0]), _mm256_mul_ps(laneF, _mm256_set1_ps(baryStep[0])));
+  __m256 e2 = _mm256_add_ps(_mm256_set1_ps(bary[1]), _mm256_mul_ps(laneF, _mm256_set1_ps(baryStep[1])));
+  __m256 w0 = _mm256_sub_ps(_mm256_set1_ps(1.f), _mm256_div_ps(_mm256_add_ps(e1, e2), area));
+  __m256 zNew = _mm256_mul_ps(_mm256_set1_ps(depth.z0), w0);
+  zNew = _mm256_add_ps(zNew, _mm256_mul_ps(_mm256_set1_ps(depth.z1), _mm256_div_ps(e1, area)));
+  zNew = _mm256_add_ps(zNew, _mm256_mul_ps(_mm256_set1_ps(depth.z2), _mm256_div_ps(e2, area)));
+  __m256 zOld = _mm256_loadu_ps(zRow);
+  __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(inside), _mm256_cmp_ps(zOld, zNew, _CMP_LT_OQ));
+  _mm256_storeu_ps(zRow, _mm256_blendv_ps(zOld, zNew, pass));
+  return _mm256_movemask_ps(pass);
+#elif defined(__SSE2__)
+  int mask = 0;
+  __m128 area = _mm_set1_ps(depth.area);
+  for(int half=0; half<2; ++half) {
+    int first = 4*half;
+    __m128i inside = _mm_set1_epi32(-1);
+    for(int e=0; e<nEdges; ++e) {
+      int32_t v = edgeValues[e] + first*edgeSteps[e];
+      int32_t s = edgeSteps[e];
+      __m128i value = _mm_setr_epi32(v, v+s, v+2*s, v+3*s);
+      inside = _mm_and_si128(inside, _mm_cmpgt_epi32(value, _mm_set1_epi32(-1)));
+    }
+    __m128 laneF = _mm_setr_ps(first, first+1, first+2, first+3);
+    __m128 e1 = _mm_add_ps(_mm_set1_ps(bary[0]), _mm_mul_ps(laneF, _mm_set1_ps(baryStep[0])));
+    __m128 e2 = _mm_add_ps(_mm_set1_ps(bary[1]), _mm_mul_ps(laneF, _mm_set1_ps(baryStep[1])));
+    __m128 w0 = _mm_sub_ps(_mm_set1_ps(1.f), _mm_div_ps(_mm_add_ps(e1, e2), area));
+    __m128 zNew = _mm_mul_ps(_mm_set1_ps(depth.z0), w0);
+    zNew = _mm_add_ps(zNew, _mm_mul_ps(_mm_set1_ps(depth.z1), _mm_div_ps(e1, area)));
+    zNew = _mm_add_ps(zNew, _mm_mul_ps(_mm_set1_ps(depth.z2), _mm_div_ps(e2, area)));
+    __m128 zOld = _mm_loadu_ps(zRow + first);
+    __m128 pass = _mm_and_ps(_mm_castsi128_ps(inside), _mm_cmplt_ps(zOld, zNew));
+    _mm_storeu_ps(zRow + first, _mm_or_ps(_mm_and_ps(pass, zNew), _mm_andnot_ps(pass, zOld)));
+    mask |= _mm_movemask_ps(pass) << first;
+  }
+  return mask;
+#else
+  int mask = 0;
+  for(int k=0; k<RASTER_TILE_SIZE; ++k) {
+    bool inside = true;
+    for(int e=0; e<nEdges; ++e) {
+      inside = inside and edgeValues[e] + k*edgeSteps[e] >= 0;
+    }
+    float zNew = depth.at(bary[0] + k*baryStep[0], bary[1] + k*baryStep[1]);
+    if(inside and zRow[k] < zNew) {
+      zRow[k] = zNew;
+      mask |= 1 << k;
+    }
+  }
+  return mask;
+#endif
+}
+
+template <class fillType>
+inline void fillMasked(fillType* row, int mask, const fillType& fillValue) {
+  while(mask) {
+    row[__builtin_ctz(mask)] = fillValue;
+    mask &= mask - 1;
+  }
+}
+
+// Float edge functions, for triangles outside the guard band
+template <class fillType>
+void rasteriseTriangleUnbounded(const Vec3f pts[3], Buffer<float>& zBuffer, Buffer<fillType>& buffer, const fillType& fillValue, int rowMin, int rowMax) {
+  float area = (pts[1].x-pts[0].x)*(pts[2].y-pts[0].y) - (pts[2].x-pts[0].x)*(pts[1].y-pts[0].y);
+  if(std::abs(area) < 1.f) {
+    return;
+  }
+  float xmin = std::max(0.f, std::ceil(std::min(std::min(pts[0].x, pts[1].x), pts[2].x)));
+  float xmax = std::min(buffer.width-1.f, std::floor(std::max(std::max(pts[0].x, pts[1].x), pts[2].x)));
+  float ymin = std::max(float(rowMin), std::ceil(std::min(std::min(pts[0].y, pts[1].y), pts[2].y)));
+  float ymax = std::min(float(rowMax), std::floor(std::max(std::max(pts[0].y, pts[1].y), pts[2].y)));
+  for(float y=ymin; y<=ymax; ++y) {
+    float* zRow = zBuffer.getRow(int(y));
+    fillType* row = buffer.getRow(int(y));
+    for(float x=xmin; x<=xmax; ++x) {
+      float w[3];
+      for(int k=0; k<3; ++k) {
+        const Vec3f& a = pts[(k+1)%3];
+        const Vec3f& b = pts[(k+2)%3];
+        w[k] = ((b.x-a.x)*(y-a.y) - (b.y-a.y)*(x-a.x))/area;
+      }
+      if(w[0] < 0.f or w[1] < 0.f or w[2] < 0.f) continue;
+      float z = w[0]*pts[0].z + w[1]*pts[1].z + w[2]*pts[2].z;
+      if(zRow[int(x)] < z) {
+        zRow[int(x)] = z;
+        row[int(x)] = fillValue;
+      }
+    }
+  }
+}
+
+template <class fillType>
+void rasteriseTriangle(const Vec3f pts[3], Buffer<float>& zBuffer, Buffer<fillType>& buffer, const fillType& fillValue, int rowMin, int rowMax) {
+  for(int i=0; i<3; ++i) {
+    if(not (std::abs(pts[i].x) < RASTER_GUARD_BAND and std::abs(pts[i].y) < RASTER_GUARD_BAND)) {
+      rasteriseTriangleUnbounded(pts, zBuffer, buffer, fillValue, rowMin, rowMax);
+      return;
+    }
+  }
+
+  // Snap to fixed point, winding counter-clockwise
+  int64_t X[3], Y[3];
+  int order[3] = {0, 1, 2};
+  for(int i=0; i<3; ++i) {
+    X[i] = std::lround(pts[i].x*RASTER_SUBPIXEL_SCALE);
+    Y[i] = std::lround(pts[i].y*RASTER_SUBPIXEL_SCALE);
+  }
+  int64_t area = (X[1]-X[0])*(Y[2]-Y[0]) - (X[2]-X[0])*(Y[1]-Y[0]);
+  if(area < 0) {
+    std::swap(X[1], X[2]);
+    std::swap(Y[1], Y[2]);
+    std::swap(order[1], order[2]);
+    area = -area;
+  }
+  // Degenerate: less than one pixel of doubled area
+  if(area < RASTER_SUBPIXEL_SCALE*RASTER_SUBPIXEL_SCALE) {
+    return;
+  }
+
+  // Edge k is opposite vertex k: E(x, y) = origin + stepX*x + stepY*y for
+  // integer pixel positions
+  int64_t origin[3], stepX[3], stepY[3];
+  for(int k=0; k<3; ++k) {
+    int a = (k+1)%3;
+    int b = (k+2)%3;
+    stepX[k] = -(Y[b]-Y[a])*RASTER_SUBPIXEL_SCALE;
+    stepY[k] = (X[b]-X[a])*RASTER_SUBPIXEL_SCALE;
+    origin[k] = -(X[b]-X[a])*Y[a] + (Y[b]-Y[a])*X[a];
+  }
+
+  // Edge k gives the unnormalised barycentric weight of vertex k, so the
+  // weights of the caller's vertices 1 and 2 are those of edges order[1]
+  // and order[2]
+  RasterDepth depth;
+  depth.area = float(area);
+  depth.z0 = pts[0].z;
+  depth.z1 = pts[1].z;
+  depth.z2 = pts[2].z;
+  const int bary1 = order[1];
+  const int bary2 = order[2];
+  const float baryStep[2] = {float(stepX[bary1]), float(stepX[bary2])};
+
+  int64_t xmin = std::max<int64_t>(0, -((-std::min(std::min(X[0], X[1]), X[2])) >> RASTER_SUBPIXEL_BITS));
+  int64_t xmax = std::min<int64_t>(buffer.width-1, std::max(std::max(X[0], X[1]), X[2]) >> RASTER_SUBPIXEL_BITS);
+  int64_t ymin = std::max<int64_t>(rowMin, -((-std::min(std::min(Y[0], Y[1]), Y[2])) >> RASTER_SUBPIXEL_BITS));
+  int64_t ymax = std::min<int64_t>(rowMax, std::max(std::max(Y[0], Y[1]), Y[2]) >> RASTER_SUBPIXEL_BITS);
+
+  const int64_t tileSpan = RASTER_TILE_SIZE - 1;
+  for(int64_t ty=ymin & ~tileSpan; ty<=ymax; ty+=RASTER_TILE_SIZE) {
+    for(int64_t tx=xmin & ~tileSpan; tx<=xmax; tx+=RASTER_TILE_SIZE) {
+      // Classify the tile against each edge from its extreme corners
+      int32_t edgeValues[3], edgeSteps[3];
+      int64_t cornerValues[3];
+      int nPartial = 0;
+      int partial[3];
+      bool outside = false;
+      for(int k=0; k<3; ++k) {
+        int64_t corner = origin[k] + stepX[k]*tx + stepY[k]*ty;
+        int64_t lo = corner + std::min<int64_t>(0, stepX[k])*tileSpan + std::min<int64_t>(0, stepY[k])*tileSpan;
+        int64_t hi = corner + std::max<int64_t>(0, stepX[k])*tileSpan + std::max<int64_t>(0, stepY[k])*tileSpan;
+        if(hi < 0) {
+          outside = true;
+          break;
+        }
+        if(lo < 0) {
+          cornerValues[nPartial] = corner;
+          partial[nPartial++] = k;
+        }
+      }
+      if(outside) {
+        continue;
+      }
+
+      int64_t rowStart = std::max(ty, ymin);
+      int64_t rowEnd = std::min(ty+tileSpan, ymax);
+      bool wholeSpan = tx >= 0 and tx+RASTER_TILE_SIZE <= buffer.width;
+      for(int64_t y=rowStart; y<=rowEnd; ++y) {
+        float* zRow = zBuffer.getRow(y);
+        fillType* row = buffer.getRow(y);
+        float bary[2] = {
+          float(origin[bary1] + stepX[bary1]*tx + stepY[bary1]*y),
+          float(origin[bary2] + stepX[bary2]*tx + stepY[bary2]*y)
+        };
+        if(wholeSpan) {
+          for(int e=0; e<nPartial; ++e) {
+            int k = partial[e];
+            edgeValues[e] = int32_t(cornerValues[e] + stepY[k]*(y-ty));
+            edgeSteps[e] = int32_t(stepX[k]);
+          }
+          int mask = depthTestSpan(zRow + tx, depth, bary, baryStep, edgeValues, edgeSteps, nPartial);
+          fillMasked(row + tx, mask, fillValue);
+        } else {
+          // Tile hangs off the edge of the buffer
+          int64_t xStart = std::max(tx, xmin);
+          int64_t xEnd = std::min(tx+tileSpan, xmax);
+          for(int64_t x=xStart; x<=xEnd; ++x) {
+            bool inside = true;
+            for(int e=0; e<nPartial; ++e) {
+              int k = partial[e];
+              inside = inside and cornerValues[e] + stepX[k]*(x-tx) + stepY[k]*(y-ty) >= 0;
+            }
+            float zNew = depth.at(bary[0] + (x-tx)*baryStep[0], bary[1] + (x-tx)*baryStep[1]);
+            if(inside and zRow[x] < zNew) {
+              zRow[x] = zNew;
+              row[x] = fillValue;
+            }
+          }
+        }
+      }
+    }
+  }
+}
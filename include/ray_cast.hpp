@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cmath>
+
+#include "geometry.hpp"
+#include "model.hpp"
+
+// Segment ends closer than this (as a fraction of its length) to a face
+// don't count as crossing it
+const float RAY_END_TOLERANCE = 1e-4f;
+
+// Point to point visibility and nearest hits over a model's faces, for the
+// solvers that estimate form factors rather than rendering hemicubes.
+// Queries walk the model's BVH.
+class RayCaster {
+  public:
+    RayCaster(const Model& model);
+    // True if any face other than skipA and skipB crosses the segment
+    // between from and to, short of either end
+    bool occluded(const Vec3f& from, const Vec3f& to, int skipA, int skipB) const;
+    // The same, past every face for which skip(face) is true
+    template <class Skip>
+    bool occluded(const Vec3f& from, const Vec3f& to, const Skip& skip) const {
+      return bvh.anyHit(from, to - from, RAY_END_TOLERANCE, 1.f - RAY_END_TOLERANCE, skip);
+    }
+    // The nearest face other than skip that the ray from + t*dir, t > 0,
+    // hits, with its t; -1 if none
+    int firstHit(const Vec3f& from, const Vec3f& dir, int skip, float& t) const;
+  private:
+    const FaceBVH& bvh;
+
+    RayCaster();
+};
+
+// Unoccluded form factor from a point to a disc of the given area,
+//   A cos(theta_x) cos(theta_y) / (pi r^2 + A)
+// which stays below 1 however close the two get
+inline float pointToDiscFormFactor(const Vec3f& x, const Vec3f& nx, const Vec3f& y, const Vec3f& ny, float area) {
+  Vec3f d = y - x;
+  float r2 = d.norm2();
+  float r = std::sqrt(r2);
+  float cosX = nx.dot(d)/r;
+  float cosY = -ny.dot(d)/r;
+  if(r2 == 0.f or cosX <= 0.f or cosY <= 0.f) {
+    return 0.f;
+  }
+  return area*cosX*cosY/(float(M_PI)*r2 + area);
+}
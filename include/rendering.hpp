@@ -6,29 +6,40 @@
 #include "tgaimage.hpp"
 #include "geometry.hpp"
 #include "buffer.hpp"
+#include "sparse_matrix.hpp"
+#include "form_factor_stream.hpp"
 #include "model.hpp"
 #include "colours.hpp"
+#include "rasteriser.hpp"
 
 void renderColourBuffer(const GLubyte* buffer, const int size, std::string filename);
 void renderColourBuffer(const Buffer<TGAColor>& buffer, TGAImage& image);
 void renderColourBuffer(const Buffer<TGAColor>& buffer, std::string filename);
 void renderZBuffer(const Buffer<float>& zBuffer, TGAImage& image);
 void renderZBuffer(const Buffer<float>& zBuffer, std::string filename);
-void renderWireFrame(const Model& model, Buffer<TGAColor>& buffer, const Matrix& MVP);
-void renderModelReflectivity(Buffer<TGAColor>& buffer, const Model& model, const Matrix& MVP, const Vec3f& eye, float nearPlane);
-void renderModelRadiosity(Buffer<TGAColor>& buffer, const Model& model, const Matrix& MVP, const Vec3f& eye, float nearPlane, std::vector<Vec3f>& radiosity);
-void renderModelIds(Buffer<unsigned int>& buffer, const Model& model, const Matrix& MVP, const Vec3f& eye, float nearPlane);
+void renderWireFrame(const Model& model, Buffer<TGAColor>& buffer, const Mat4& MVP);
+void renderModelReflectivity(Buffer<TGAColor>& buffer, const Model& model, const Mat4& MVP, const Vec3f& eye, float nearPlane);
+void renderModelRadiosity(Buffer<TGAColor>& buffer, const Model& model, const Mat4& MVP, const Vec3f& eye, float nearPlane, std::vector<Vec3f>& radiosity);
+void renderModelIds(Buffer<unsigned int>& buffer, const Model& model, const Mat4& MVP, const Vec3f& eye, float nearPlane);
 void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, Buffer<float>& totalFormFactors);
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const ChunkedBuffer<float>& totalFormFactors);
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const SparseMatrix& totalFormFactors);
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, FormFactorStream& totalFormFactors);
 void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize);
 void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize);
 void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, Buffer<float>& totalFormFactors);
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const ChunkedBuffer<float>& totalFormFactors);
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const SparseMatrix& totalFormFactors);
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, FormFactorStream& totalFormFactors);
 void normaliseRadiosity(std::vector<Vec3f>& radiosity);
 
 Vec3f interpolate(const Vec3f& v0, const Vec3f& v1, float t);
 float clipLineZ(const Vec3f& v0, const Vec3f& v1, float nearPlane);
-std::vector<Vec4f> transformFace(const Face& face, const Model& model, const Matrix& MVP);
+void transformFace(const Face& face, const Model& model, const Mat4& MVP, Vec4f outScreenCoords[3]);
+std::vector<Vec4f> transformFace(const Face& face, const Model& model, const Mat4& MVP);
 TGAColor getFaceColour(const Face& face, const Model& model);
 int clipTriangle(std::vector<Vec4f>& pts, float nearPlane);
+int clipTriangle(Vec4f pts[6], float nearPlane);
 void renderInterpolatedTriangle(const std::vector<Vec3f>& pts, Buffer<TGAColor> &buffer, const Vec3f intensities[3]);
 void renderVertexRadiosityToTexture(const Model& model, const std::vector<Vec3f>& radiosity, int size, std::string filename);
 void radiosityFaceToVertex(std::vector<Vec3f>& vertexRadiosity, const Model& model, const std::vector<Vec3f>& faceRadiosity);
@@ -58,15 +69,9 @@ void renderLine(int x0, int y0, int x1, int y1, Buffer<T> &buffer, const T& fill
   }
 }
 
-template <class fillType, class zBufferType>
-void renderTriangle(const Vec3f& v1, const Vec3f& v2, const Vec3f& v3, Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
-  std::vector<Vec3f> pts({v1, v2, v3});
-  renderTriangle(pts, zBuffer, buffer, fillValue);
-}
-
 // No interpolation of fillValue
 template <class fillType, class zBufferType>
-void renderTriangle(const std::vector<Vec3f>& pts, Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
+void renderTriangle(const Vec3f pts[3], Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
   // Create bounding box
   Vec2f bboxmin(buffer.width-1, buffer.height-1);
   Vec2f bboxmax(0, 0);
@@ -97,6 +102,30 @@ void renderTriangle(const std::vector<Vec3f>& pts, Buffer<zBufferType>& zBuffer,
   }
 }
 
+#ifdef EDGE_FUNCTION_RASTERISER
+// Float z-buffers go through the edge function rasteriser
+template <class fillType>
+void renderTriangle(const Vec3f pts[3], Buffer<float>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
+  rasteriseTriangle(pts, zBuffer, buffer, fillValue, 0, buffer.height-1);
+}
+
+template <class fillType>
+void renderTriangle(const std::vector<Vec3f>& pts, Buffer<float>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
+  rasteriseTriangle(pts.data(), zBuffer, buffer, fillValue, 0, buffer.height-1);
+}
+#endif
+
+template <class fillType, class zBufferType>
+void renderTriangle(const std::vector<Vec3f>& pts, Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
+  renderTriangle<fillType, zBufferType>(pts.data(), zBuffer, buffer, fillValue);
+}
+
+template <class fillType, class zBufferType>
+void renderTriangle(const Vec3f& v1, const Vec3f& v2, const Vec3f& v3, Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue) {
+  const Vec3f pts[3] = {v1, v2, v3};
+  renderTriangle(pts, zBuffer, buffer, fillValue);
+}
+
 // No ZBuffer
 template <class fillType>
 void renderTriangle(const std::vector<Vec3f>& pts, Buffer<fillType> &buffer, const fillType& fillValue) {
@@ -122,22 +151,31 @@ void renderTriangle(const std::vector<Vec3f>& pts, Buffer<fillType> &buffer, con
   }
 }
 
+// pts needs room for the second triangle if clipping splits it
 template <class fillType, class zBufferType>
-void clipAndRenderTriangle(std::vector<Vec4f>& pts, Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue, float nearPlane) {
+void clipAndRenderTriangle(Vec4f pts[6], Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue, float nearPlane) {
   int numTriangles = clipTriangle(pts, nearPlane);
   for(int i=0; i<numTriangles*3; ++i) {
     pts[i].homogenise();
   }
-  Matrix viewport = viewportRelative(0, 0, buffer.width, buffer.height);
+  Mat4 viewport = viewportRelative(0, 0, buffer.width, buffer.height);
   for(int i=0; i<numTriangles*3; i+=3) {
     // Transform into viewport
+    Vec3f screen[3];
     for(int j=0; j<3; ++j) {
       pts[j+i] = viewport*pts[j+i];
+      screen[j] = pts[j+i];
     }
-    renderTriangle(pts[i+0], pts[i+1], pts[i+2], zBuffer, buffer, fillValue);
+    renderTriangle(screen, zBuffer, buffer, fillValue);
   }
 }
 
+template <class fillType, class zBufferType>
+void clipAndRenderTriangle(std::vector<Vec4f>& pts, Buffer<zBufferType>& zBuffer, Buffer<fillType> &buffer, const fillType& fillValue, float nearPlane) {
+  pts.resize(6);
+  clipAndRenderTriangle(pts.data(), zBuffer, buffer, fillValue, nearPlane);
+}
+
 template <class T>
 void renderIdsToColour(const Buffer<T>& itemBuffer, const Model& model, std::string fileName) {
   Buffer<TGAColor> colourBuffer(itemBuffer.width, itemBuffer.height, black);
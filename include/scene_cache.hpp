@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "material.hpp"
+#include "mesh.hpp"
+#include "obj_parser.hpp"
+
+const uint32_t SCENE_CACHE_VERSION = 1;
+
+// Identifies the contents of a source file. A cache is reused when size
+// and mtime match; if only the mtime differs (a fresh checkout, say) the
+// contents are hashed and compared instead.
+struct SourceStamp {
+  uint64_t size;
+  int64_t mtime;
+  uint64_t hash;
+};
+
+struct SceneCacheHeader {
+  char magic[4];
+  uint32_t version;
+  SourceStamp obj;
+  SourceStamp mtl;
+};
+
+uint64_t hashBytes(const char* data, std::size_t size);
+bool stampSource(const char* filename, SourceStamp& stamp, bool withHash);
+
+// Binary snapshot of a loaded model: materials, the parsed OBJ arrays and
+// the precomputed mesh, so a reload skips parsing and preprocessing.
+// Reading fails (leaving the outputs untouched) if the cache is missing,
+// from another version, stale against either source file or indexes out
+// of its own arrays. A source that was only touched has its new mtime
+// written back, so it isn't hashed again next time.
+bool readSceneCache(const char* cacheFilename, const char* objFilename, const char* mtlFilename, std::vector<Material>& materials, ObjData& data, TriangleMesh& mesh);
+bool writeSceneCache(const char* cacheFilename, const char* objFilename, const char* mtlFilename, const std::vector<Material>& materials, const ObjData& data, const TriangleMesh& mesh);
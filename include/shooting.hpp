@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "sparse_matrix.hpp"
+#include "form_factor_rows.hpp"
+
+// Sources per block dealt out to the lanes
+const int SHOOTING_BLOCK = 64;
+
+// Shooting from a face scatters into every face it can see, so sources
+// can't simply be split between threads. Instead blocks of sources are
+// dealt out round robin to a fixed number of lanes, each accumulating into
+// its own arrays, and at the end of a pass the lanes are summed in order.
+// Lanes can run on any number of threads with bitwise identical results.
+class ShootingLanes {
+  public:
+    ShootingLanes(const Model& model, int nlanes);
+    int nlanes() const { return (int)lanes.size(); }
+    int nblocks() const { return (model.nfaces() + SHOOTING_BLOCK - 1)/SHOOTING_BLOCK; }
+    int laneOf(int faceIdx) const { return (faceIdx/SHOOTING_BLOCK) % nlanes(); }
+    // Adds diff_i A_i F_ij / A_j to face j in the lane
+    void shoot(int lane, int faceIdx, const Vec3f& radiosityDiff, const SparseRow& formFactors);
+    void shoot(int lane, int faceIdx, const Vec3f& radiosityDiff, const float* formFactors);
+    // Adds flux/A_j to face j in the lane
+    void deposit(int lane, int faceIdx, const Vec3f& flux);
+    // radiosityGathered_j = rho_j * (sum of the lanes), clearing the lanes
+    void reduce(std::vector<Vec3f>& radiosityGathered);
+  private:
+    const Model& model;
+    std::vector<float> inverseAreas;
+    std::vector<RadiosityChannels> lanes;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "geometry.hpp"
+#include "model.hpp"
+
+// Renders and writes the solvers' progress images (<prefix><pass>.tga) on
+// a background thread, from a copy of the radiosity, so a solve never
+// waits on image I/O. A pass is written if it is a multiple of everyPasses
+// or everySeconds have gone by since the last one; with both 0 nothing is
+// written. At most maxQueued snapshots wait to be written; past that the
+// newest waiting one is replaced. Anything queued is written before the
+// destructor returns.
+class SnapshotWriter {
+  public:
+    SnapshotWriter(const Model& model, int size, int everyPasses, float everySeconds, int maxQueued, const std::string& prefix);
+    // 1200 pixel output<pass>.tga at the cadence set in the Makefile
+    explicit SnapshotWriter(const Model& model);
+    ~SnapshotWriter();
+    bool enabled() const { return everyPasses > 0 or everySeconds > 0.f; }
+    // Queues the pass if it is due
+    void offer(int pass, const std::vector<Vec3f>& radiosity);
+    // Queues it regardless of the cadence, if snapshots are enabled
+    void write(int pass, const std::vector<Vec3f>& radiosity);
+    int written() const;
+    // Snapshots replaced in the queue before they were written
+    int dropped() const;
+  private:
+    struct Snapshot {
+      std::string filename;
+      std::vector<Vec3f> radiosity;
+    };
+
+    const Model& model;
+    int size;
+    int everyPasses;
+    float everySeconds;
+    int maxQueued;
+    std::string prefix;
+    std::chrono::steady_clock::time_point lastQueued;
+
+    mutable std::mutex mutex;
+    std::condition_variable queued;
+    std::deque<Snapshot> queue;
+    int nwritten;
+    int ndropped;
+    bool stopping;
+    std::thread writer;
+
+    void start();
+    void work();
+
+    SnapshotWriter();
+    SnapshotWriter(const SnapshotWriter&);
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "sparse_matrix.hpp"
+
+// The heap is rebuilt once it holds this many entries per face
+const int SOUTHWELL_HEAP_SLACK = 4;
+
+// Faces by unshot flux, largest first. Changing a face's flux leaves its
+// old entry in the heap, recognised on the way out by no longer matching;
+// once they build up to SOUTHWELL_HEAP_SLACK entries per face the heap is
+// rebuilt from the current fluxes, so it stays O(nfaces).
+class FluxQueue {
+  public:
+    explicit FluxQueue(int nfaces): current(nfaces, 0.f) {}
+    float flux(int i) const { return current[i]; }
+    // Sets face i's flux, queueing it if there is any
+    void set(int i, float flux);
+    // Removes the face with the most flux, leaving it 0; -1 once none has any
+    int pop();
+    std::size_t size() const { return heap.size(); }
+  private:
+    typedef std::pair<float, int> Entry;
+    std::vector<float> current;
+    std::vector<Entry> heap;
+};
+
+// Southwell progressive refinement: rather than sweeping every face each
+// pass, always shoot from the face with the most unshot flux (unshot
+// radiosity times area), stopping once the unshot flux left is below
+// energyCutoff of the flux emitted. Without form factors each shot renders
+// just the one hemicube it needs, so the early images come from a few
+// hemicubes rather than a full pass. Returns the number of shots.
+int southwellRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, float energyCutoff = DIFF_TO_TOTAL_CUTOFF);
+int southwellRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const SparseMatrix& totalFormFactors, float energyCutoff = DIFF_TO_TOTAL_CUTOFF);
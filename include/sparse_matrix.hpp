@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+// Read-only view of one row of a SparseMatrix
+struct SparseRow {
+  int size;
+  const int* indices;
+  const float* values;
+};
+
+// Compressed sparse row storage for form factors. Row i holds the form
+// factors from face i to every face it can see, indexed by face (not by
+// item buffer id, so there is no background column) and without the
+// diagonal. Rows are appended in order, or the whole matrix can be a read
+// only view of arrays owned elsewhere (such as a memory mapped file).
+class SparseMatrix {
+  public:
+    SparseMatrix();
+    SparseMatrix(const SparseMatrix& m);
+    SparseMatrix& operator=(const SparseMatrix& m);
+    static SparseMatrix view(std::shared_ptr<const void> owner, int nrows, const std::size_t* rowStart, const int* indices, const float* values);
+    int nrows() const { return nrowsView; }
+    std::size_t nonZeros() const { return rowStartView[nrowsView]; }
+    std::size_t memoryUsage() const;
+    void reserve(int nrows, std::size_t nonZeros);
+    void appendRow(const std::vector<int>& rowIndices, const std::vector<float>& rowValues);
+    SparseRow getRow(int i) const;
+    float get(int i, int j) const;
+
+    static void compressRow(float* formFactors, int nfaces, int faceIdx, std::vector<int>& rowIndices, std::vector<float>& rowValues);
+  private:
+    std::vector<std::size_t> rowStart;
+    std::vector<int> indices;
+    std::vector<float> values;
+
+    // Rows are always read through these, which point either at the
+    // vectors above or into owner
+    std::shared_ptr<const void> owner;
+    int nrowsView;
+    const std::size_t* rowStartView;
+    const int* indicesView;
+    const float* valuesView;
+    void refreshView();
+};
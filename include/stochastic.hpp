@@ -0,0 +1,28 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "convergence.hpp"
+
+// Shares nrays between the faces in proportion to their unshot power,
+// A_i (diff_i.r + diff_i.g + diff_i.b), by systematic sampling: with the
+// shares laid end to end from offset (in [0, 1)), a face gets the whole
+// numbers its share covers, so its count is its share rounded up or down.
+// Returns the total unshot power.
+double allocateRays(const Model& model, const std::vector<Vec3f>& diff, int nrays, double offset, std::vector<int>& rays);
+
+// Stochastic Jacobi radiosity. Each pass shoots every face's unshot
+// radiosity along random rays, raysPerPass shared between the faces by
+// allocateRays, and each ray leaves the power it carries on the first face
+// it hits. No form factors are stored, so memory is O(N), and rays are
+// independent, so they are shot in lanes like progressive shooting.
+//
+// Variance is reduced by the systematic ray allocation, and by taking each
+// face's ray origins and cosine weighted directions from a randomly shifted
+// Kronecker sequence rather than independent random numbers. Each face
+// draws from its own seed for the pass, so results don't depend on the
+// number of threads.
+ConvergenceReport stochasticRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int raysPerPass = STOCHASTIC_RAYS_PER_PASS, uint64_t seed = STOCHASTIC_SEED);
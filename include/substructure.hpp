@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.hpp"
+#include "model.hpp"
+#include "sparse_matrix.hpp"
+#include "convergence.hpp"
+
+// Faces grouped into patches: edge connected runs of coplanar faces of one
+// material, each at most maxFaces. Patch p's faces are
+// faces[start[p]..start[p+1]).
+struct Patches {
+  std::vector<int> patchOf;
+  std::vector<int> start;
+  std::vector<int> faces;
+  std::vector<float> areas;
+  std::vector<Vec3f> centres; // area weighted centroid
+  std::vector<Vec3f> normals;
+
+  int npatches() const { return (int)areas.size(); }
+};
+
+void groupCoplanarFaces(const Model& model, int maxFaces, Patches& patches);
+
+// Row p holds the form factors from patch p, seen from its centre, to
+// every face
+void calcPatchFormFactors(const Model& model, const Patches& patches, SparseMatrix& formFactors, int gridSize);
+
+// Substructured gathering (Cohen et al.): patches shoot, faces receive.
+// Each face gathers from every patch, taking the patch's radiosity as the
+// area weighted mean of its faces',
+//   B_i = E_i + rho_i sum_p B_p F_pi A_p/A_i
+// so only one hemicube is drawn per patch while every face still gets its
+// own radiosity.
+ConvergenceReport substructuredRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const Patches& patches, const SparseMatrix& patchFormFactors);
@@ -0,0 +1,327 @@
+#include <cassert>
+#include <thread>
+
+#include "bvh.hpp"
+
+// Centroids are binned this finely along each axis to place SAH splits
+const int BVH_BINS = 16;
+// Leaves hold at most this many faces, unless they can't be split
+const int BVH_MAX_LEAF_FACES = 4;
+// Subtrees with fewer faces than this aren't worth a thread
+const int BVH_PARALLEL_FACES = 4096;
+
+struct Bounds {
+  Vec3f lo, hi;
+
+  Bounds():
+    lo(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+    hi(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()) {}
+  void grow(const Vec3f& p) {
+    for(int a=0; a<3; ++a) {
+      lo[a] = std::min(lo[a], p[a]);
+      hi[a] = std::max(hi[a], p[a]);
+    }
+  }
+  void grow(const Bounds& b) {
+    if(b.empty()) {
+      return;
+    }
+    grow(b.lo);
+    grow(b.hi);
+  }
+  bool empty() const { return lo.x > hi.x; }
+  float halfArea() const {
+    if(empty()) {
+      return 0.f;
+    }
+    Vec3f d = hi - lo;
+    return d.x*d.y + d.y*d.z + d.z*d.x;
+  }
+};
+
+// Per face bounds and centroids, shared by every build thread
+class BVHBuilder {
+  public:
+    BVHBuilder(const TriangleMesh& mesh, std::vector<int>& order):
+      order(order),
+      faceBounds(mesh.nfaces()),
+      centroids(mesh.nfaces()),
+      threads(std::max(1u, std::thread::hardware_concurrency()))
+    {
+      for(int i=0; i<mesh.nfaces(); ++i) {
+        for(int j=0; j<3; ++j) {
+          faceBounds[i].grow(mesh.corner(i, j));
+        }
+        centroids[i] = (faceBounds[i].lo + faceBounds[i].hi)*0.5f;
+      }
+    }
+
+    // Appends the subtree over order[begin..end) to nodes; the indices of
+    // right children are from the start of nodes
+    void build(int begin, int end, int depth, BVHNodes& nodes);
+  private:
+    std::vector<int>& order;
+    std::vector<Bounds> faceBounds;
+    std::vector<Vec3f> centroids;
+    unsigned threads;
+
+    int split(int begin, int end, int depth, const Bounds& centres);
+};
+
+class CentroidLess {
+  public:
+    CentroidLess(const std::vector<Vec3f>& centroids, int axis): centroids(centroids), axis(axis) {}
+    bool operator()(int a, int b) const { return centroids[a][axis] < centroids[b][axis]; }
+  private:
+    const std::vector<Vec3f>& centroids;
+    int axis;
+};
+
+class InLowerBins {
+  public:
+    InLowerBins(const std::vector<Vec3f>& centroids, int axis, float lo, float scale, int bin):
+      centroids(centroids), axis(axis), lo(lo), scale(scale), bin(bin) {}
+    bool operator()(int face) const { return binOf(centroids[face][axis], lo, scale) < bin; }
+    static int binOf(float x, float lo, float scale) {
+      return std::min(BVH_BINS - 1, std::max(0, int((x - lo)*scale)));
+    }
+  private:
+    const std::vector<Vec3f>& centroids;
+    int axis;
+    float lo, scale;
+    int bin;
+};
+
+// Where to split order[begin..end), or begin to make a leaf. Picks the
+// cheapest bin boundary by SAH over all three axes.
+int BVHBuilder::split(int begin, int end, int depth, const Bounds& centres) {
+  int count = end - begin;
+  if(count <= 1) {
+    return begin;
+  }
+  Vec3f extent = centres.hi - centres.lo;
+  int longest = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  if(depth >= BVH_SAH_DEPTH or extent[longest] <= 0.f) {
+    if(count <= BVH_MAX_LEAF_FACES) {
+      return begin;
+    }
+    int middle = (begin + end)/2;
+    std::nth_element(order.begin()+begin, order.begin()+middle, order.begin()+end, CentroidLess(centroids, longest));
+    return middle;
+  }
+
+  float bestCost = std::numeric_limits<float>::max();
+  int bestAxis = -1, bestBin = 0;
+  for(int axis=0; axis<3; ++axis) {
+    if(extent[axis] <= 0.f) {
+      continue;
+    }
+    float scale = BVH_BINS/extent[axis];
+    Bounds bins[BVH_BINS];
+    int counts[BVH_BINS] = {0};
+    for(int k=begin; k<end; ++k) {
+      int face = order[k];
+      int bin = InLowerBins::binOf(centroids[face][axis], centres.lo[axis], scale);
+      bins[bin].grow(faceBounds[face]);
+      ++counts[bin];
+    }
+    // Sweep from the right, then from the left, costing each boundary
+    float rightCost[BVH_BINS];
+    Bounds right;
+    int rightCount = 0;
+    for(int b=BVH_BINS-1; b>0; --b) {
+      right.grow(bins[b]);
+      rightCount += counts[b];
+      rightCost[b] = right.halfArea()*rightCount;
+    }
+    Bounds left;
+    int leftCount = 0;
+    for(int b=1; b<BVH_BINS; ++b) {
+      left.grow(bins[b-1]);
+      leftCount += counts[b-1];
+      float cost = left.halfArea()*leftCount + rightCost[b];
+      if(leftCount > 0 and leftCount < count and cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestBin = b;
+      }
+    }
+  }
+
+  Bounds all;
+  for(int k=begin; k<end; ++k) {
+    all.grow(faceBounds[order[k]]);
+  }
+  // As a leaf a ray tests every face; split, it tests one more box and then
+  // the faces of the children it reaches
+  bool cheaperAsLeaf = bestAxis < 0 or bestCost >= all.halfArea()*(count - 1);
+  if(count <= BVH_MAX_LEAF_FACES and cheaperAsLeaf) {
+    return begin;
+  }
+  if(bestAxis < 0) {
+    int middle = (begin + end)/2;
+    std::nth_element(order.begin()+begin, order.begin()+middle, order.begin()+end, CentroidLess(centroids, longest));
+    return middle;
+  }
+  InLowerBins inLower(centroids, bestAxis, centres.lo[bestAxis], BVH_BINS/extent[bestAxis], bestBin);
+  return int(std::partition(order.begin()+begin, order.begin()+end, inLower) - order.begin());
+}
+
+// Builds the left subtree into nodes of its own
+class BVHSubtreeJob {
+  public:
+    BVHSubtreeJob(BVHBuilder& builder, int begin, int end, int depth, BVHNodes& nodes):
+      builder(builder), begin(begin), end(end), depth(depth), nodes(nodes) {}
+    void operator()() { builder.build(begin, end, depth, nodes); }
+  private:
+    BVHBuilder& builder;
+    int begin, end, depth;
+    BVHNodes& nodes;
+};
+
+void BVHBuilder::build(int begin, int end, int depth, BVHNodes& nodes) {
+  Bounds bounds, centres;
+  for(int k=begin; k<end; ++k) {
+    bounds.grow(faceBounds[order[k]]);
+    centres.grow(centroids[order[k]]);
+  }
+  int index = (int)nodes.size();
+  BVHNode node;
+  for(int a=0; a<3; ++a) {
+    node.lo[a] = bounds.lo[a];
+    node.hi[a] = bounds.hi[a];
+  }
+  node.first = begin;
+  node.count = end - begin;
+  nodes.push_back(node);
+
+  int middle = split(begin, end, depth, centres);
+  if(middle == begin) {
+    return;
+  }
+  nodes[index].count = 0;
+  if(end - begin >= BVH_PARALLEL_FACES and depth < 16 and (1u << depth) < threads) {
+    BVHNodes leftNodes;
+    std::thread left(BVHSubtreeJob(*this, begin, middle, depth+1, leftNodes));
+    BVHNodes rightNodes;
+    build(middle, end, depth+1, rightNodes);
+    left.join();
+    // Renumber the right children of both subtrees for where they land
+    int leftBase = index + 1;
+    int rightBase = leftBase + (int)leftNodes.size();
+    for(std::size_t k=0; k<leftNodes.size(); ++k) {
+      if(not leftNodes[k].leaf()) {
+        leftNodes[k].first += leftBase;
+      }
+    }
+    for(std::size_t k=0; k<rightNodes.size(); ++k) {
+      if(not rightNodes[k].leaf()) {
+        rightNodes[k].first += rightBase;
+      }
+    }
+    nodes.insert(nodes.end(), leftNodes.begin(), leftNodes.end());
+    nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+    nodes[index].first = rightBase;
+  } else {
+    build(begin, middle, depth+1, nodes);
+    nodes[index].first = (int)nodes.size();
+    build(middle, end, depth+1, nodes);
+  }
+}
+
+void FaceBVH::build(const TriangleMesh& mesh) {
+  nodes.clear();
+  order.resize(mesh.nfaces());
+  for(int i=0; i<mesh.nfaces(); ++i) {
+    order[i] = i;
+  }
+  if(mesh.nfaces() > 0) {
+    BVHBuilder builder(mesh, order);
+    builder.build(0, mesh.nfaces(), 0, nodes);
+  }
+
+  triangles.resize(order.size());
+  for(std::size_t k=0; k<order.size(); ++k) {
+    Vec3f v0 = mesh.corner(order[k], 0);
+    Vec3f e1 = mesh.corner(order[k], 1) - v0;
+    Vec3f e2 = mesh.corner(order[k], 2) - v0;
+    for(int a=0; a<3; ++a) {
+      triangles[k].v0[a] = v0[a];
+      triangles[k].e1[a] = e1[a];
+      triangles[k].e2[a] = e2[a];
+    }
+  }
+}
+
+// The box corner furthest along and furthest against the plane's normal
+inline float planeDistance(const Vec4f& plane, const BVHNode& node, bool furthest) {
+  float d = plane.w;
+  const float n[3] = {plane.x, plane.y, plane.z};
+  for(int a=0; a<3; ++a) {
+    d += n[a]*((n[a] > 0.f) == furthest ? node.hi[a] : node.lo[a]);
+  }
+  return d;
+}
+
+void FaceBVH::frustumQuery(const Vec4f* planes, int nplanes, std::vector<int>& out) const {
+  if(nodes.empty()) {
+    return;
+  }
+  int stack[BVH_STACK_DEPTH];
+  int top = 0;
+  stack[top++] = 0;
+  while(top > 0) {
+    int index = stack[--top];
+    assert(top + 2 <= BVH_STACK_DEPTH);
+    const BVHNode& node = nodes[index];
+    bool inside = true;
+    bool outside = false;
+    for(int p=0; p<nplanes and not outside; ++p) {
+      outside = planeDistance(planes[p], node, true) < 0.f;
+      inside = inside and planeDistance(planes[p], node, false) >= 0.f;
+    }
+    if(outside) {
+      continue;
+    }
+    if(not node.leaf() and not inside) {
+      stack[top++] = node.first;
+      stack[top++] = index + 1;
+      continue;
+    }
+    // Every face below a node wholly inside, or those of a cut leaf that
+    // reach inside every plane
+    int begin = node.first;
+    int end = node.first + node.count;
+    if(not node.leaf()) {
+      int last = index;
+      while(not nodes[last].leaf()) {
+        last = nodes[last].first;
+      }
+      int firstLeaf = index;
+      while(not nodes[firstLeaf].leaf()) {
+        ++firstLeaf;
+      }
+      begin = nodes[firstLeaf].first;
+      end = nodes[last].first + nodes[last].count;
+    }
+    for(int k=begin; k<end; ++k) {
+      bool reaches = true;
+      if(not inside) {
+        const BVHTriangle& tri = triangles[k];
+        Vec3f v0(tri.v0[0], tri.v0[1], tri.v0[2]);
+        Vec3f corners[3] = {v0, v0 + Vec3f(tri.e1[0], tri.e1[1], tri.e1[2]), v0 + Vec3f(tri.e2[0], tri.e2[1], tri.e2[2])};
+        for(int p=0; p<nplanes and reaches; ++p) {
+          const Vec4f& plane = planes[p];
+          float d = -std::numeric_limits<float>::max();
+          for(int j=0; j<3; ++j) {
+            d = std::max(d, plane.x*corners[j].x + plane.y*corners[j].y + plane.z*corners[j].z + plane.w);
+          }
+          reaches = d >= 0.f;
+        }
+      }
+      if(reaches) {
+        out.push_back(order[k]);
+      }
+    }
+  }
+}
@@ -0,0 +1,69 @@
+#include <algorithm>
+
+#include "convergence.hpp"
+
+std::ostream& operator<<(std::ostream& s, const ConvergenceReport& report) {
+  s << report.method << (report.converged ? " converged" : " did not converge")
+    << " after " << report.passes << " passes" << std::endl;
+  for(std::size_t i=0; i<report.history.size(); ++i) {
+    s << "  pass " << i << ": " << report.history[i].relativeChange() << std::endl;
+  }
+  return s;
+}
+
+float PassMetrics::relativeChange() const {
+  float relative = 0.f;
+  for(int k=0; k<3; ++k) {
+    if(change[k] > 0.f) {
+      relative = std::max(relative, total[k] > 0.f ? change[k]/total[k] : INFINITY);
+    }
+  }
+  return relative;
+}
+
+std::ostream& operator<<(std::ostream& s, const PassMetrics& metrics) {
+  s << "Pass " << metrics.pass << ": relative change " << metrics.relativeChange() << ", max residual "
+    << metrics.maxResidual.r << " " << metrics.maxResidual.g << " " << metrics.maxResidual.b;
+  return s;
+}
+
+ConvergenceTracker::ConvergenceTracker(const char* method): tolerance(DIFF_TO_TOTAL_CUTOFF, DIFF_TO_TOTAL_CUTOFF, DIFF_TO_TOTAL_CUTOFF), progress(method) {
+  start(std::vector<Vec3f>());
+}
+
+ConvergenceTracker::ConvergenceTracker(const Vec3f& tolerance, const char* method): tolerance(tolerance), progress(method) {
+  start(std::vector<Vec3f>());
+}
+
+void ConvergenceTracker::start(const std::vector<Vec3f>& radiosity) {
+  for(int k=0; k<3; ++k) {
+    total[k] = change[k] = 0.0;
+    maxResidual[k] = 0.f;
+  }
+  for(std::size_t i=0; i<radiosity.size(); ++i) {
+    for(int k=0; k<3; ++k) {
+      total[k] += radiosity[i][k];
+    }
+  }
+  progress.history.clear();
+  progress.passes = 0;
+  progress.converged = false;
+}
+
+bool ConvergenceTracker::endPass() {
+  PassMetrics metrics;
+  metrics.pass = progress.passes;
+  metrics.converged = true;
+  for(int k=0; k<3; ++k) {
+    metrics.total[k] = (float)total[k];
+    metrics.change[k] = (float)change[k];
+    metrics.maxResidual[k] = maxResidual[k];
+    metrics.converged = metrics.converged and change[k] <= tolerance[k]*total[k];
+    change[k] = 0.0;
+    maxResidual[k] = 0.f;
+  }
+  progress.history.push_back(metrics);
+  progress.passes = (int)progress.history.size();
+  progress.converged = metrics.converged;
+  return metrics.converged;
+}
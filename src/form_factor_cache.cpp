@@ -0,0 +1,154 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include "form_factor_cache.hpp"
+#include "scene_cache.hpp"
+#include "mapped_file.hpp"
+
+template <class T>
+void hashArray(uint64_t& hash, const std::vector<T>& values) {
+  uint64_t partial = hashBytes(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+  hash = (hash ^ partial)*1099511628211ull;
+}
+
+// The build options that change what the hemicubes see
+const char* hemicubeRenderer() {
+#if defined(OPENGL)
+  return "opengl";
+#elif defined(EDGE_FUNCTION_RASTERISER)
+  return "edge function";
+#else
+  return "barycentric";
+#endif
+}
+
+uint64_t formFactorCacheKey(const Model& model, int gridSize, float nearPlane) {
+  const TriangleMesh& mesh = model.mesh();
+  uint64_t hash = FORM_FACTOR_CACHE_VERSION;
+  hashArray(hash, mesh.vx);
+  hashArray(hash, mesh.vy);
+  hashArray(hash, mesh.vz);
+  hashArray(hash, mesh.indices);
+  hashArray(hash, mesh.nx);
+  hashArray(hash, mesh.ny);
+  hashArray(hash, mesh.nz);
+  hashArray(hash, std::vector<int>(1, gridSize));
+  hashArray(hash, std::vector<float>(1, nearPlane));
+  std::string renderer(hemicubeRenderer());
+  hashArray(hash, std::vector<char>(renderer.begin(), renderer.end()));
+  return hash;
+}
+
+bool readFormFactorCache(const char* filename, uint64_t key, int nrows, SparseMatrix& formFactors) {
+  std::shared_ptr<MappedFile> file(new MappedFile(filename));
+  if(not file->valid() or file->size() < sizeof(FormFactorCacheHeader)) {
+    return false;
+  }
+  FormFactorCacheHeader header;
+  std::memcpy(&header, file->data(), sizeof(header));
+  if(std::memcmp(header.magic, FORM_FACTOR_CACHE_MAGIC, 4) != 0
+      or header.version != FORM_FACTOR_CACHE_VERSION
+      or header.key != key
+      or header.nrows != uint64_t(nrows)) {
+    return false;
+  }
+  std::size_t rowStartBytes = (header.nrows+1)*sizeof(std::size_t);
+  std::size_t expectedSize = sizeof(header) + rowStartBytes + header.nonZeros*(sizeof(int) + sizeof(float));
+  if(file->size() != expectedSize) {
+    return false;
+  }
+
+  const char* base = file->data() + sizeof(header);
+  const std::size_t* rowStart = reinterpret_cast<const std::size_t*>(base);
+  const int* indices = reinterpret_cast<const int*>(base + rowStartBytes);
+  const float* values = reinterpret_cast<const float*>(base + rowStartBytes + header.nonZeros*sizeof(int));
+  if(rowStart[0] != 0 or rowStart[header.nrows] != header.nonZeros) {
+    return false;
+  }
+  for(int i=0; i<nrows; ++i) {
+    if(rowStart[i+1] < rowStart[i]) {
+      return false;
+    }
+  }
+  for(std::size_t k=0; k<header.nonZeros; ++k) {
+    if(indices[k] < 0 or indices[k] >= nrows) {
+      return false;
+    }
+  }
+  formFactors = SparseMatrix::view(file, (int)header.nrows, rowStart, indices, values);
+  return true;
+}
+
+bool writeFormFactorCache(const char* filename, uint64_t key, const SparseMatrix& formFactors) {
+  FormFactorFileWriter writer(filename, key, formFactors.nrows());
+  for(int i=0; i<formFactors.nrows(); ++i) {
+    SparseRow row = formFactors.getRow(i);
+    writer.appendRow(row.indices, row.values, row.size);
+  }
+  return writer.finish();
+}
+
+FormFactorFileWriter::FormFactorFileWriter(const char* _filename, uint64_t key, int nrows):
+  filename(_filename),
+  tempFilename(filename + ".tmp"),
+  valuesFilename(filename + ".values.tmp"),
+  rowStart(1, 0),
+  out(tempFilename.c_str(), std::ios::binary),
+  valuesOut(valuesFilename.c_str(), std::ios::binary),
+  finished(false)
+{
+  std::memcpy(header.magic, FORM_FACTOR_CACHE_MAGIC, 4);
+  header.version = FORM_FACTOR_CACHE_VERSION;
+  header.key = key;
+  header.nrows = nrows;
+  header.nonZeros = 0;
+  rowStart.reserve(nrows+1);
+  // Header and row offsets are filled in by finish()
+  out.seekp(sizeof(header) + (nrows+1)*sizeof(std::size_t));
+}
+
+FormFactorFileWriter::~FormFactorFileWriter() {
+  if(not finished) {
+    out.close();
+    valuesOut.close();
+    std::remove(tempFilename.c_str());
+    std::remove(valuesFilename.c_str());
+  }
+}
+
+void FormFactorFileWriter::appendRow(const std::vector<int>& rowIndices, const std::vector<float>& rowValues) {
+  appendRow(rowIndices.data(), rowValues.data(), (int)rowIndices.size());
+}
+
+void FormFactorFileWriter::appendRow(const int* rowIndices, const float* rowValues, int size) {
+  out.write(reinterpret_cast<const char*>(rowIndices), size*sizeof(int));
+  valuesOut.write(reinterpret_cast<const char*>(rowValues), size*sizeof(float));
+  rowStart.push_back(rowStart.back() + size);
+}
+
+bool FormFactorFileWriter::finish() {
+  if(rowStart.size() != header.nrows+1) {
+    return false;
+  }
+  header.nonZeros = rowStart.back();
+  valuesOut.close();
+  {
+    std::ifstream values(valuesFilename.c_str(), std::ios::binary);
+    if(header.nonZeros > 0) {
+      out << values.rdbuf();
+    }
+  }
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(rowStart.data()), rowStart.size()*sizeof(std::size_t));
+  out.close();
+  std::remove(valuesFilename.c_str());
+  finished = true;
+  if(out.fail() or valuesOut.fail()) {
+    std::remove(tempFilename.c_str());
+    return false;
+  }
+  return std::rename(tempFilename.c_str(), filename.c_str()) == 0;
+}
@@ -0,0 +1,63 @@
+#include "form_factor_row_cache.hpp"
+#include "hemicube.hpp"
+
+SparseRow CachedRow::row() const {
+  SparseRow row;
+  row.size = (int)indices.size();
+  row.indices = indices.data();
+  row.values = values.data();
+  return row;
+}
+
+std::size_t CachedRow::bytes() const {
+  return sizeof(CachedRow) + indices.capacity()*sizeof(int) + values.capacity()*sizeof(float);
+}
+
+FormFactorRowCache::FormFactorRowCache(const Model& model, int gridSize, std::size_t budgetBytes):
+  model(model),
+  gridSize(gridSize),
+  topFace(gridSize, gridSize, 0),
+  sideFace(gridSize, gridSize/2, 0),
+  budget(budgetBytes),
+  bytes(0),
+  nhits(0),
+  nmisses(0)
+{
+  calcFormFactorPerCell(gridSize, topFace, sideFace);
+}
+
+CachedRowPtr FormFactorRowCache::getRow(int faceIdx, HemicubeScratch& scratch) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::unordered_map<int, Entry>::iterator found = entries.find(faceIdx);
+    if(found != entries.end()) {
+      recency.splice(recency.begin(), recency, found->second.used);
+      ++nhits;
+      return found->second.row;
+    }
+    ++nmisses;
+  }
+
+  std::shared_ptr<CachedRow> rendered(new CachedRow());
+  calcFormFactorsSingleFace(model, faceIdx, scratch.row.data(), scratch, topFace, sideFace);
+  SparseMatrix::compressRow(scratch.row.data(), model.nfaces(), faceIdx, rendered->indices, rendered->values);
+  rendered->indices.shrink_to_fit();
+  rendered->values.shrink_to_fit();
+
+  std::lock_guard<std::mutex> lock(mutex);
+  // Another thread may have rendered it meanwhile
+  if(entries.count(faceIdx) or rendered->bytes() > budget) {
+    return rendered;
+  }
+  while(bytes + rendered->bytes() > budget) {
+    int oldest = recency.back();
+    bytes -= entries[oldest].row->bytes();
+    entries.erase(oldest);
+    recency.pop_back();
+  }
+  recency.push_front(faceIdx);
+  Entry entry = {rendered, recency.begin()};
+  entries[faceIdx] = entry;
+  bytes += rendered->bytes();
+  return rendered;
+}
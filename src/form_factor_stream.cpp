@@ -0,0 +1,120 @@
+#include <cassert>
+#include <stdexcept>
+#include <algorithm>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "form_factor_stream.hpp"
+#include "form_factor_cache.hpp"
+
+SparseRow FormFactorBlock::getRow(int i) const {
+  assert(i >= firstRow and i < endRow);
+  SparseRow row;
+  std::size_t start = rowStart[i-firstRow] - rowStart[0];
+  row.size = rowStart[i-firstRow+1] - rowStart[i-firstRow];
+  row.indices = indices.data() + start;
+  row.values = values.data() + start;
+  return row;
+}
+
+inline bool readFully(int fd, void* data, std::size_t size, std::size_t offset) {
+  char* out = static_cast<char*>(data);
+  while(size > 0) {
+    ssize_t n = pread(fd, out, size, offset);
+    if(n <= 0) {
+      return false;
+    }
+    out += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+FormFactorStream::FormFactorStream(const char* filename, uint64_t key, std::size_t blockBytes):
+  fd(-1),
+  rowStart(1, 0),
+  pendingBlock(-1)
+{
+  int file = open(filename, O_RDONLY);
+  if(file < 0) {
+    return;
+  }
+  FormFactorCacheHeader header;
+  bool ok = readFully(file, &header, sizeof(header), 0)
+    and std::equal(header.magic, header.magic+4, FORM_FACTOR_CACHE_MAGIC)
+    and header.version == FORM_FACTOR_CACHE_VERSION
+    and header.key == key;
+  if(ok) {
+    rowStart.resize(header.nrows+1);
+    ok = readFully(file, rowStart.data(), rowStart.size()*sizeof(std::size_t), sizeof(header))
+      and rowStart.back() == header.nonZeros;
+  }
+  off_t fileSize = lseek(file, 0, SEEK_END);
+  indicesOffset = sizeof(header) + rowStart.size()*sizeof(std::size_t);
+  valuesOffset = indicesOffset + header.nonZeros*sizeof(int);
+  if(not ok or fileSize != off_t(valuesOffset + header.nonZeros*sizeof(float))) {
+    rowStart.assign(1, 0);
+    close(file);
+    return;
+  }
+  fd = file;
+
+  // Split into blocks of about blockBytes of indices and values
+  const std::size_t bytesPerEntry = sizeof(int) + sizeof(float);
+  blockStart.push_back(0);
+  for(int i=0; i<nrows(); ++i) {
+    if((rowStart[i+1] - rowStart[blockStart.back()])*bytesPerEntry > blockBytes and i > blockStart.back()) {
+      blockStart.push_back(i);
+    }
+  }
+  blockStart.push_back(nrows());
+}
+
+FormFactorStream::~FormFactorStream() {
+  if(pending.valid()) {
+    pending.wait();
+  }
+  if(fd >= 0) {
+    close(fd);
+  }
+}
+
+bool FormFactorStream::readBlock(int block, FormFactorBlock& out) const {
+  out.firstRow = blockStart[block];
+  out.endRow = blockStart[block+1];
+  out.rowStart.assign(rowStart.begin() + out.firstRow, rowStart.begin() + out.endRow + 1);
+  std::size_t first = out.rowStart.front();
+  std::size_t count = out.rowStart.back() - first;
+  out.indices.resize(count);
+  out.values.resize(count);
+  return readFully(fd, out.indices.data(), count*sizeof(int), indicesOffset + first*sizeof(int))
+    and readFully(fd, out.values.data(), count*sizeof(float), valuesOffset + first*sizeof(float));
+}
+
+void FormFactorStream::prefetch(int block) {
+  pendingBlock = block;
+  pending = std::async(std::launch::async, &FormFactorStream::readBlock, this, block, std::ref(prefetched));
+}
+
+// Takes the prefetched block and starts reading the one after it
+void FormFactorStream::advance() {
+  if(not pending.get()) {
+    throw std::runtime_error("Failed reading form factor block");
+  }
+  std::swap(current, prefetched);
+  prefetch((pendingBlock+1) % nblocks());
+}
+
+SparseRow FormFactorStream::getRow(int i) {
+  assert(valid() and i < nrows());
+  if(pendingBlock < 0) {
+    prefetch(0);
+  }
+  // Blocks come round in order, so a new pass just carries on to block 0
+  while(i < current.firstRow or i >= current.endRow) {
+    advance();
+  }
+  return current.getRow(i);
+}
@@ -0,0 +1,37 @@
+#include "gauss_seidel.hpp"
+#include "rendering.hpp"
+#include "snapshot_writer.hpp"
+#include "form_factor_rows.hpp"
+
+template <class FormFactorMatrix>
+ConvergenceReport sorRadiosityPrecalculated(std::vector<Vec3f>& radiosity, const Model& model, const FormFactorMatrix& totalFormFactors, float omega) {
+  for(int i=0; i<model.nfaces(); ++i) {
+    radiosity[i] = model.getFaceEmissivity(i);
+  }
+
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence(omega == 1.f ? "Gauss-Seidel" : "SOR");
+  convergence.start(radiosity);
+  for(int passes=0; passes<MAX_PASSES; ++passes) {
+    for(int i=0; i<model.nfaces(); ++i) {
+      Vec3f gathered = gatherRow(radiosity, i, totalFormFactors.getRow(i));
+      Vec3f target = model.getFaceEmissivity(i) + gathered.piecewise(model.getFaceReflectivity(i));
+      Vec3f change = (target - radiosity[i])*omega;
+      radiosity[i] += change;
+      convergence.apply(change);
+    }
+    if(convergence.endPass()) {
+      break;
+    }
+    snapshots.offer(passes, radiosity);
+  }
+  return convergence.report();
+}
+
+ConvergenceReport sorRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const SparseMatrix& totalFormFactors, float omega) {
+  return sorRadiosityPrecalculated(radiosity, model, totalFormFactors, omega);
+}
+
+ConvergenceReport sorRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const ChunkedBuffer<float>& totalFormFactors, float omega) {
+  return sorRadiosityPrecalculated(radiosity, model, totalFormFactors, omega);
+}
@@ -48,14 +48,6 @@ Matrix Matrix::identity(int dimensions) {
   return result;
 }
 
-inline float Matrix::get(int i, int j) const {
-  return m[j*cols + i];
-}
-
-inline void Matrix::set(int i, int j, float value) {
-  m[j*cols + i] = value;
-}
-
 Matrix Matrix::transpose() {
   Matrix result(cols, rows);
   for(int i=0; i<rows; i++)
@@ -102,8 +94,20 @@ Matrix v2m(const Vec3f& v) {
   return m;
 }
 
-Matrix formProjection(float l, float r, float b, float t, float n, float f) {
-  Matrix p;
+Matrix::Matrix(const Mat4& mat):
+  rows(4),
+  cols(4)
+{
+  m = new float[16];
+  for(int j=0; j<4; ++j) {
+    for(int i=0; i<4; ++i) {
+      set(i, j, mat.get(i, j));
+    }
+  }
+}
+
+Mat4 formProjection(float l, float r, float b, float t, float n, float f) {
+  Mat4 p;
   p.set(0, 0, 2.f*n/(r-l));
   p.set(1, 1, 2.f*n/(t-b));
   p.set(0, 2, (r+l)/(r-l));
@@ -115,7 +119,7 @@ Matrix formProjection(float l, float r, float b, float t, float n, float f) {
   return p;
 }
 
-Matrix formRightAngledProjection(float n, float f) {
+Mat4 formRightAngledProjection(float n, float f) {
   return formProjection(-n, n, -n, n, n, f);
 }
 
@@ -127,16 +131,16 @@ Vec4f applyProjection(const Matrix& matrix, const Vec3f& v) {
   return matrix*v2m(v);
 }
 
-Matrix formTranslation(const Vec3f& translationVector) {
-  Matrix translation = Matrix::identity(4);
+Mat4 formTranslation(const Vec3f& translationVector) {
+  Mat4 translation = Mat4::identity();
   for(int i=0; i<3; ++i) {
     translation.set(i, 3, translationVector[i]);
   }
   return translation;
 }
 
-Matrix viewportRelative(int x, int y, int w, int h, int depth) {
-  Matrix m = Matrix::identity(4);
+Mat4 viewportRelative(int x, int y, int w, int h, int depth) {
+  Mat4 m = Mat4::identity();
   m.set(0, 3, x+w/2.f);
   m.set(1, 3, y+h/2.f);
   m.set(2, 3, depth/2.f);
@@ -147,11 +151,11 @@ Matrix viewportRelative(int x, int y, int w, int h, int depth) {
   return m;
 }
 
-Matrix lookAt(Vec3f eye, Vec3f centre, Vec3f up) {
+Mat4 lookAt(Vec3f eye, Vec3f centre, Vec3f up) {
   Vec3f z = (eye-centre).normalise();
   Vec3f x = up.cross(z).normalise();
   Vec3f y = z.cross(x).normalise();
-  Matrix Minv = Matrix::identity();
+  Mat4 Minv = Mat4::identity();
   for (int i=0; i<3; i++) {
     Minv.set(0, i, x[i]);
     Minv.set(1, i, y[i]);
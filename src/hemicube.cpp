@@ -1,14 +1,21 @@
 #include "hemicube.hpp"
+#include "hemicube_rasteriser.hpp"
+#include "hemicube_scheduler.hpp"
 #include "rendering.hpp"
 #include "geometry.hpp"
 #include "face.hpp"
 #include "model.hpp"
 #include "buffer.hpp"
+#include "sparse_matrix.hpp"
+#include "form_factor_cache.hpp"
 #include "rendering.hpp"
 #include "opengl_helper.hpp"
 #include "opengl.hpp"
 
 #include <omp.h>
+#include <memory>
+#include <vector>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
@@ -60,10 +67,10 @@ void calcFormFactorsFromSideBuffer(const Buffer<unsigned int>& itemBuffer, const
   }
 }
 
-Matrix formHemicubeMVP(const Vec3f& eye, const Vec3f& dir, const Vec3f& up) {
-  Matrix translation = formTranslation(eye*-1);
-  Matrix view = lookAt(Vec3f(0, 0, 0), dir, up)*translation;
-  Matrix projection = formRightAngledProjection(HEMICUBE_NEAR_PLANE, 20.0f);
+Mat4 formHemicubeMVP(const Vec3f& eye, const Vec3f& dir, const Vec3f& up) {
+  Mat4 translation = formTranslation(eye*-1);
+  Mat4 view = lookAt(Vec3f(0, 0, 0), dir, up)*translation;
+  Mat4 projection = formRightAngledProjection(HEMICUBE_NEAR_PLANE, 20.0f);
   return projection*view;
 }
 
@@ -87,7 +94,7 @@ void renderHemicube(Buffer<unsigned int>& buffer, const Model& model, int faceId
   extern OpenGLRenderer * renderer;
   renderer->renderHemicube(buffer, MVP);
 #else
-  Matrix MVP = formHemicubeMVP(eye, dir, up);
+  Mat4 MVP = formHemicubeMVP(eye, dir, up);
   renderModelIds(buffer, model, MVP, eye, 0.05f);
 #endif
 }
@@ -96,7 +103,6 @@ void renderToHemicube(Buffer<unsigned int>& mainBuffer, const Model& model, int
   int gridSize = mainBuffer.width/2;
   Buffer<unsigned int> buffer(gridSize, gridSize, 0);
 
-  Face f = model.face(faceIdx);
   Vec3f dir = model.norm(faceIdx, 0);
   Vec3f up = getUp(dir);
   Vec3f eye = model.centreOf(faceIdx);
@@ -145,24 +151,110 @@ void renderToHemicube(Buffer<unsigned int>& mainBuffer, const Model& model, int
   }
 }
 
+// FormFactorMatrix is any dense row storage with getRow(i), zeroed beforehand
+template <class FormFactorMatrix>
+class DenseRowsJob: public HemicubeJob {
+  public:
+    DenseRowsJob(const Model& model, FormFactorMatrix& formFactors, const Buffer<float>& topFace, const Buffer<float>& sideFace):
+      model(model), formFactors(formFactors), topFace(topFace), sideFace(sideFace) {}
+    void run(int i, HemicubeScratch& scratch) {
+      calcFormFactorsSingleFace(model, i, formFactors.getRow(i), scratch, topFace, sideFace);
+    }
+  private:
+    const Model& model;
+    FormFactorMatrix& formFactors;
+    const Buffer<float>& topFace;
+    const Buffer<float>& sideFace;
+};
+
+template <class FormFactorMatrix>
+void calcFormFactorsWholeModelDense(const Model& model, FormFactorMatrix& formFactors, int gridSize) {
+  // Precalculate face form factors
+  Buffer<float> topFace(gridSize, gridSize, 0);
+  Buffer<float> sideFace(gridSize, gridSize/2, 0);
+  calcFormFactorPerCell(gridSize, topFace, sideFace);
+
+  HemicubeScheduler scheduler(hemicubeThreads(), gridSize, model.nfaces());
+  DenseRowsJob<FormFactorMatrix> job(model, formFactors, topFace, sideFace);
+  std::vector<float> costs;
+  scheduler.run(job, 0, model.nfaces(), costs);
+}
+
 void calcFormFactorsWholeModel(const Model& model, Buffer<float>& formFactors, int gridSize) {
+  calcFormFactorsWholeModelDense(model, formFactors, gridSize);
+}
+
+void calcFormFactorsWholeModel(const Model& model, ChunkedBuffer<float>& formFactors, int gridSize) {
+  calcFormFactorsWholeModelDense(model, formFactors, gridSize);
+}
+
+// Renders rows into the thread's scratch and compresses them into a block
+class SparseRowsJob: public HemicubeJob {
+  public:
+    SparseRowsJob(const Model& model, int blockStart, std::vector<std::vector<int>>& blockIndices, std::vector<std::vector<float>>& blockValues, const Buffer<float>& topFace, const Buffer<float>& sideFace):
+      blockStart(blockStart), model(model), blockIndices(blockIndices), blockValues(blockValues), topFace(topFace), sideFace(sideFace) {}
+    void run(int i, HemicubeScratch& scratch) {
+      calcFormFactorsSingleFace(model, i, scratch.row.data(), scratch, topFace, sideFace);
+      SparseMatrix::compressRow(scratch.row.data(), model.nfaces(), i, blockIndices[i-blockStart], blockValues[i-blockStart]);
+    }
+    int blockStart;
+  private:
+    const Model& model;
+    std::vector<std::vector<int>>& blockIndices;
+    std::vector<std::vector<float>>& blockValues;
+    const Buffer<float>& topFace;
+    const Buffer<float>& sideFace;
+};
+
+// RowSink takes rows in order through reserve and appendRow, as
+// SparseMatrix and FormFactorFileWriter do
+template <class RowSink>
+void calcFormFactorsWholeModelSparse(const Model& model, RowSink& formFactors, int gridSize) {
   // Precalculate face form factors
   Buffer<float> topFace(gridSize, gridSize, 0);
   Buffer<float> sideFace(gridSize, gridSize/2, 0);
   calcFormFactorPerCell(gridSize, topFace, sideFace);
 
-#ifndef OPENGL
-  #pragma omp parallel for schedule(dynamic)
-#endif
-  for(int i=0; i<model.nfaces(); ++i) {
-    calcFormFactorsSingleFace(model, i, formFactors.getRow(i), gridSize, topFace, sideFace);
+  // Rows are calculated a block at a time, compressed and then appended in
+  // order so only one block of dense rows is ever held
+  const int nfaces = model.nfaces();
+  const int blockSize = 256;
+  std::vector<std::vector<int>> blockIndices(blockSize);
+  std::vector<std::vector<float>> blockValues(blockSize);
+  HemicubeScheduler scheduler(hemicubeThreads(), gridSize, nfaces);
+  SparseRowsJob job(model, 0, blockIndices, blockValues, topFace, sideFace);
+  std::vector<float> costs;
+  formFactors.reserve(nfaces, 0);
+  for(int start=0; start<nfaces; start+=blockSize) {
+    int end = std::min(start+blockSize, nfaces);
+    job.blockStart = start;
+    scheduler.run(job, start, end, costs);
+    for(int i=start; i<end; ++i) {
+      formFactors.appendRow(blockIndices[i-start], blockValues[i-start]);
+    }
   }
 }
 
+void calcFormFactorsWholeModel(const Model& model, SparseMatrix& formFactors, int gridSize) {
+  calcFormFactorsWholeModelSparse(model, formFactors, gridSize);
+}
+
+void calcFormFactorsWholeModel(const Model& model, FormFactorFileWriter& formFactors, int gridSize) {
+  calcFormFactorsWholeModelSparse(model, formFactors, gridSize);
+}
+
 void calcFormFactorsSingleFace(const Model& model, const int faceIdx, float* formFactors, int gridSize, const Buffer<float>& topFace, const Buffer<float>& sideFace) {
   assert(gridSize%2 == 0);
 
-  Face f = model.face(faceIdx);
+#ifndef OPENGL
+  // Kept per thread, so repeated calls reuse the buffers
+  static thread_local std::unique_ptr<HemicubeRasteriser> hemicube;
+  if(not hemicube or hemicube->items().width != gridSize) {
+    hemicube.reset(new HemicubeRasteriser(gridSize));
+  }
+  hemicube->render(model, faceIdx);
+  hemicube->accumulateFormFactors(topFace, sideFace, formFactors);
+#else
   Vec3f dir = model.norm(faceIdx, 0);
   Vec3f up = getUp(dir);
   Vec3f eye = model.centreOf(faceIdx);
@@ -188,4 +280,14 @@ void calcFormFactorsSingleFace(const Model& model, const int faceIdx, float* for
   std::swap(up, dir);
   renderHemicube(itemBuffer, model, faceIdx, eye, dir, up);
   calcFormFactorsFromBuffer(itemBuffer, topFace, formFactors);
+#endif
+}
+
+void calcFormFactorsSingleFace(const Model& model, const int faceIdx, float* formFactors, HemicubeScratch& scratch, const Buffer<float>& topFace, const Buffer<float>& sideFace) {
+#ifndef OPENGL
+  scratch.rasteriser.render(model, faceIdx);
+  scratch.rasteriser.accumulateFormFactors(topFace, sideFace, formFactors);
+#else
+  calcFormFactorsSingleFace(model, faceIdx, formFactors, scratch.gridSize, topFace, sideFace);
+#endif
 }
@@ -0,0 +1,87 @@
+#include "hemicube_pipeline.hpp"
+
+HemicubeRowPipeline::HemicubeRowPipeline(FormFactorRowCache& cache, int nthreads, int ringSize):
+  cache(cache),
+  nfaces(cache.getModel().nfaces()),
+  reverse(false),
+  ring(ringSize),
+  ringRow(ringSize, -1),
+  nextPosition(nfaces),
+  released(nfaces),
+  stopping(false)
+{
+  if(nthreads == 0) {
+    scratch.reset(new HemicubeScratch(cache.getGridSize(), nfaces));
+  }
+  for(int t=0; t<nthreads; ++t) {
+    workers.push_back(std::thread(&HemicubeRowPipeline::work, this));
+    pinThread(workers.back(), t);
+  }
+}
+
+HemicubeRowPipeline::~HemicubeRowPipeline() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  slotFree.notify_all();
+  for(std::size_t t=0; t<workers.size(); ++t) {
+    workers[t].join();
+  }
+}
+
+void HemicubeRowPipeline::work() {
+  HemicubeScratch workerScratch(cache.getGridSize(), nfaces);
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    while(not stopping and not (nextPosition < nfaces and nextPosition < released + (int)ring.size())) {
+      slotFree.wait(lock);
+    }
+    if(stopping) {
+      return;
+    }
+    int at = nextPosition++;
+    int faceIdx = reverse ? nfaces-1-at : at;
+    lock.unlock();
+    CachedRowPtr row = cache.getRow(faceIdx, workerScratch);
+    lock.lock();
+    int slot = at % ring.size();
+    ring[slot] = row;
+    ringRow[slot] = faceIdx;
+    rowReady.notify_all();
+  }
+}
+
+void HemicubeRowPipeline::beginPass(bool reverseSweep) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    reverse = reverseSweep;
+    nextPosition = 0;
+    released = 0;
+  }
+  slotFree.notify_all();
+}
+
+SparseRow HemicubeRowPipeline::acquire(int faceIdx) {
+  int slot = position(faceIdx) % ring.size();
+  if(workers.empty()) {
+    ring[slot] = cache.getRow(faceIdx, *scratch);
+    return ring[slot]->row();
+  }
+  std::unique_lock<std::mutex> lock(mutex);
+  while(ringRow[slot] != faceIdx) {
+    rowReady.wait(lock);
+  }
+  return ring[slot]->row();
+}
+
+void HemicubeRowPipeline::release(int faceIdx) {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    int slot = position(faceIdx) % ring.size();
+    ring[slot].reset();
+    ringRow[slot] = -1;
+    released = position(faceIdx)+1;
+  }
+  slotFree.notify_all();
+}
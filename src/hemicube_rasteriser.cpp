@@ -0,0 +1,185 @@
+#include <cmath>
+#include <algorithm>
+
+#include "hemicube_rasteriser.hpp"
+#include "hemicube.hpp"
+#include "rendering.hpp"
+#include "rasteriser.hpp"
+
+// Maps a point in the patch frame (x and y across the patch, z along its
+// normal) to (horizontal, vertical, depth) as seen through a hemicube face.
+// Face 0 is the top, faces 1-4 are the sides.
+inline Vec3f toHemicubeFace(const Vec3f& p, int hemicubeFace) {
+  switch(hemicubeFace) {
+    case 0: return Vec3f(p.x, p.y, p.z);
+    case 1: return Vec3f(p.y, p.z, p.x);
+    case 2: return Vec3f(-p.y, p.z, -p.x);
+    case 3: return Vec3f(-p.x, p.z, p.y);
+    default: return Vec3f(p.x, p.z, -p.y);
+  }
+}
+
+// One bit for each frustum plane the point is outside of
+inline int outcode(const Vec3f& p, bool isSide) {
+  int code = 0;
+  if(p.z < HEMICUBE_NEAR_PLANE) code |= 1;
+  if(p.x > p.z) code |= 2;
+  if(p.x < -p.z) code |= 4;
+  if(p.y > p.z) code |= 8;
+  if(isSide ? p.y < 0.f : p.y < -p.z) code |= 16;
+  return code;
+}
+
+// First and last pixel whose centre lies within [lo, hi], clamped to [0, size)
+inline void pixelSpan(float lo, float hi, int size, int& first, int& last) {
+  first = (int)std::max(0.f, std::ceil(lo - 0.5f));
+  last = (int)std::max(-1.f, std::min(size - 1.f, std::floor(hi - 0.5f)));
+}
+
+HemicubeRasteriser::HemicubeRasteriser(int _gridSize):
+  transformedVertices(0),
+  rasterisedPixels(0),
+  gridSize(_gridSize),
+  itemBuffer(_gridSize, 3*_gridSize),
+  zBuffer(_gridSize, 3*_gridSize)
+{
+  assert(gridSize%2 == 0);
+}
+
+void HemicubeRasteriser::render(const Model& model, int faceIdx) {
+  render(model, model.mesh().centroid(faceIdx), model.mesh().normal(faceIdx), faceIdx);
+}
+
+void HemicubeRasteriser::render(const Model& model, const Vec3f& eye, const Vec3f& n, int faceIdx) {
+  itemBuffer.fillAll(0);
+  zBuffer.fillAll(0.f);
+
+  const TriangleMesh& mesh = model.mesh();
+  Vec3f a = getUp(n).cross(n).normalise();
+  Vec3f b = n.cross(a);
+
+  // Only faces reaching in front of the patch can be seen; the BVH hands
+  // them back a subtree at a time, sorted back into draw order
+  Vec4f front(n.x, n.y, n.z, -n.dot(eye));
+  visible.clear();
+  model.bvh().frustumQuery(&front, 1, visible);
+  std::sort(visible.begin(), visible.end());
+
+  for(std::size_t k=0; k<visible.size(); ++k) {
+    int i = visible[k];
+    if(i == faceIdx) {
+      continue;
+    }
+
+    Vec3f local[3];
+    for(int j=0; j<3; ++j) {
+      int v = mesh.indices[3*i+j];
+      float x = mesh.vx[v] - eye.x;
+      float y = mesh.vy[v] - eye.y;
+      float z = mesh.vz[v] - eye.z;
+      local[j] = Vec3f(x*a.x + y*a.y + z*a.z, x*b.x + y*b.y + z*b.z, x*n.x + y*n.y + z*n.z);
+    }
+    transformedVertices += 3;
+
+    // Wholly behind the patch
+    if(local[0].z <= 0.f and local[1].z <= 0.f and local[2].z <= 0.f) {
+      continue;
+    }
+
+    // Back face culling: the patch centre is behind the face's plane
+    if(mesh.nx[i]*eye.x + mesh.ny[i]*eye.y + mesh.nz[i]*eye.z + mesh.planeD[i] < 0.f) {
+      continue;
+    }
+
+    for(int hemicubeFace=0; hemicubeFace<5; ++hemicubeFace) {
+      renderToFace(local, hemicubeFace, i+1);
+    }
+  }
+}
+
+void HemicubeRasteriser::renderToFace(const Vec3f local[3], int hemicubeFace, unsigned int id) {
+  bool isSide = hemicubeFace != 0;
+
+  Vec3f pts[3];
+  int outsideAll = ~0;
+  int outsideAny = 0;
+  for(int j=0; j<3; ++j) {
+    pts[j] = toHemicubeFace(local[j], hemicubeFace);
+    int code = outcode(pts[j], isSide);
+    outsideAll &= code;
+    outsideAny |= code;
+  }
+  // Every vertex is outside the same plane
+  if(outsideAll != 0) {
+    return;
+  }
+
+  // Clip against the near plane, leaving a triangle or a quad
+  Vec3f clipped[4];
+  int nClipped = 0;
+  for(int j=0; j<3; ++j) {
+    const Vec3f& v0 = pts[j];
+    const Vec3f& v1 = pts[(j+1)%3];
+    bool in0 = not (outsideAny & 1) or v0.z >= HEMICUBE_NEAR_PLANE;
+    bool in1 = not (outsideAny & 1) or v1.z >= HEMICUBE_NEAR_PLANE;
+    if(in0) {
+      clipped[nClipped++] = v0;
+    }
+    if(in0 != in1) {
+      clipped[nClipped++] = interpolate(v0, v1, (HEMICUBE_NEAR_PLANE - v0.z)/(v1.z - v0.z));
+    }
+  }
+
+  // Project into pixels, keeping 1/depth for the depth test since it
+  // interpolates linearly in screen space
+  int nRows = isSide ? gridSize/2 : gridSize;
+  int rowOffset = isSide ? gridSize + (hemicubeFace-1)*gridSize/2 : 0;
+  float halfGrid = gridSize/2.f;
+  float yOffset = isSide ? 0.f : 1.f;
+  Vec3f screen[4];
+  for(int k=0; k<nClipped; ++k) {
+    float invDepth = 1.f/clipped[k].z;
+    screen[k] = Vec3f(
+        (clipped[k].x*invDepth + 1.f)*halfGrid,
+        (clipped[k].y*invDepth + yOffset)*halfGrid,
+        invDepth);
+  }
+
+  for(int k=1; k+1<nClipped; ++k) {
+    Vec3f triangle[3] = {screen[0], screen[k], screen[k+1]};
+    rasterise(triangle, rowOffset, nRows, id);
+  }
+}
+
+void HemicubeRasteriser::rasterise(const Vec3f pts[3], int rowOffset, int nRows, unsigned int id) {
+  // Sample at pixel centres within this face's rows of the unfolded buffer
+  Vec3f shifted[3];
+  for(int k=0; k<3; ++k) {
+    shifted[k] = Vec3f(pts[k].x - 0.5f, pts[k].y - 0.5f + rowOffset, pts[k].z);
+  }
+  int xmin, xmax, ymin, ymax;
+  pixelSpan(std::min(std::min(pts[0].x, pts[1].x), pts[2].x), std::max(std::max(pts[0].x, pts[1].x), pts[2].x), gridSize, xmin, xmax);
+  pixelSpan(std::min(std::min(pts[0].y, pts[1].y), pts[2].y), std::max(std::max(pts[0].y, pts[1].y), pts[2].y), nRows, ymin, ymax);
+  if(xmin > xmax or ymin > ymax) {
+    return;
+  }
+  rasterisedPixels += long(xmax-xmin+1)*(ymax-ymin+1);
+
+  rasteriseTriangle(shifted, zBuffer, itemBuffer, id, rowOffset, rowOffset+nRows-1);
+}
+
+void HemicubeRasteriser::accumulateFormFactors(const Buffer<float>& topFace, const Buffer<float>& sideFace, float* formFactors) const {
+  for(int j=0; j<gridSize; ++j) {
+    for(int i=0; i<gridSize; ++i) {
+      formFactors[itemBuffer.get(i, j)] += topFace.get(i, j);
+    }
+  }
+  for(int side=0; side<4; ++side) {
+    int rowOffset = gridSize + side*gridSize/2;
+    for(int j=0; j<gridSize/2; ++j) {
+      for(int i=0; i<gridSize; ++i) {
+        formFactors[itemBuffer.get(i, rowOffset+j)] += sideFace.get(i, j);
+      }
+    }
+  }
+}
@@ -0,0 +1,193 @@
+#include <chrono>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+
+#include "hemicube_scheduler.hpp"
+
+// Chunks cut per thread: enough to steal from, few enough to stay cheap
+const int CHUNKS_PER_THREAD = 8;
+
+HemicubeScratch::HemicubeScratch(int gridSize, int nfaces):
+  gridSize(gridSize),
+  rasteriser(gridSize),
+  row(nfaces+1, 0.f)
+{
+}
+
+int hemicubeThreads() {
+#ifdef OPENGL
+  return 1;
+#else
+  return std::max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+void pinThread(std::thread& thread, int index) {
+#ifdef PIN_THREADS
+  cpu_set_t allowed;
+  if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0 or CPU_COUNT(&allowed) == 0) {
+    return;
+  }
+  index %= CPU_COUNT(&allowed);
+  for(int cpu=0; cpu<CPU_SETSIZE; ++cpu) {
+    if(CPU_ISSET(cpu, &allowed) and index-- == 0) {
+      cpu_set_t pinned;
+      CPU_ZERO(&pinned);
+      CPU_SET(cpu, &pinned);
+      pthread_setaffinity_np(thread.native_handle(), sizeof(pinned), &pinned);
+      return;
+    }
+  }
+#endif
+}
+
+HemicubeScheduler::HemicubeScheduler(int nthreads, int gridSize, int nfaces):
+  job(NULL),
+  costs(NULL),
+  generation(0),
+  active(0),
+  stopping(false)
+{
+  for(int t=0; t<std::max(1, nthreads); ++t) {
+    scratch.push_back(std::unique_ptr<HemicubeScratch>(new HemicubeScratch(gridSize, nfaces)));
+    queues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+  }
+  // The calling thread is left where the OS puts it
+  for(int t=1; t<nthreads; ++t) {
+    workers.push_back(std::thread(&HemicubeScheduler::work, this, t));
+    pinThread(workers.back(), t);
+  }
+}
+
+HemicubeScheduler::~HemicubeScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  started.notify_all();
+  for(std::size_t t=0; t<workers.size(); ++t) {
+    workers[t].join();
+  }
+}
+
+void HemicubeScheduler::run(HemicubeJob& runJob, int begin, int end, std::vector<float>& itemCosts) {
+  if(begin >= end) {
+    return;
+  }
+  if((int)itemCosts.size() < end) {
+    itemCosts.resize(end, 0.f);
+  }
+
+  // Unmeasured items cost the average of the measured ones
+  double measured = 0.0;
+  int nmeasured = 0;
+  for(int i=begin; i<end; ++i) {
+    if(itemCosts[i] > 0.f) {
+      measured += itemCosts[i];
+      ++nmeasured;
+    }
+  }
+  float unmeasured = nmeasured > 0 ? float(measured/nmeasured) : 1.f;
+  std::vector<float> estimates(end-begin);
+  double total = 0.0;
+  for(int i=begin; i<end; ++i) {
+    estimates[i-begin] = itemCosts[i] > 0.f ? itemCosts[i] : unmeasured;
+    total += estimates[i-begin];
+  }
+
+  // Chunks of about equal cost, each thread taking a contiguous share
+  int nthreads = (int)scratch.size();
+  int nchunks = std::min(end-begin, CHUNKS_PER_THREAD*nthreads);
+  double chunkCost = total/nchunks;
+  double threadCost = total/nthreads;
+  double before = 0.0;
+  Chunk chunk = {begin, begin};
+  double cost = 0.0;
+  for(int i=begin; i<end; ++i) {
+    cost += estimates[i-begin];
+    chunk.end = i+1;
+    if(cost >= chunkCost or i == end-1) {
+      int owner = std::min(nthreads-1, int((before + 0.5*cost)/threadCost));
+      queues[owner]->chunks.push_back(chunk);
+      before += cost;
+      cost = 0.0;
+      chunk.begin = i+1;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    job = &runJob;
+    costs = &itemCosts;
+    active = nthreads;
+    ++generation;
+  }
+  started.notify_all();
+  drain(0);
+  std::unique_lock<std::mutex> lock(mutex);
+  --active;
+  while(active > 0) {
+    finished.wait(lock);
+  }
+  job = NULL;
+  costs = NULL;
+}
+
+void HemicubeScheduler::work(int thread) {
+  int seen = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    while(not stopping and generation == seen) {
+      started.wait(lock);
+    }
+    if(stopping) {
+      return;
+    }
+    seen = generation;
+    lock.unlock();
+    drain(thread);
+    lock.lock();
+    if(--active == 0) {
+      finished.notify_all();
+    }
+  }
+}
+
+void HemicubeScheduler::drain(int thread) {
+  HemicubeScratch& threadScratch = *scratch[thread];
+  std::vector<float>& itemCosts = *costs;
+  Chunk chunk;
+  while(take(thread, chunk)) {
+    for(int i=chunk.begin; i<chunk.end; ++i) {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      job->run(i, threadScratch);
+      std::chrono::duration<float> taken = std::chrono::steady_clock::now() - start;
+      // Never 0, which would mean unmeasured
+      itemCosts[i] = std::max(taken.count(), 1e-9f);
+    }
+  }
+}
+
+bool HemicubeScheduler::take(int thread, Chunk& chunk) {
+  {
+    WorkQueue& own = *queues[thread];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if(not own.chunks.empty()) {
+      chunk = own.chunks.front();
+      own.chunks.pop_front();
+      return true;
+    }
+  }
+  int nthreads = (int)queues.size();
+  for(int k=1; k<nthreads; ++k) {
+    WorkQueue& victim = *queues[(thread+k)%nthreads];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if(not victim.chunks.empty()) {
+      chunk = victim.chunks.back();
+      victim.chunks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
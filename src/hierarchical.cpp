@@ -0,0 +1,409 @@
+#include <iostream>
+#include <algorithm>
+
+#include "hierarchical.hpp"
+
+// Area of e's faces facing direction d (unit length), from the areas
+// they present along each axis: exact for faces square to the axes, and
+// an overestimate by up to sqrt(3) otherwise
+inline float projectedArea(const Element& e, const Vec3f& d) {
+  float area = 0.f;
+  for(int a=0; a<3; ++a) {
+    area += d[a] > 0.f ? e.facingPositive[a]*d[a] : -e.facingNegative[a]*d[a];
+  }
+  return area;
+}
+
+HierarchicalRadiosity::HierarchicalRadiosity(const Model& model, float epsilon, float minAreaFraction):
+  model(model),
+  rays(model),
+  epsilon(epsilon),
+  maxEmission(0.f),
+  root(-1)
+{
+  const TriangleMesh& mesh = model.mesh();
+  float totalArea = 0.f;
+  for(int i=0; i<mesh.nfaces(); ++i) {
+    Element face;
+    face.face = i;
+    face.parent = -1;
+    face.firstChild = -1;
+    face.nchildren = 0;
+    face.centre = mesh.centroid(i);
+    face.radius = 0.f;
+    for(int j=0; j<3; ++j) {
+      face.corners[j] = mesh.corner(i, j);
+      face.radius = std::max(face.radius, (face.corners[j] - face.centre).norm());
+    }
+    face.area = mesh.areas[i];
+    Vec3f n = mesh.normal(i);
+    for(int a=0; a<3; ++a) {
+      face.facingPositive[a] = face.area*std::max(n[a], 0.f);
+      face.facingNegative[a] = face.area*std::max(-n[a], 0.f);
+    }
+    face.faceBegin = face.faceEnd = -1;
+    face.reflectivity = model.getFaceReflectivity(i);
+    face.radiosity = model.getFaceEmissivity(i);
+    elements.push_back(face);
+    totalArea += face.area;
+    for(int k=0; k<3; ++k) {
+      maxEmission = std::max(maxEmission, face.radiosity[k]);
+    }
+  }
+  minArea = minAreaFraction*totalArea;
+}
+
+int HierarchicalRadiosity::nleaves() const {
+  int n = 0;
+  for(std::size_t e=0; e<elements.size(); ++e) {
+    n += elements[e].firstChild < 0;
+  }
+  return n;
+}
+
+// A face element's centre, or halfway from it to corner k-1. A cluster's
+// are the centroids of faces spread through it.
+Vec3f HierarchicalRadiosity::samplePoint(int e, int k) const {
+  const Element& element = elements[e];
+  if(element.face >= 0) {
+    return k == 0 ? element.centre : (element.centre + element.corners[k-1])*0.5f;
+  }
+  return model.mesh().centroid(clusterFaces[element.faceBegin + k*(element.faceEnd - element.faceBegin)/4]);
+}
+
+// The faces at either end of a link, which don't block it: a face
+// element's own face, or every face in a cluster
+class SkipEnds {
+  public:
+    SkipEnds(const std::vector<int>& clusterRank, const Element& a, const Element& b):
+      clusterRank(clusterRank), a(a), b(b) {}
+    bool operator()(int face) const { return inside(a, face) or inside(b, face); }
+  private:
+    const std::vector<int>& clusterRank;
+    const Element& a;
+    const Element& b;
+
+    bool inside(const Element& e, int face) const {
+      return e.face >= 0 ? face == e.face : clusterRank[face] >= e.faceBegin and clusterRank[face] < e.faceEnd;
+    }
+};
+
+// Rays between matching sample points
+float HierarchicalRadiosity::formFactor(int receiver, int source) const {
+  const Element& r = elements[receiver];
+  const Element& s = elements[source];
+  const TriangleMesh& mesh = model.mesh();
+  float unoccluded;
+  if(r.face >= 0 and s.face >= 0) {
+    unoccluded = pointToDiscFormFactor(r.centre, mesh.normal(r.face), s.centre, mesh.normal(s.face), s.area);
+  } else {
+    Vec3f d = s.centre - r.centre;
+    float r2 = d.norm2();
+    float distance = std::sqrt(r2);
+    if(r2 == 0.f) {
+      return 0.f;
+    }
+    d = d*(1.f/distance);
+    // A cluster receives its faces' mean cosine, and emits from the area
+    // its faces show
+    float cosR = r.face >= 0 ? mesh.normal(r.face).dot(d) : projectedArea(r, d)/r.area;
+    float shownS = s.face >= 0 ? -mesh.normal(s.face).dot(d)*s.area : projectedArea(s, d*-1.f);
+    if(cosR <= 0.f or shownS <= 0.f) {
+      return 0.f;
+    }
+    unoccluded = cosR*shownS/(float(M_PI)*r2 + s.area);
+  }
+  if(unoccluded == 0.f) {
+    return 0.f;
+  }
+  SkipEnds skip(clusterRank, r, s);
+  int visible = 0;
+  for(int k=0; k<4; ++k) {
+    visible += not rays.occluded(samplePoint(receiver, k), samplePoint(source, k), skip);
+  }
+  return unoccluded*visible/4.f;
+}
+
+bool HierarchicalRadiosity::splittable(int e) const {
+  return elements[e].face < 0 or elements[e].area > minArea;
+}
+
+// Too close for either end to stand in for a cluster's faces
+bool HierarchicalRadiosity::overlap(int receiver, int source) const {
+  const Element& r = elements[receiver];
+  const Element& s = elements[source];
+  return (r.face < 0 or s.face < 0) and (s.centre - r.centre).norm() < r.radius + s.radius;
+}
+
+bool HierarchicalRadiosity::shouldSplit(int receiver, int source, float formFactor) const {
+  if(not splittable(receiver) and not splittable(source)) {
+    return false;
+  }
+  Vec3f carried = elements[source].radiosity.piecewise(elements[receiver].reflectivity)*formFactor;
+  return std::max(carried.r, std::max(carried.g, carried.b)) > epsilon*maxEmission;
+}
+
+void HierarchicalRadiosity::subdivide(int e) {
+  if(elements[e].firstChild >= 0) {
+    return;
+  }
+  Element parent = elements[e];
+  Vec3f mid[3];
+  for(int j=0; j<3; ++j) {
+    mid[j] = (parent.corners[j] + parent.corners[(j+1)%3])*0.5f;
+  }
+  // One child at each corner and one in the middle
+  const Vec3f triangles[4][3] = {
+    {parent.corners[0], mid[0], mid[2]},
+    {mid[0], parent.corners[1], mid[1]},
+    {mid[2], mid[1], parent.corners[2]},
+    {mid[0], mid[1], mid[2]}
+  };
+  elements[e].firstChild = (int)children.size();
+  elements[e].nchildren = 4;
+  for(int c=0; c<4; ++c) {
+    Element child = parent;
+    child.parent = e;
+    child.firstChild = -1;
+    child.nchildren = 0;
+    child.centre = (triangles[c][0] + triangles[c][1] + triangles[c][2])*(1.f/3.f);
+    child.radius = 0.f;
+    for(int j=0; j<3; ++j) {
+      child.corners[j] = triangles[c][j];
+      child.radius = std::max(child.radius, (child.corners[j] - child.centre).norm());
+    }
+    child.area = parent.area/4.f;
+    children.push_back((int)elements.size());
+    elements.push_back(child);
+  }
+}
+
+void HierarchicalRadiosity::link(int receiver, int source) {
+  if(overlap(receiver, source)) {
+    split(receiver, source);
+    return;
+  }
+  float f = formFactor(receiver, source);
+  if(f > 0.f) {
+    refine(receiver, source, f);
+  }
+}
+
+// Opens the bigger cluster if there is one, otherwise splits whichever
+// face element is bigger and can be
+void HierarchicalRadiosity::split(int receiver, int source) {
+  const Element& r = elements[receiver];
+  const Element& s = elements[source];
+  bool splitSource;
+  if(r.face < 0 or s.face < 0) {
+    splitSource = s.face < 0 and (r.face >= 0 or s.radius > r.radius);
+  } else {
+    splitSource = splittable(source) and (not splittable(receiver) or s.area > r.area);
+  }
+  if(splitSource) {
+    subdivide(source);
+    for(int c=0; c<elements[source].nchildren; ++c) {
+      link(receiver, child(source, c));
+    }
+  } else {
+    subdivide(receiver);
+    for(int c=0; c<elements[receiver].nchildren; ++c) {
+      link(child(receiver, c), source);
+    }
+  }
+}
+
+void HierarchicalRadiosity::refine(int receiver, int source, float formFactor) {
+  if(shouldSplit(receiver, source, formFactor)) {
+    split(receiver, source);
+  } else {
+    Link l = {receiver, source, formFactor};
+    links.push_back(l);
+  }
+}
+
+void HierarchicalRadiosity::linkRoots() {
+  links.clear();
+  int nfaces = model.nfaces();
+  for(int i=0; i<nfaces; ++i) {
+    for(int j=0; j<nfaces; ++j) {
+      if(i == j) {
+        continue;
+      }
+      link(i, j);
+    }
+  }
+}
+
+int HierarchicalRadiosity::buildCluster(const FaceBVH& bvh, int node) {
+  const BVHNode& n = bvh.node(node);
+  Element cluster;
+  cluster.face = -1;
+  cluster.parent = -1;
+  cluster.firstChild = -1;
+  cluster.nchildren = 0;
+  cluster.centre = (n.lower() + n.upper())*0.5f;
+  cluster.radius = (n.upper() - n.lower()).norm()*0.5f;
+  cluster.area = 0.f;
+  cluster.faceBegin = cluster.faceEnd = 0;
+  int e = (int)elements.size();
+  elements.push_back(cluster);
+
+  std::vector<int> members;
+  if(n.leaf()) {
+    members.assign(clusterFaces.begin() + n.first, clusterFaces.begin() + n.first + n.count);
+    elements[e].faceBegin = n.first;
+    elements[e].faceEnd = n.first + n.count;
+  } else {
+    members.push_back(buildCluster(bvh, node+1));
+    members.push_back(buildCluster(bvh, n.first));
+    elements[e].faceBegin = elements[members[0]].faceBegin;
+    elements[e].faceEnd = elements[members[1]].faceEnd;
+  }
+  elements[e].firstChild = (int)children.size();
+  elements[e].nchildren = (int)members.size();
+  for(std::size_t c=0; c<members.size(); ++c) {
+    Element& member = elements[members[c]];
+    member.parent = e;
+    elements[e].area += member.area;
+    elements[e].facingPositive += member.facingPositive;
+    elements[e].facingNegative += member.facingNegative;
+    for(int k=0; k<3; ++k) {
+      elements[e].reflectivity[k] = std::max(elements[e].reflectivity[k], member.reflectivity[k]);
+    }
+    children.push_back(members[c]);
+  }
+  // Centred on its faces rather than its box, which a big face can drag
+  // well away from the rest
+  Vec3f centre;
+  for(std::size_t c=0; c<members.size(); ++c) {
+    float weight = elements[e].area > 0.f ? elements[members[c]].area/elements[e].area : 1.f/members.size();
+    centre += elements[members[c]].centre*weight;
+  }
+  float radius = 0.f;
+  for(std::size_t c=0; c<members.size(); ++c) {
+    radius = std::max(radius, (elements[members[c]].centre - centre).norm() + elements[members[c]].radius);
+  }
+  elements[e].centre = centre;
+  elements[e].radius = radius;
+  return e;
+}
+
+// Links everything inside e to everything else inside it
+void HierarchicalRadiosity::linkWithin(int e) {
+  if(elements[e].face >= 0) {
+    return;
+  }
+  for(int a=0; a<elements[e].nchildren; ++a) {
+    linkWithin(child(e, a));
+    for(int b=0; b<elements[e].nchildren; ++b) {
+      if(a != b) {
+        link(child(e, a), child(e, b));
+      }
+    }
+  }
+}
+
+void HierarchicalRadiosity::linkClusters() {
+  links.clear();
+  if(root < 0 and model.nfaces() > 0) {
+    const FaceBVH& bvh = model.bvh();
+    clusterFaces = bvh.faces();
+    clusterRank.resize(clusterFaces.size());
+    for(std::size_t k=0; k<clusterFaces.size(); ++k) {
+      clusterRank[clusterFaces[k]] = (int)k;
+    }
+    root = buildCluster(bvh, 0);
+    pushPull(root, Vec3f(0,0,0));
+  }
+  if(root >= 0) {
+    linkWithin(root);
+  }
+}
+
+bool HierarchicalRadiosity::refineLinks() {
+  std::vector<Link> previous;
+  previous.swap(links);
+  bool split = false;
+  for(std::size_t k=0; k<previous.size(); ++k) {
+    const Link& l = previous[k];
+    split = split or shouldSplit(l.receiver, l.source, l.formFactor);
+    refine(l.receiver, l.source, l.formFactor);
+  }
+  return split;
+}
+
+// The irradiance gathered at every level above e comes down as down
+Vec3f HierarchicalRadiosity::pushPull(int e, const Vec3f& down) {
+  Vec3f irradiance = down + elements[e].gathered;
+  Vec3f radiosity;
+  if(elements[e].firstChild < 0) {
+    int face = elements[e].face;
+    radiosity = model.getFaceEmissivity(face) + irradiance.piecewise(elements[e].reflectivity);
+  } else {
+    for(int c=0; c<elements[e].nchildren; ++c) {
+      int ch = child(e, c);
+      Vec3f childRadiosity = pushPull(ch, irradiance);
+      if(elements[e].area > 0.f) {
+        radiosity += childRadiosity*(elements[ch].area/elements[e].area);
+      }
+    }
+  }
+  elements[e].radiosity = radiosity;
+  return radiosity;
+}
+
+ConvergenceReport HierarchicalRadiosity::solve(int maxPasses) {
+  std::vector<Vec3f> roots;
+  faceRadiosity(roots);
+  ConvergenceTracker convergence("Hierarchical");
+  convergence.start(roots);
+  for(int passes=0; passes<maxPasses; ++passes) {
+    for(std::size_t e=0; e<elements.size(); ++e) {
+      elements[e].gathered = Vec3f(0,0,0);
+    }
+    for(std::size_t k=0; k<links.size(); ++k) {
+      const Link& l = links[k];
+      elements[l.receiver].gathered += elements[l.source].radiosity*l.formFactor;
+    }
+    if(root >= 0) {
+      pushPull(root, Vec3f(0,0,0));
+    } else {
+      for(int i=0; i<model.nfaces(); ++i) {
+        pushPull(i, Vec3f(0,0,0));
+      }
+    }
+    for(int i=0; i<model.nfaces(); ++i) {
+      convergence.apply(elements[i].radiosity - roots[i]);
+      roots[i] = elements[i].radiosity;
+    }
+    if(convergence.endPass()) {
+      break;
+    }
+  }
+  return convergence.report();
+}
+
+void HierarchicalRadiosity::faceRadiosity(std::vector<Vec3f>& radiosity) const {
+  radiosity.resize(model.nfaces());
+  for(int i=0; i<model.nfaces(); ++i) {
+    radiosity[i] = elements[i].radiosity;
+  }
+}
+
+ConvergenceReport hierarchicalRadiosity(std::vector<Vec3f>& radiosity, const Model& model, float epsilon) {
+  HierarchicalRadiosity hierarchy(model, epsilon, HIERARCHICAL_MIN_AREA);
+#ifdef CLUSTERING
+  hierarchy.linkClusters();
+#else
+  hierarchy.linkRoots();
+#endif
+  ConvergenceReport report = hierarchy.solve(MAX_PASSES);
+  for(int refinements=0; refinements<HIERARCHICAL_REFINEMENTS and hierarchy.refineLinks(); ++refinements) {
+    std::cerr << "Refinement " << refinements << ": " << hierarchy.nelements() << " elements ("
+      << hierarchy.nleaves() << " leaves), " << hierarchy.nlinks() << " links" << std::endl;
+    report = hierarchy.solve(MAX_PASSES);
+  }
+  hierarchy.faceRadiosity(radiosity);
+  return report;
+}
@@ -0,0 +1,231 @@
+#include <cmath>
+#include <iostream>
+
+#include "krylov.hpp"
+#include "form_factor_rows.hpp"
+
+typedef std::vector<Vec3f> Channels;
+
+// Per channel inner product, accumulated in double
+inline Vec3f dot(const Channels& a, const Channels& b) {
+  double sum[3] = {0, 0, 0};
+  for(std::size_t i=0; i<a.size(); ++i) {
+    for(int k=0; k<3; ++k) {
+      sum[k] += double(a[i][k])*b[i][k];
+    }
+  }
+  return Vec3f(sum[0], sum[1], sum[2]);
+}
+
+// Channels which have converged end up with 0/0, which stays at 0
+inline Vec3f divide(const Vec3f& a, const Vec3f& b) {
+  Vec3f result;
+  for(int k=0; k<3; ++k) {
+    result[k] = b[k] != 0.f ? a[k]/b[k] : 0.f;
+  }
+  return result;
+}
+
+// An inner product next to this fraction of the norms it came from has
+// vanished, as far as float arithmetic can tell
+const float KRYLOV_BREAKDOWN = 1e-6f;
+
+// True, and the report marked unconverged, if a channel with residual left
+// is about to be divided by a.b that has vanished. Carrying on would
+// divide by rounding noise, or (with divide's 0/0) quietly stall.
+inline bool brokeDown(ConvergenceReport& report, const char* what, const Channels& a, const Channels& b, const Vec3f& product, const Vec3f& residualNorm2) {
+  Vec3f scale = dot(a, a).piecewise(dot(b, b));
+  for(int k=0; k<3; ++k) {
+    if(residualNorm2[k] > 0.f and std::abs(product[k]) <= KRYLOV_BREAKDOWN*std::sqrt(scale[k])) {
+      report.converged = false;
+      std::cerr << report.method << " broke down at iteration " << report.passes << ": " << what << " vanished" << std::endl;
+      return true;
+    }
+  }
+  return false;
+}
+
+// y += a.x per channel
+inline void addScaled(Channels& y, const Vec3f& a, const Channels& x) {
+  for(std::size_t i=0; i<y.size(); ++i) {
+    y[i] += x[i].piecewise(a);
+  }
+}
+
+// Records the iteration as a pass whose change is the residual norm against
+// the right hand side's, so its relative change is the largest relative
+// residual, and says whether that is small enough
+inline bool recordResidual(ConvergenceReport& report, const Vec3f& residualNorm2, const Vec3f& rhsNorm2) {
+  PassMetrics metrics;
+  metrics.pass = (int)report.history.size();
+  for(int k=0; k<3; ++k) {
+    metrics.total[k] = std::sqrt(rhsNorm2[k]);
+    metrics.change[k] = rhsNorm2[k] > 0.f ? std::sqrt(residualNorm2[k]) : 0.f;
+  }
+  metrics.maxResidual = metrics.change;
+  float worst = metrics.relativeChange();
+  metrics.converged = worst < KRYLOV_TOLERANCE;
+  report.history.push_back(metrics);
+  std::cerr << report.method << " iteration " << metrics.pass << ": residual " << worst << std::endl;
+  report.converged = metrics.converged;
+  return report.converged;
+}
+
+// y = (A/R - S)x, on faces with mask 1 in that channel
+template <class FormFactorMatrix>
+void symmetricProduct(Channels& y, const Channels& x, const Model& model, const FormFactorMatrix& formFactors, const Channels& diagonal, const Channels& mask) {
+  const float* areas = model.mesh().areas.data();
+  int nfaces = model.nfaces();
+  Channels transposed(nfaces, Vec3f(0,0,0));
+  for(int i=0; i<nfaces; ++i) {
+    y[i] = gatherRow(x, i, formFactors.getRow(i))*areas[i];
+    scatterRow(transposed, i, x[i]*areas[i], formFactors.getRow(i));
+  }
+  for(int i=0; i<nfaces; ++i) {
+    y[i] = (diagonal[i].piecewise(x[i]) - (y[i] + transposed[i])*0.5f).piecewise(mask[i]);
+  }
+}
+
+template <class FormFactorMatrix>
+ConvergenceReport conjugateGradientPrecalculated(std::vector<Vec3f>& radiosity, const Model& model, const FormFactorMatrix& formFactors) {
+  ConvergenceReport report("Conjugate gradient");
+  const float* areas = model.mesh().areas.data();
+  int nfaces = model.nfaces();
+
+  // Faces that reflect nothing in a channel are fixed at their emission
+  // there, and carried over to the right hand side
+  Channels diagonal(nfaces), mask(nfaces), fixed(nfaces), rhs(nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    Vec3f reflectivity = model.getFaceReflectivity(i);
+    Vec3f emissivity = model.getFaceEmissivity(i);
+    for(int k=0; k<3; ++k) {
+      bool reflects = reflectivity[k] > 0.f;
+      mask[i][k] = reflects ? 1.f : 0.f;
+      diagonal[i][k] = reflects ? areas[i]/reflectivity[k] : areas[i];
+      fixed[i][k] = reflects ? 0.f : emissivity[k];
+    }
+  }
+  Channels ones(nfaces, Vec3f(1,1,1));
+  symmetricProduct(rhs, fixed, model, formFactors, Channels(nfaces, Vec3f(0,0,0)), ones);
+  for(int i=0; i<nfaces; ++i) {
+    rhs[i] = (diagonal[i].piecewise(model.getFaceEmissivity(i)) - rhs[i]).piecewise(mask[i]);
+  }
+
+  Channels x(nfaces), r(nfaces), z(nfaces), p(nfaces), q(nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    x[i] = model.getFaceEmissivity(i).piecewise(mask[i]);
+  }
+  symmetricProduct(q, x, model, formFactors, diagonal, mask);
+  for(int i=0; i<nfaces; ++i) {
+    r[i] = rhs[i] - q[i];
+    p[i] = z[i] = divide(r[i], diagonal[i]);
+  }
+  Vec3f rhsNorm2 = dot(rhs, rhs);
+  Vec3f rz = dot(r, z);
+  for(int iteration=0; iteration<MAX_PASSES; ++iteration) {
+    symmetricProduct(q, p, model, formFactors, diagonal, mask);
+    Vec3f pq = dot(p, q);
+    if(brokeDown(report, "p.Ap", p, q, pq, dot(r, r))) {
+      break;
+    }
+    Vec3f alpha = divide(rz, pq);
+    addScaled(x, alpha, p);
+    addScaled(r, alpha*-1.f, q);
+    report.passes = iteration+1;
+    if(recordResidual(report, dot(r, r), rhsNorm2)) {
+      break;
+    }
+    for(int i=0; i<nfaces; ++i) {
+      z[i] = divide(r[i], diagonal[i]);
+    }
+    Vec3f rzNext = dot(r, z);
+    Vec3f beta = divide(rzNext, rz);
+    rz = rzNext;
+    for(int i=0; i<nfaces; ++i) {
+      p[i] = z[i] + p[i].piecewise(beta);
+    }
+  }
+
+  for(int i=0; i<nfaces; ++i) {
+    radiosity[i] = x[i] + fixed[i];
+  }
+  return report;
+}
+
+// y = (I - RF)x
+template <class FormFactorMatrix>
+void gatheringProduct(Channels& y, const Channels& x, const Model& model, const FormFactorMatrix& formFactors) {
+  for(int i=0; i<model.nfaces(); ++i) {
+    y[i] = x[i] - gatherRow(x, i, formFactors.getRow(i)).piecewise(model.getFaceReflectivity(i));
+  }
+}
+
+template <class FormFactorMatrix>
+ConvergenceReport biCGStabPrecalculated(std::vector<Vec3f>& radiosity, const Model& model, const FormFactorMatrix& formFactors) {
+  ConvergenceReport report("BiCGSTAB");
+  int nfaces = model.nfaces();
+  Channels x(nfaces), r(nfaces), shadow(nfaces), p(nfaces, Vec3f(0,0,0)), v(nfaces, Vec3f(0,0,0)), s(nfaces), t(nfaces);
+  Channels rhs(nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    rhs[i] = x[i] = model.getFaceEmissivity(i);
+  }
+  gatheringProduct(v, x, model, formFactors);
+  for(int i=0; i<nfaces; ++i) {
+    shadow[i] = r[i] = rhs[i] - v[i];
+    v[i] = Vec3f(0,0,0);
+  }
+  Vec3f rhsNorm2 = dot(rhs, rhs);
+  Vec3f rho(1,1,1), alpha(1,1,1), omega(1,1,1);
+  for(int iteration=0; iteration<MAX_PASSES; ++iteration) {
+    Vec3f rhoNext = dot(shadow, r);
+    Vec3f residualNorm2 = dot(r, r);
+    if(brokeDown(report, "r0.r", shadow, r, rhoNext, residualNorm2)) {
+      break;
+    }
+    Vec3f beta = divide(rhoNext, rho).piecewise(divide(alpha, omega));
+    rho = rhoNext;
+    for(int i=0; i<nfaces; ++i) {
+      p[i] = r[i] + (p[i] - v[i].piecewise(omega)).piecewise(beta);
+    }
+    gatheringProduct(v, p, model, formFactors);
+    Vec3f shadowV = dot(shadow, v);
+    if(brokeDown(report, "r0.Ap", shadow, v, shadowV, residualNorm2)) {
+      break;
+    }
+    alpha = divide(rho, shadowV);
+    for(int i=0; i<nfaces; ++i) {
+      s[i] = r[i] - v[i].piecewise(alpha);
+    }
+    gatheringProduct(t, s, model, formFactors);
+    omega = divide(dot(t, s), dot(t, t));
+    for(int i=0; i<nfaces; ++i) {
+      x[i] += p[i].piecewise(alpha) + s[i].piecewise(omega);
+      r[i] = s[i] - t[i].piecewise(omega);
+    }
+    report.passes = iteration+1;
+    if(recordResidual(report, dot(r, r), rhsNorm2)) {
+      break;
+    }
+  }
+
+  for(int i=0; i<nfaces; ++i) {
+    radiosity[i] = x[i];
+  }
+  return report;
+}
+
+ConvergenceReport conjugateGradientRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const SparseMatrix& totalFormFactors) {
+  return conjugateGradientPrecalculated(radiosity, model, totalFormFactors);
+}
+
+ConvergenceReport conjugateGradientRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const ChunkedBuffer<float>& totalFormFactors) {
+  return conjugateGradientPrecalculated(radiosity, model, totalFormFactors);
+}
+
+ConvergenceReport biCGStabRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const SparseMatrix& totalFormFactors) {
+  return biCGStabPrecalculated(radiosity, model, totalFormFactors);
+}
+
+ConvergenceReport biCGStabRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const ChunkedBuffer<float>& totalFormFactors) {
+  return biCGStabPrecalculated(radiosity, model, totalFormFactors);
+}
@@ -4,7 +4,16 @@
 #include "model.hpp"
 #include "geometry.hpp"
 #include "hemicube.hpp"
+#include "sparse_matrix.hpp"
+#include "form_factor_cache.hpp"
+#include "form_factor_stream.hpp"
 #include "rendering.hpp"
+#include "southwell.hpp"
+#include "gauss_seidel.hpp"
+#include "krylov.hpp"
+#include "hierarchical.hpp"
+#include "substructure.hpp"
+#include "stochastic.hpp"
 #include "colours.hpp"
 #include "opengl_helper.hpp"
 #include "opengl.hpp"
@@ -19,7 +28,12 @@ int main(int argc, char* argv[]) {
   std::cout << "obj: " << modelObj << std::endl;
   std::cout << "mtl: " << modelMtl << std::endl;
 
+#ifdef SCENE_CACHE
+  std::string modelCache = modelObj + std::string(".scene");
+  Model model(modelObj.c_str(), modelMtl.c_str(), modelCache.c_str());
+#else
   Model model(modelObj.c_str(), modelMtl.c_str());
+#endif
   std::cerr << "Model setup." << std::endl;
   std::cerr << "Num faces: " << model.nfaces() << std::endl;
   std::cerr << "Num verts: " << model.nverts() << std::endl;
@@ -35,16 +49,98 @@ int main(int argc, char* argv[]) {
 
   std::vector<Vec3f> radiosity(model.nfaces());
 
-#ifndef PROGRESSIVE
+#if !defined(PROGRESSIVE) && !defined(HIERARCHICAL) && !defined(SUBSTRUCTURED) && !defined(STOCHASTIC)
   std::cerr << "PRECALCULATING FORM FACTORS" << std::endl;
-  std::cerr << "Form factor memory cost: " << sizeof(float)*model.nfaces()*model.nfaces()/(1024.f*1024.f) << " MB" << std::endl;
-  Buffer<float> totalFormFactors(model.nfaces()+1, model.nfaces()+1, 0.f);
+#ifdef STREAMED_FORM_FACTORS
+  // Written straight to disk row by row, then read back a block at a time
+  std::string formFactorFile = modelObj + std::string(".ff");
+  uint64_t formFactorKey = formFactorCacheKey(model, gridSize, HEMICUBE_NEAR_PLANE);
+  std::size_t blockBytes = std::size_t(FORM_FACTOR_BLOCK_MB)*1024*1024;
+  if(FormFactorStream(formFactorFile.c_str(), formFactorKey, blockBytes).valid()) {
+    std::cerr << "Streaming form factors from " << formFactorFile << std::endl;
+  } else {
+    std::cerr << "Calculating form factors" << std::endl;
+    FormFactorFileWriter writer(formFactorFile.c_str(), formFactorKey, model.nfaces());
+    calcFormFactorsWholeModel(model, writer, gridSize);
+    if(not writer.finish()) {
+      std::cerr << "Could not write " << formFactorFile << std::endl;
+      return 1;
+    }
+    std::cerr << "Calculated form factors" << std::endl;
+  }
+  FormFactorStream totalFormFactors(formFactorFile.c_str(), formFactorKey, blockBytes);
+  std::cerr << "Form factor blocks: " << totalFormFactors.nblocks()
+    << " (" << totalFormFactors.nonZeros() << " non-zero)" << std::endl;
+#else
+#ifdef DENSE_FORM_FACTORS
+  ChunkedBuffer<float> totalFormFactors(model.nfaces()+1, model.nfaces()+1, 0.f);
+  std::cerr << "Form factor memory cost: " << sizeof(float)*totalFormFactors.size()/(1024.f*1024.f) << " MB" << std::endl;
+#else
+  SparseMatrix totalFormFactors;
+#endif
+#if defined(FORM_FACTOR_CACHE) && !defined(DENSE_FORM_FACTORS)
+  std::string formFactorCache = modelObj + std::string(".ff");
+  uint64_t formFactorKey = formFactorCacheKey(model, gridSize, HEMICUBE_NEAR_PLANE);
+  if(readFormFactorCache(formFactorCache.c_str(), formFactorKey, model.nfaces(), totalFormFactors)) {
+    std::cerr << "Loaded form factors from " << formFactorCache << std::endl;
+  } else {
+    std::cerr << "Calculating form factors" << std::endl;
+    calcFormFactorsWholeModel(model, totalFormFactors, gridSize);
+    std::cerr << "Calculated form factors" << std::endl;
+    if(not writeFormFactorCache(formFactorCache.c_str(), formFactorKey, totalFormFactors)) {
+      std::cerr << "Could not write " << formFactorCache << std::endl;
+    }
+  }
+#else
   std::cerr << "Calculating form factors" << std::endl;
   calcFormFactorsWholeModel(model, totalFormFactors, gridSize);
   std::cerr << "Calculated form factors" << std::endl;
 #endif
+#ifndef DENSE_FORM_FACTORS
+  std::cerr << "Form factor memory cost: " << totalFormFactors.memoryUsage()/(1024.f*1024.f) << " MB"
+    << " (" << totalFormFactors.nonZeros() << " non-zero)" << std::endl;
+#endif
+#endif
+#endif
+
+#if defined(HIERARCHICAL)
+  std::cerr << "USING HIERARCHICAL RADIOSITY" << std::endl;
+#ifndef GATHERING
+#error "HIERARCHICAL only gathers"
+#endif
+  std::cerr << hierarchicalRadiosity(radiosity, model);
+
+  std::cerr << "Normalising radiosity" << std::endl;
+  normaliseRadiosity(radiosity);
+
+#elif defined(SUBSTRUCTURED)
+  std::cerr << "USING PATCH/ELEMENT SUBSTRUCTURING" << std::endl;
+#if !defined(GATHERING) || defined(OPENGL)
+#error "SUBSTRUCTURED only gathers, with the software rasteriser"
+#endif
+  Patches patches;
+  groupCoplanarFaces(model, SUBSTRUCTURE_PATCH_FACES, patches);
+  std::cerr << "Patches: " << patches.npatches() << std::endl;
+  SparseMatrix patchFormFactors;
+  calcPatchFormFactors(model, patches, patchFormFactors, gridSize);
+  std::cerr << "Form factor memory cost: " << patchFormFactors.memoryUsage()/(1024.f*1024.f) << " MB"
+    << " (" << patchFormFactors.nonZeros() << " non-zero)" << std::endl;
+  std::cerr << substructuredRadiosity(radiosity, model, patches, patchFormFactors);
+
+  std::cerr << "Normalising radiosity" << std::endl;
+  normaliseRadiosity(radiosity);
+
+#elif defined(STOCHASTIC)
+  std::cerr << "USING STOCHASTIC JACOBI RADIOSITY" << std::endl;
+#ifndef SHOOTING
+#error "STOCHASTIC only shoots"
+#endif
+  std::cerr << stochasticRadiosity(radiosity, model);
+
+  std::cerr << "Normalising radiosity" << std::endl;
+  normaliseRadiosity(radiosity);
 
-#ifdef PROGRESSIVE
+#elif defined(PROGRESSIVE)
   std::cerr << "USING PROGRESSIVE REFINEMENT" << std::endl;
 
 #ifdef SHOOTING
@@ -54,6 +150,13 @@ int main(int argc, char* argv[]) {
 #ifdef GATHERING
   std::cerr << "gathering radiosity" << std::endl;
   gatherRadiosity(radiosity, model, gridSize);
+#endif
+#ifdef SOUTHWELL
+  std::cerr << "Shooting radiosity from the brightest faces first" << std::endl;
+  southwellRadiosity(radiosity, model, gridSize);
+#endif
+#if defined(GAUSS_SEIDEL) || defined(SOR) || defined(CONJUGATE_GRADIENT) || defined(BICGSTAB)
+#error "GAUSS_SEIDEL, SOR, CONJUGATE_GRADIENT and BICGSTAB need precalculated form factors"
 #endif
 
   std::cerr << "Normalising radiosity" << std::endl;
@@ -69,6 +172,37 @@ int main(int argc, char* argv[]) {
   std::cerr << "gathering radiosity" << std::endl;
   gatherRadiosity(radiosity, model, gridSize, totalFormFactors);
 #endif
+#ifdef SOUTHWELL
+#if defined(DENSE_FORM_FACTORS) || defined(STREAMED_FORM_FACTORS)
+#error "SOUTHWELL picks rows in any order, so needs sparse or progressive form factors"
+#endif
+  std::cerr << "Shooting radiosity from the brightest faces first" << std::endl;
+  southwellRadiosity(radiosity, model, gridSize, totalFormFactors);
+#endif
+#if defined(GAUSS_SEIDEL) || defined(SOR)
+#ifdef STREAMED_FORM_FACTORS
+#error "GAUSS_SEIDEL and SOR need sparse or dense form factors"
+#endif
+#ifdef SOR
+  float omega = SOR_OMEGA;
+#else
+  float omega = 1.f;
+#endif
+  std::cerr << "Gathering radiosity in place, omega " << omega << std::endl;
+  std::cerr << sorRadiosity(radiosity, model, totalFormFactors, omega);
+#endif
+#if defined(CONJUGATE_GRADIENT) || defined(BICGSTAB)
+#ifdef STREAMED_FORM_FACTORS
+#error "CONJUGATE_GRADIENT and BICGSTAB need sparse or dense form factors"
+#endif
+#ifdef CONJUGATE_GRADIENT
+  std::cerr << "Solving the symmetrised system with conjugate gradient" << std::endl;
+  std::cerr << conjugateGradientRadiosity(radiosity, model, totalFormFactors);
+#else
+  std::cerr << "Solving with BiCGSTAB" << std::endl;
+  std::cerr << biCGStabRadiosity(radiosity, model, totalFormFactors);
+#endif
+#endif
 
 #endif
 
@@ -0,0 +1,42 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "mapped_file.hpp"
+
+MappedFile::MappedFile(const char* filename):
+  isValid(false),
+  begin(nullptr),
+  length(0)
+{
+  int fd = open(filename, O_RDONLY);
+  if(fd < 0) {
+    return;
+  }
+  struct stat info;
+  if(fstat(fd, &info) != 0 or not S_ISREG(info.st_mode)) {
+    close(fd);
+    return;
+  }
+  length = info.st_size;
+  if(length > 0) {
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(mapping == MAP_FAILED) {
+      close(fd);
+      length = 0;
+      return;
+    }
+    madvise(mapping, length, MADV_SEQUENTIAL);
+    begin = static_cast<const char*>(mapping);
+  }
+  // The mapping stays valid once the descriptor is closed
+  close(fd);
+  isValid = true;
+}
+
+MappedFile::~MappedFile() {
+  if(begin) {
+    munmap(const_cast<char*>(begin), length);
+  }
+}
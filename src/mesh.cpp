@@ -0,0 +1,48 @@
+#include <cassert>
+
+#include "mesh.hpp"
+
+void TriangleMesh::build(const std::vector<Vec3f>& verts, const std::vector<Vec3f>& norms, const std::vector<Face>& faces) {
+  int nv = (int)verts.size();
+  int nf = (int)faces.size();
+
+  vx.resize(nv);
+  vy.resize(nv);
+  vz.resize(nv);
+  for(int i=0; i<nv; ++i) {
+    vx[i] = verts[i].x;
+    vy[i] = verts[i].y;
+    vz[i] = verts[i].z;
+  }
+
+  indices.resize(3*nf);
+  nx.resize(nf);
+  ny.resize(nf);
+  nz.resize(nf);
+  cx.resize(nf);
+  cy.resize(nf);
+  cz.resize(nf);
+  planeD.resize(nf);
+  areas.resize(nf);
+  for(int i=0; i<nf; ++i) {
+    const Face& f = faces[i];
+    assert(f.size() >= 3);
+    Vec3f total(0, 0, 0);
+    for(int j=0; j<f.size(); ++j) {
+      total = total + verts[f[j].ivert];
+    }
+    Vec3f centre = total*(1.f/f.size());
+    Vec3f n = norms.empty() ? Vec3f(0, 0, 0) : norms[f[0].inorm];
+    for(int j=0; j<3; ++j) {
+      indices[3*i+j] = f[j].ivert;
+    }
+    nx[i] = n.x;
+    ny[i] = n.y;
+    nz[i] = n.z;
+    cx[i] = centre.x;
+    cy[i] = centre.y;
+    cz[i] = centre.z;
+    planeD[i] = -n.dot(centre);
+    areas[i] = calcTriangleArea(verts[f[0].ivert], verts[f[1].ivert], verts[f[2].ivert]);
+  }
+}
@@ -1,100 +1,51 @@
-#include <iostream>
-#include <string>
-#include <fstream>
-#include <sstream>
 #include <vector>
-#include <unordered_map>
 
 #include "model.hpp"
 #include "material.hpp"
 #include "face.hpp"
-
-Model::Model(const char *objFilename, const char *mtlFilename) : verts_(), faces_() {
-  std::ifstream in;
+#include "mapped_file.hpp"
+#include "obj_parser.hpp"
+#include "scene_cache.hpp"
+
+Model::Model(const char *objFilename, const char *mtlFilename, const char *cacheFilename) : verts_(), faces_() {
+  ObjData data;
+  if (cacheFilename && readSceneCache(cacheFilename, objFilename, mtlFilename, materials_, data, mesh_)) {
+    verts_.swap(data.verts);
+    norms_.swap(data.norms);
+    uv_.swap(data.uvs);
+    faces_.swap(data.faces);
+    bvh_.build(mesh_);
+    return;
+  }
 
   // Setup materials
-  int materialsCount = 0;
-  std::unordered_map<std::string, int> materialsTable;
-  in.open (mtlFilename, std::ifstream::in);
-  if (in.fail()) return;
-  std::string line;
-  while (!in.eof()) {
-    std::getline(in, line);
-    std::istringstream iss(line.c_str());
-    char trash;
-    if (!line.compare(0, 6, "newmtl")) {
-      char trash6[6];
-      iss >> trash6;
-      std::string matName;
-      iss >> matName;
-      materialsTable.insert({matName, materialsCount});
-      materials_.push_back(Material());
-      materialsCount++;
-    } else if (!line.compare(0, 3, "Kd ")) {
-      iss >> trash >> trash;
-      float r, g, b;
-      iss >> r >> g >> b;
-      materials_[materials_.size()-1].reflectivity = Vec3f(r, g, b);
-    } else if (!line.compare(0, 3, "Ke ")) {
-      iss >> trash >> trash;
-      float r, g, b;
-      iss >> r >> g >> b;
-      materials_[materials_.size()-1].emissivity = Vec3f(r, g, b);
-    }
-  }
-  in.close();
-
-  in.open (objFilename, std::ifstream::in);
-  if (in.fail()) return;
-  int matIdx = 0;
-  while (!in.eof()) {
-    std::getline(in, line);
-    std::istringstream iss(line.c_str());
-    char trash;
-    if (!line.compare(0, 2, "v ")) {
-      iss >> trash;
-      Vec3f v;
-      for (int i=0;i<3;i++) iss >> v.raw[i];
-      verts_.push_back(v);
-    } else if (!line.compare(0, 3, "vn ")) {
-      iss >> trash >> trash;
-      Vec3f n;
-      for (int i=0;i<3;i++) iss >> n[i];
-      n.normalise();
-      norms_.push_back(n);
-    } else if (!line.compare(0, 6, "usemtl")) {
-      char trash6[6];
-      iss >> trash6;
-      std::string matName;
-      iss >> matName;
-      matIdx = materialsTable[matName];
-    } else if (!line.compare(0, 3, "vt ")) {
-      iss >> trash >> trash;
-      Vec3f uv;
-      for (int i=0;i<2;i++) iss >> uv[i];
-      uv_.push_back(uv);
-    } else if (!line.compare(0, 2, "f ")) {
-      Face f;
-      f.matIdx = matIdx;
-      int iuv, inorm, ivert;
-      iss >> trash;
-      while (iss >> ivert >> trash >> iuv >> trash >> inorm) {
-        ivert--; // in wavefront obj all indices start at 1, not zero
-        iuv--;
-        inorm--;
-        f.push_back(ivert, iuv, inorm);
-      }
-      faces_.push_back(f);
-    }
-  }
-  for(int i=0; i<nfaces(); ++i) {
-    Face& f = face(i);
+  MaterialTable materialsTable;
+  MappedFile mtl(mtlFilename);
+  if (!mtl.valid()) return;
+  parseMtl(mtl.data(), mtl.data() + mtl.size(), materials_, materialsTable);
+
+  MappedFile obj(objFilename);
+  if (!obj.valid()) return;
+  parseObj(obj.data(), obj.data() + obj.size(), materialsTable, data);
+
+  for(size_t i=0; i<data.faces.size(); ++i) {
+    Face& f = data.faces[i];
     f.area = calcTriangleArea(
-      vert(f[0].ivert),
-      vert(f[1].ivert),
-      vert(f[2].ivert)
+      data.verts[f[0].ivert],
+      data.verts[f[1].ivert],
+      data.verts[f[2].ivert]
       );
   }
+  mesh_.build(data.verts, data.norms, data.faces);
+  bvh_.build(mesh_);
+  if (cacheFilename) {
+    writeSceneCache(cacheFilename, objFilename, mtlFilename, materials_, data, mesh_);
+  }
+
+  verts_.swap(data.verts);
+  norms_.swap(data.norms);
+  uv_.swap(data.uvs);
+  faces_.swap(data.faces);
 }
 
 Model::~Model() {
@@ -161,15 +112,9 @@ const Material& Model::material(int idx) const {
 
 Vec3f Model::centreOf(int faceIdx) const {
   assert(faceIdx < nfaces());
-  Face f = face(faceIdx);
-  int size = f.size();
-  Vec3f total(0, 0, 0);
-  for(int i=0; i<size; ++i) {
-    total = total + vert(f[i].ivert);
-  }
-  return total*(1.f/size);
+  return mesh_.centroid(faceIdx);
 }
 
 float Model::area(int faceIdx) const {
-  return face(faceIdx).area;
+  return mesh_.areas[faceIdx];
 }
@@ -0,0 +1,293 @@
+#include <cmath>
+#include <cstdint>
+#include <sstream>
+#include <algorithm>
+
+#include "obj_parser.hpp"
+
+// Below this the file is parsed as a single chunk
+const std::size_t OBJ_CHUNK_BYTES = 1 << 20;
+
+inline bool isBlank(char c) {
+  return c == ' ' or c == '\t' or c == '\r';
+}
+
+inline const char* skipBlanks(const char* p, const char* end) {
+  while(p < end and isBlank(*p)) ++p;
+  return p;
+}
+
+inline const char* nextLine(const char* p, const char* end) {
+  const char* newline = std::find(p, end, '\n');
+  return newline == end ? end : newline + 1;
+}
+
+inline const char* parseInt(const char* p, const char* end, int& out) {
+  bool negative = false;
+  if(p < end and (*p == '-' or *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  int value = 0;
+  while(p < end and *p >= '0' and *p <= '9') {
+    value = value*10 + (*p - '0');
+    ++p;
+  }
+  out = negative ? -value : value;
+  return p;
+}
+
+// Decimal mantissa and exponent are gathered as integers and combined in
+// double, which is exact for the up to 15 significant digits and small
+// exponents that OBJ exporters write
+inline const char* parseFloat(const char* p, const char* end, float& out) {
+  static const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  bool negative = false;
+  if(p < end and (*p == '-' or *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  while(p < end and *p >= '0' and *p <= '9') {
+    if(digits < 19) {
+      mantissa = mantissa*10 + (*p - '0');
+      digits += mantissa != 0;
+    } else {
+      ++exponent;
+    }
+    ++p;
+  }
+  if(p < end and *p == '.') {
+    ++p;
+    while(p < end and *p >= '0' and *p <= '9') {
+      if(digits < 19) {
+        mantissa = mantissa*10 + (*p - '0');
+        digits += mantissa != 0;
+        --exponent;
+      }
+      ++p;
+    }
+  }
+  if(p < end and (*p == 'e' or *p == 'E')) {
+    int e;
+    p = parseInt(p+1, end, e);
+    exponent += e;
+  }
+  double value = double(mantissa);
+  if(exponent < 0) {
+    value = exponent >= -22 ? value/powersOfTen[-exponent] : value*std::pow(10.0, exponent);
+  } else if(exponent > 0) {
+    value = exponent <= 22 ? value*powersOfTen[exponent] : value*std::pow(10.0, exponent);
+  }
+  out = float(negative ? -value : value);
+  return p;
+}
+
+inline const char* parseVec(const char* p, const char* end, Vec3f& v, int n) {
+  for(int i=0; i<n; ++i) {
+    p = parseFloat(skipBlanks(p, end), end, v.raw[i]);
+  }
+  return p;
+}
+
+inline bool startsWith(const char* p, const char* end, const char* prefix) {
+  for(; *prefix; ++p, ++prefix) {
+    if(p == end or *p != *prefix) return false;
+  }
+  return true;
+}
+
+inline std::string parseName(const char* p, const char* end) {
+  p = skipBlanks(p, end);
+  const char* nameEnd = p;
+  while(nameEnd < end and not isBlank(*nameEnd) and *nameEnd != '\n') ++nameEnd;
+  return std::string(p, nameEnd);
+}
+
+void parseMtl(const char* begin, const char* end, std::vector<Material>& materials, MaterialTable& materialsTable) {
+  for(const char* p=begin; p<end; p=nextLine(p, end)) {
+    if(startsWith(p, end, "newmtl")) {
+      materialsTable.insert({parseName(p+6, end), (int)materials.size()});
+      materials.push_back(Material());
+    } else if(startsWith(p, end, "Kd ") and not materials.empty()) {
+      parseVec(p+3, end, materials.back().reflectivity, 3);
+    } else if(startsWith(p, end, "Ke ") and not materials.empty()) {
+      parseVec(p+3, end, materials.back().emissivity, 3);
+    }
+  }
+}
+
+// One chunk's elements. Negative indices can reach back before the chunk,
+// so they are stored relative to its first element and listed in fixups.
+// Faces before the chunk's first usemtl have matIdx -1 and take the
+// material in effect at the end of the previous chunk.
+struct ObjChunk {
+  ObjData data;
+  std::vector<Vec3i> fixups;
+  int lastMaterial;
+};
+
+inline int resolveIndex(int index, int count, bool& relative) {
+  relative = index < 0;
+  return relative ? count + index : index - 1;
+}
+
+void parseObjChunk(const char* begin, const char* end, const MaterialTable& materialsTable, ObjChunk& chunk) {
+  int matIdx = -1;
+  ObjData& data = chunk.data;
+  for(const char* p=begin; p<end; p=nextLine(p, end)) {
+    if(startsWith(p, end, "v ")) {
+      Vec3f v;
+      parseVec(p+2, end, v, 3);
+      data.verts.push_back(v);
+    } else if(startsWith(p, end, "vn ")) {
+      Vec3f n;
+      parseVec(p+3, end, n, 3);
+      n.normalise();
+      data.norms.push_back(n);
+    } else if(startsWith(p, end, "vt ")) {
+      Vec3f uv;
+      parseVec(p+3, end, uv, 2);
+      data.uvs.push_back(uv);
+    } else if(startsWith(p, end, "usemtl")) {
+      MaterialTable::const_iterator found = materialsTable.find(parseName(p+6, end));
+      matIdx = found == materialsTable.end() ? 0 : found->second;
+    } else if(startsWith(p, end, "f ")) {
+      Face f;
+      f.matIdx = matIdx;
+      int faceIdx = (int)data.faces.size();
+      const int counts[3] = {(int)data.verts.size(), (int)data.uvs.size(), (int)data.norms.size()};
+      p += 2;
+      while(true) {
+        p = skipBlanks(p, end);
+        if(p == end or *p == '\n' or *p == '#') break;
+        int raw[3] = {0, 0, 0};
+        p = parseInt(p, end, raw[0]);
+        for(int k=1; k<3 and p<end and *p=='/'; ++k) {
+          p = parseInt(p+1, end, raw[k]);
+        }
+        Vec3i corner;
+        for(int k=0; k<3; ++k) {
+          bool relative = false;
+          corner[k] = raw[k] == 0 ? -1 : resolveIndex(raw[k], counts[k], relative);
+          if(relative) {
+            chunk.fixups.push_back(Vec3i(faceIdx, f.size(), k));
+          }
+        }
+        f.push_back(corner.ivert, corner.iuv, corner.inorm);
+        // Skip anything unparseable rather than looping on it
+        while(p < end and not isBlank(*p) and *p != '\n') ++p;
+      }
+      data.faces.push_back(f);
+    }
+  }
+  chunk.lastMaterial = matIdx;
+}
+
+template <class T>
+void appendAll(std::vector<T>& out, const std::vector<T>& in) {
+  out.insert(out.end(), in.begin(), in.end());
+}
+
+void parseObj(const char* begin, const char* end, const MaterialTable& materialsTable, ObjData& out) {
+  std::size_t size = end - begin;
+  int nChunks = (int)(size/OBJ_CHUNK_BYTES) + 1;
+  std::vector<const char*> bounds(nChunks+1);
+  bounds[0] = begin;
+  for(int c=1; c<nChunks; ++c) {
+    bounds[c] = std::max(bounds[c-1], nextLine(begin + c*(size/nChunks), end));
+  }
+  bounds[nChunks] = end;
+
+  std::vector<ObjChunk> chunks(nChunks);
+  #pragma omp parallel for schedule(dynamic)
+  for(int c=0; c<nChunks; ++c) {
+    parseObjChunk(bounds[c], bounds[c+1], materialsTable, chunks[c]);
+  }
+
+  // Stitch the chunks together in order
+  std::size_t totals[4] = {0, 0, 0, 0};
+  for(int c=0; c<nChunks; ++c) {
+    totals[0] += chunks[c].data.verts.size();
+    totals[1] += chunks[c].data.uvs.size();
+    totals[2] += chunks[c].data.norms.size();
+    totals[3] += chunks[c].data.faces.size();
+  }
+  out.verts.reserve(out.verts.size() + totals[0]);
+  out.uvs.reserve(out.uvs.size() + totals[1]);
+  out.norms.reserve(out.norms.size() + totals[2]);
+  out.faces.reserve(out.faces.size() + totals[3]);
+
+  int matIdx = 0;
+  for(int c=0; c<nChunks; ++c) {
+    ObjChunk& chunk = chunks[c];
+    const int offsets[3] = {(int)out.verts.size(), (int)out.uvs.size(), (int)out.norms.size()};
+    for(std::size_t k=0; k<chunk.fixups.size(); ++k) {
+      const Vec3i& fixup = chunk.fixups[k];
+      chunk.data.faces[fixup.x][fixup.y][fixup.z] += offsets[fixup.z];
+    }
+    for(std::size_t k=0; k<chunk.data.faces.size(); ++k) {
+      Face& f = chunk.data.faces[k];
+      if(f.matIdx < 0) {
+        f.matIdx = matIdx;
+      }
+    }
+    if(chunk.lastMaterial >= 0) {
+      matIdx = chunk.lastMaterial;
+    }
+    appendAll(out.verts, chunk.data.verts);
+    appendAll(out.uvs, chunk.data.uvs);
+    appendAll(out.norms, chunk.data.norms);
+    appendAll(out.faces, chunk.data.faces);
+  }
+}
+
+void parseObjLegacy(std::istream& in, const MaterialTable& materialsTable, ObjData& out) {
+  std::string line;
+  int matIdx = 0;
+  while (!in.eof()) {
+    std::getline(in, line);
+    std::istringstream iss(line.c_str());
+    char trash;
+    if (!line.compare(0, 2, "v ")) {
+      iss >> trash;
+      Vec3f v;
+      for (int i=0;i<3;i++) iss >> v.raw[i];
+      out.verts.push_back(v);
+    } else if (!line.compare(0, 3, "vn ")) {
+      iss >> trash >> trash;
+      Vec3f n;
+      for (int i=0;i<3;i++) iss >> n[i];
+      n.normalise();
+      out.norms.push_back(n);
+    } else if (!line.compare(0, 6, "usemtl")) {
+      std::string keyword, matName;
+      iss >> keyword;
+      iss >> matName;
+      MaterialTable::const_iterator found = materialsTable.find(matName);
+      matIdx = found == materialsTable.end() ? 0 : found->second;
+    } else if (!line.compare(0, 3, "vt ")) {
+      iss >> trash >> trash;
+      Vec3f uv;
+      for (int i=0;i<2;i++) iss >> uv[i];
+      out.uvs.push_back(uv);
+    } else if (!line.compare(0, 2, "f ")) {
+      Face f;
+      f.matIdx = matIdx;
+      int iuv, inorm, ivert;
+      iss >> trash;
+      while (iss >> ivert >> trash >> iuv >> trash >> inorm) {
+        ivert--; // in wavefront obj all indices start at 1, not zero
+        iuv--;
+        inorm--;
+        f.push_back(ivert, iuv, inorm);
+      }
+      out.faces.push_back(f);
+    }
+  }
+}
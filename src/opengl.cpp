@@ -146,7 +146,7 @@ void OpenGLRenderer::initVertexBuffer(const Model& model) {
   vertex_buffer_data = new GLfloat [model.nfaces()*3*3];
   int nFaces = model.nfaces();
   for(int i=0; i<nFaces; ++i) {
-    Face f = model.face(i);
+    const Face& f = model.face(i);
     for(int j=0; j<3; ++j) {
       Vec3f vertex = model.vert(f[j].ivert);
       for(int k=0; k<3; ++k) {
@@ -0,0 +1,21 @@
+#include <limits>
+
+#include "ray_cast.hpp"
+
+RayCaster::RayCaster(const Model& model): bvh(model.bvh()) {}
+
+class SkipTwo {
+  public:
+    SkipTwo(int a, int b): a(a), b(b) {}
+    bool operator()(int face) const { return face == a or face == b; }
+  private:
+    int a, b;
+};
+
+bool RayCaster::occluded(const Vec3f& from, const Vec3f& to, int skipA, int skipB) const {
+  return occluded(from, to, SkipTwo(skipA, skipB));
+}
+
+int RayCaster::firstHit(const Vec3f& from, const Vec3f& dir, int skip, float& t) const {
+  return bvh.firstHit(from, dir, 0.f, std::numeric_limits<float>::max(), SkipTwo(skip, skip), t);
+}
@@ -1,15 +1,23 @@
 #include <iostream>
-#include <sstream>
 #include <cmath>
+#include <algorithm>
+#include <thread>
 #include <GL/gl.h>
 
 #include "rendering.hpp"
 #include "tgaimage.hpp"
 #include "geometry.hpp"
 #include "buffer.hpp"
+#include "sparse_matrix.hpp"
 #include "model.hpp"
 #include "colours.hpp"
 #include "hemicube.hpp"
+#include "form_factor_rows.hpp"
+#include "shooting.hpp"
+#include "hemicube_pipeline.hpp"
+#include "hemicube_scheduler.hpp"
+#include "snapshot_writer.hpp"
+#include "convergence.hpp"
 
 void renderColourBuffer(const GLubyte* buffer, const int size, std::string filename) {
   TGAImage frame(size, size, TGAImage::RGB);
@@ -60,14 +68,14 @@ void renderZBuffer(const Buffer<float>& zBuffer, std::string filename) {
   frame.write_tga_file(filename.c_str());
 }
 
-void renderWireFrame(const Model& model, Buffer<TGAColor>& buffer, const Matrix& MVP) {
+void renderWireFrame(const Model& model, Buffer<TGAColor>& buffer, const Mat4& MVP) {
   for (int i=0; i<model.nfaces(); i++) {
     Face face = model.face(i);
     std::swap(face[0], face[1]);
     int nVerts = face.size();
     for (int j=0; j<nVerts; j++) {
-      Vec3f v0 = m2v(MVP*v2m(model.vert(face[j].ivert)));
-      Vec3f v1 = m2v(MVP*v2m(model.vert(face[(j+1)%nVerts].ivert)));
+      Vec3f v0 = (MVP*Vec4f(model.vert(face[j].ivert), 1)).homogenise();
+      Vec3f v1 = (MVP*Vec4f(model.vert(face[(j+1)%nVerts].ivert), 1)).homogenise();
       renderLine(v0.x, v0.y, v1.x, v1.y, buffer, white);
     }
   }
@@ -81,22 +89,26 @@ Vec3f interpolate(const Vec3f& v0, const Vec3f& v1, float t) {
   return v0 + (v1-v0)*t;
 }
 
-std::vector<Vec4f> transformFace(const Face& face, const Model& model, const Matrix& MVP) {
-  std::vector<Vec4f> outScreenCoords(3);
+void transformFace(const Face& face, const Model& model, const Mat4& MVP, Vec4f outScreenCoords[3]) {
   for (int j=0; j<3; j++) {
-    Vec4f v(model.vert(face[j].ivert), 1);
-    outScreenCoords[j] = MVP*v;
+    outScreenCoords[j] = MVP*Vec4f(model.vert(face[j].ivert), 1);
   }
+}
+
+std::vector<Vec4f> transformFace(const Face& face, const Model& model, const Mat4& MVP) {
+  std::vector<Vec4f> outScreenCoords(3);
+  transformFace(face, model, MVP, outScreenCoords.data());
   return outScreenCoords;
 }
 
-void renderModelReflectivity(Buffer<TGAColor>& buffer, const Model& model, const Matrix& MVP, const Vec3f& eye, float nearPlane) {
+void renderModelReflectivity(Buffer<TGAColor>& buffer, const Model& model, const Mat4& MVP, const Vec3f& eye, float nearPlane) {
   Buffer<float> zBuffer(buffer.width, buffer.height, 0.f);
+  Vec4f pts[6];
   for (int i=0; i<model.nfaces(); ++i) {
-    Face face = model.face(i);
+    const Face& face = model.face(i);
     TGAColor colour = model.getFaceColour(face);
 
-    std::vector<Vec4f> pts = transformFace(face, model, MVP);
+    transformFace(face, model, MVP, pts);
 
     Vec3f n = model.norm(i, 0);
     if( n.dot(model.centreOf(i)-eye) <= 0.f ) {
@@ -105,14 +117,15 @@ void renderModelReflectivity(Buffer<TGAColor>& buffer, const Model& model, const
   }
 }
 
-void renderModelRadiosity(Buffer<TGAColor>& buffer, const Model& model, const Matrix& MVP, const Vec3f& eye, float nearPlane, std::vector<Vec3f>& radiosity) {
+void renderModelRadiosity(Buffer<TGAColor>& buffer, const Model& model, const Mat4& MVP, const Vec3f& eye, float nearPlane, std::vector<Vec3f>& radiosity) {
   Buffer<float> zBuffer(buffer.width, buffer.height, 0.f);
+  Vec4f pts[6];
   for (int i=0; i<model.nfaces(); ++i) {
-    Face face = model.face(i);
+    const Face& face = model.face(i);
     Vec3f rad = radiosity[i]*255.f;
     TGAColor colour = TGAColor(rad.r, rad.g, rad.b, 255);
 
-    std::vector<Vec4f> pts = transformFace(face, model, MVP);
+    transformFace(face, model, MVP, pts);
 
     Vec3f n = model.norm(i, 0);
     if( n.dot(model.centreOf(i)-eye) <= 0.f ) {
@@ -125,7 +138,7 @@ void renderVertexRadiosityToTexture(const Model& model, const std::vector<Vec3f>
   Buffer<TGAColor> buffer(size, size, black);
 
   for (int i=0; i<model.nfaces(); ++i) {
-    Face face = model.face(i);
+    const Face& face = model.face(i);
     std::vector<Vec3f> screen_coords(3);
     // Get uv coords of face in buffer space
     for (int j=0; j<3; j++) {
@@ -147,7 +160,6 @@ void renderFaceRadiosityToTexture(const Model& model, const std::vector<Vec3f>&
   Buffer<TGAColor> buffer(size, size, black);
 
   for (int i=0; i<model.nfaces(); ++i) {
-    Face face = model.face(i);
     std::vector<Vec3f> screen_coords(3);
     // Get uv coords of face in buffer space
     for (int j=0; j<3; j++) {
@@ -165,11 +177,11 @@ void renderFaceRadiosityToTexture(const Model& model, const std::vector<Vec3f>&
   renderColourBuffer(buffer, filename);
 }
 
-void renderModelIds(Buffer<unsigned int>& buffer, const Model& model, const Matrix& MVP, const Vec3f& eye, float nearPlane) {
+void renderModelIds(Buffer<unsigned int>& buffer, const Model& model, const Mat4& MVP, const Vec3f& eye, float nearPlane) {
   Buffer<float> zBuffer(buffer.width, buffer.height, 0.f);
+  Vec4f pts[6];
   for (int i=0; i<model.nfaces(); ++i) {
-    Face face = model.face(i);
-    std::vector<Vec4f> pts = transformFace(face, model, MVP);
+    transformFace(model.face(i), model, MVP, pts);
 
     Vec3f n = model.norm(i, 0);
     if( n.dot(model.centreOf(i)-eye) <= 0.f ) {
@@ -179,6 +191,14 @@ void renderModelIds(Buffer<unsigned int>& buffer, const Model& model, const Matr
 }
 
 int clipTriangle(std::vector<Vec4f>& pts, float nearPlane) {
+  Vec4f clipped[6] = {pts[0], pts[1], pts[2]};
+  int nTrianglesReturned = clipTriangle(clipped, nearPlane);
+  pts.assign(clipped, clipped + (nTrianglesReturned == 2 ? 6 : 3));
+  return nTrianglesReturned;
+}
+
+// Clips pts[0..2] in place; a split writes the second triangle to pts[3..5]
+int clipTriangle(Vec4f pts[6], float nearPlane) {
   // Default no triangles to be rendered
   int nTrianglesReturned = 0;
   // Figure out intersection points
@@ -212,13 +232,13 @@ int clipTriangle(std::vector<Vec4f>& pts, float nearPlane) {
         if(v1.z < nearPlane) {
           // Gotta split triangle into two
           // Create new triangle
-          pts.push_back(Vec4f(interpolate(
+          pts[3] = Vec4f(interpolate(
                 v2, v3, intersectPts[i2]
-                ), nearPlane));
-          pts.push_back(Vec4f(interpolate(
+                ), nearPlane);
+          pts[4] = Vec4f(interpolate(
                 v3, v1, intersectPts[i3]
-                ), nearPlane));
-          pts.push_back(v1);
+                ), nearPlane);
+          pts[5] = v1;
           // Fix triangle passed in
           pts[i3] = Vec4f(interpolate(v2, v3, intersectPts[i2]), nearPlane);
           nTrianglesReturned = 2;
@@ -241,60 +261,69 @@ int clipTriangle(std::vector<Vec4f>& pts, float nearPlane) {
   return nTrianglesReturned;
 }
 
-void shootRadiositySingleFace(const Model& model, int gridSize, std::vector<Vec3f>& radiosity, std::vector<Vec3f>& radiosityGathered, const std::vector<Vec3f>& radiosityDiff, int faceIdx, const float* formFactors) {
-  float areaThisPatch = model.area(faceIdx);
-  for(int j=0; j<model.nfaces(); ++j) {
-    // Don't affect self
-    if( j==faceIdx ) {
-      continue;
+void normaliseRadiosity(std::vector<Vec3f>& radiosity) {
+  for(int i=0; i<(int)radiosity.size(); ++i) {
+    for(int j=0; j<3; ++j) {
+      radiosity[i][j] = radiosity[i][j] < 1.0f ? radiosity[i][j] : 1.0f;
     }
-    float formFactor = formFactors[j+1];
-    float areaJthPatch = model.area(j);
-    Vec3f reflectivity = model.getFaceReflectivity(j);
-
-    Vec3f radiosityOut = radiosityDiff[faceIdx].piecewise(reflectivity)
-                         *(formFactor*areaThisPatch/areaJthPatch);
-
-    radiosity[j] += radiosityOut;
-    radiosityGathered[j] += radiosityOut;
   }
 }
 
-void gatherRadiositySingleFace(const Model& model, int gridSize, std::vector<Vec3f>& radiosity, std::vector<Vec3f>& radiosityGathered, const std::vector<Vec3f>& radiosityDiff, int faceIdx, const float* formFactors) {
-  Vec3f reflectivity = model.getFaceReflectivity(faceIdx);
-  for(int j=0; j<model.nfaces(); ++j) {
-    // Don't affect self
-    if( j==faceIdx ) {
-      continue;
+// Each lane shoots its blocks in order, taking rows from the cache. Sweeps
+// alternate direction so the rows most recently cached are wanted first.
+class ShootLaneJob: public HemicubeJob {
+  public:
+    ShootLaneJob(ShootingLanes& lanes, const std::vector<Vec3f>& radiosityDiff, FormFactorRowCache& cache, bool reverse):
+      lanes(lanes), radiosityDiff(radiosityDiff), cache(cache), reverse(reverse) {}
+    void run(int lane, HemicubeScratch& scratch) {
+      int nfaces = cache.getModel().nfaces();
+      std::vector<int> faces;
+      for(int block=lane; block<lanes.nblocks(); block+=lanes.nlanes()) {
+        for(int i=block*SHOOTING_BLOCK; i<std::min((block+1)*SHOOTING_BLOCK, nfaces); ++i) {
+          faces.push_back(i);
+        }
+      }
+      if(reverse) {
+        std::reverse(faces.begin(), faces.end());
+      }
+      for(std::size_t k=0; k<faces.size(); ++k) {
+        CachedRowPtr row = cache.getRow(faces[k], scratch);
+        lanes.shoot(lane, faces[k], radiosityDiff[faces[k]], row->row());
+      }
     }
-    float formFactor = formFactors[j+1];
-
-    Vec3f radiosityOut = radiosityDiff[j].piecewise(reflectivity)
-                         *formFactor;
-
-    radiosity[faceIdx] += radiosityOut;
-    radiosityGathered[faceIdx] += radiosityOut;
-  }
+  private:
+    ShootingLanes& lanes;
+    const std::vector<Vec3f>& radiosityDiff;
+    FormFactorRowCache& cache;
+    bool reverse;
+};
+
+// Lanes are scheduled by how long they took last pass, which mostly comes
+// down to how many of their rows had to be drawn
+void shootPass(ShootingLanes& lanes, const std::vector<Vec3f>& radiosityDiff, FormFactorRowCache& cache, bool reverse, HemicubeScheduler& scheduler, std::vector<float>& laneCosts) {
+  ShootLaneJob job(lanes, radiosityDiff, cache, reverse);
+  scheduler.run(job, 0, lanes.nlanes(), laneCosts);
 }
 
-void normaliseRadiosity(std::vector<Vec3f>& radiosity) {
-  for(int i=0; i<(int)radiosity.size(); ++i) {
-    for(int j=0; j<3; ++j) {
-      radiosity[i][j] = radiosity[i][j] < 1.0f ? radiosity[i][j] : 1.0f;
+template <class FormFactorMatrix>
+void shootPass(ShootingLanes& lanes, const Model& model, const std::vector<Vec3f>& radiosityDiff, const FormFactorMatrix& totalFormFactors) {
+  #pragma omp parallel for schedule(dynamic, 1)
+  for(int lane=0; lane<lanes.nlanes(); ++lane) {
+    for(int block=lane; block<lanes.nblocks(); block+=lanes.nlanes()) {
+      int end = std::min((block+1)*SHOOTING_BLOCK, model.nfaces());
+      for(int i=block*SHOOTING_BLOCK; i<end; ++i) {
+        lanes.shoot(lane, i, radiosityDiff[i], totalFormFactors.getRow(i));
+      }
     }
   }
 }
 
-bool isRadiosityDistributed(const std::vector<Vec3f>& radiosity, const std::vector<Vec3f>& radiosityDiff) {
-  Vec3f sumDiff(0,0,0);
-  Vec3f sumRadiosity(0,0,0);
-  for(int i=0; i<(int)radiosity.size(); ++i) {
-    sumDiff += radiosityDiff[i];
-    sumRadiosity += radiosity[i];
+// Streamed rows have to be read in order. Each lane still sees its faces
+// in the same order, so the result is the same as from memory.
+void shootPass(ShootingLanes& lanes, const Model& model, const std::vector<Vec3f>& radiosityDiff, FormFactorStream& totalFormFactors) {
+  for(int i=0; i<model.nfaces(); ++i) {
+    lanes.shoot(lanes.laneOf(i), i, radiosityDiff[i], totalFormFactors.getRow(i));
   }
-  return (sumDiff.r/sumRadiosity.r < DIFF_TO_TOTAL_CUTOFF and
-          sumDiff.g/sumRadiosity.g < DIFF_TO_TOTAL_CUTOFF and
-          sumDiff.b/sumRadiosity.b < DIFF_TO_TOTAL_CUTOFF);
 }
 
 void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize) {
@@ -306,39 +335,35 @@ void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridS
     radiosity[i] = model.getFaceEmissivity(i);
   }
 
-  Buffer<float> topFace(gridSize, gridSize, 0);
-  Buffer<float> sideFace(gridSize, gridSize/2, 0);
-  calcFormFactorPerCell(gridSize, topFace, sideFace);
-
-  float * formFactorPtr = new float [model.nfaces()+1];
+  FormFactorRowCache cache(model, gridSize, std::size_t(FORM_FACTOR_ROW_CACHE_MB)*1024*1024);
+  ShootingLanes lanes(model, SHOOTING_LANES);
+  HemicubeScheduler scheduler(hemicubeThreads(), gridSize, model.nfaces());
+  std::vector<float> laneCosts;
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence;
+  convergence.start(radiosity);
   for(int passes=0; passes<MAX_PASSES; ++passes) {
-    std::cerr << "Pass: " << passes << std::endl;
-    for(int i=0; i<model.nfaces(); ++i) {
-      for(int j=0; j<model.nfaces()+1; ++j) {
-        formFactorPtr[j] = 0.f;
-      }
-      calcFormFactorsSingleFace(model, i, formFactorPtr, gridSize,topFace, sideFace);
-      shootRadiositySingleFace(model, gridSize, radiosity, radiosityGathered, radiosityDiff, i, formFactorPtr);
-      //if(i%23 == 0) {
-        //std::stringstream iss;
-        //iss << "output" << passes << ".tga";
-        //renderFaceRadiosityToTexture(model, radiosity, 1200, iss.str());
-      //}
-    }
+    shootPass(lanes, radiosityDiff, cache, passes%2 == 1, scheduler, laneCosts);
+    lanes.reduce(radiosityGathered);
     for(int i=0; i<model.nfaces(); ++i) {
+      radiosity[i] += radiosityGathered[i];
       radiosityDiff[i] = radiosityGathered[i];
-      radiosityGathered[i] = Vec3f(0,0,0);
+      convergence.apply(radiosityGathered[i]);
     }
-    if(isRadiosityDistributed(radiosity, radiosityDiff)) {
+    bool converged = convergence.endPass();
+    std::cerr << convergence.last() << std::endl;
+    if(converged) {
       break;
     }
-    std::stringstream iss;
-    iss << "output" << passes << ".tga";
-    renderFaceRadiosityToTexture(model, radiosity, 1200, iss.str());
+    snapshots.offer(passes, radiosity);
   }
+  std::cerr << "Row cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << std::endl;
 }
 
-void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, Buffer<float>& totalFormFactors) {
+// Shared by every precalculated form factor storage; FormFactorMatrix just
+// needs a getRow(i) understood by ShootingLanes::shoot
+template <class FormFactorMatrix>
+void shootRadiosityPrecalculated(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, FormFactorMatrix& totalFormFactors) {
   // Setup radiosity
   std::vector<Vec3f> radiosityDiff(model.nfaces());
   std::vector<Vec3f> radiosityGathered(model.nfaces());
@@ -347,105 +372,174 @@ void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridS
     radiosity[i] = model.getFaceEmissivity(i);
   }
 
+  ShootingLanes lanes(model, SHOOTING_LANES);
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence;
+  convergence.start(radiosity);
   for(int passes=0; passes<MAX_PASSES; ++passes) {
-    std::cerr << "Pass: " << passes << std::endl;
-    for(int i=0; i<model.nfaces(); ++i) {
-      float* formFactorPtr = totalFormFactors.getRow(i);
-      shootRadiositySingleFace(model, gridSize, radiosity, radiosityGathered, radiosityDiff, i, formFactorPtr);
-    }
+    shootPass(lanes, model, radiosityDiff, totalFormFactors);
+    lanes.reduce(radiosityGathered);
     for(int i=0; i<model.nfaces(); ++i) {
+      radiosity[i] += radiosityGathered[i];
       radiosityDiff[i] = radiosityGathered[i];
-      radiosityGathered[i] = Vec3f(0,0,0);
+      convergence.apply(radiosityGathered[i]);
     }
-    if(isRadiosityDistributed(radiosity, radiosityDiff)) {
+    bool converged = convergence.endPass();
+    std::cerr << convergence.last() << std::endl;
+    if(converged) {
       break;
     }
-    std::stringstream iss;
-    iss << "output" << passes << ".tga";
-    renderFaceRadiosityToTexture(model, radiosity, 1200, iss.str());
+    snapshots.offer(passes, radiosity);
   }
 }
 
-void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, Buffer<float>& totalFormFactors) {
-  // Setup radiosity
+// One Jacobi gathering pass, gathered_i = rho_i sum_j F_ij diff_j. Rows are
+// independent so faces are shared between threads
+template <class FormFactorMatrix>
+void gatherPass(std::vector<Vec3f>& radiosityGathered, const Model& model, const RadiosityChannels& radiosityDiff, const FormFactorMatrix& totalFormFactors) {
+  #pragma omp parallel for schedule(dynamic, 64)
+  for(int i=0; i<model.nfaces(); ++i) {
+    Vec3f gathered = gatherRow(radiosityDiff, i, totalFormFactors.getRow(i));
+    radiosityGathered[i] = gathered.piecewise(model.getFaceReflectivity(i));
+  }
+}
+
+// Streamed rows have to be read in order
+void gatherPass(std::vector<Vec3f>& radiosityGathered, const Model& model, const RadiosityChannels& radiosityDiff, FormFactorStream& totalFormFactors) {
+  for(int i=0; i<model.nfaces(); ++i) {
+    Vec3f gathered = gatherRow(radiosityDiff, i, totalFormFactors.getRow(i));
+    radiosityGathered[i] = gathered.piecewise(model.getFaceReflectivity(i));
+  }
+}
 
+template <class FormFactorMatrix>
+void gatherRadiosityPrecalculated(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, FormFactorMatrix& totalFormFactors) {
+  // Setup radiosity
   std::vector<Vec3f> radiosityDiff(model.nfaces());
   std::vector<Vec3f> radiosityGathered(model.nfaces());
+  RadiosityChannels diffChannels(model.nfaces());
   for(int i=0; i<model.nfaces(); ++i) {
     radiosityDiff[i] = model.getFaceEmissivity(i);
     radiosity[i] = model.getFaceEmissivity(i);
   }
 
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence;
+  convergence.start(radiosity);
   for(int passes=0; passes<MAX_PASSES; ++passes) {
-    std::cerr << "Pass: " << passes << std::endl;
     for(int i=0; i<model.nfaces(); ++i) {
-      float* formFactorPtr = totalFormFactors.getRow(i);
-      gatherRadiositySingleFace(model, gridSize, radiosity, radiosityGathered, radiosityDiff, i, formFactorPtr);
+      diffChannels.set(i, radiosityDiff[i]);
     }
+    gatherPass(radiosityGathered, model, diffChannels, totalFormFactors);
     for(int i=0; i<model.nfaces(); ++i) {
+      radiosity[i] += radiosityGathered[i];
       radiosityDiff[i] = radiosityGathered[i];
-      radiosityGathered[i] = Vec3f(0,0,0);
+      convergence.apply(radiosityGathered[i]);
     }
-    if(isRadiosityDistributed(radiosity, radiosityDiff)) {
+    bool converged = convergence.endPass();
+    std::cerr << convergence.last() << std::endl;
+    if(converged) {
       break;
     }
-    std::stringstream iss;
-    iss << "output" << passes << ".tga";
-    renderFaceRadiosityToTexture(model, radiosity, 1200, iss.str());
+    snapshots.offer(passes, radiosity);
   }
 }
 
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, Buffer<float>& totalFormFactors) {
+  shootRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const ChunkedBuffer<float>& totalFormFactors) {
+  shootRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const SparseMatrix& totalFormFactors) {
+  shootRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void shootRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, FormFactorStream& totalFormFactors) {
+  shootRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, Buffer<float>& totalFormFactors) {
+  gatherRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const ChunkedBuffer<float>& totalFormFactors) {
+  gatherRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const SparseMatrix& totalFormFactors) {
+  gatherRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
+void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, FormFactorStream& totalFormFactors) {
+  gatherRadiosityPrecalculated(radiosity, model, gridSize, totalFormFactors);
+}
+
 // progressive refinement
 void gatherRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize) {
   // Setup radiosity
   std::vector<Vec3f> radiosityDiff(model.nfaces());
   std::vector<Vec3f> radiosityGathered(model.nfaces());
+  RadiosityChannels diffChannels(model.nfaces());
   for(int i=0; i<model.nfaces(); ++i) {
     radiosityDiff[i] = model.getFaceEmissivity(i);
     radiosity[i] = model.getFaceEmissivity(i);
   }
 
-  Buffer<float> topFace(gridSize, gridSize, 0);
-  Buffer<float> sideFace(gridSize, gridSize/2, 0);
-  calcFormFactorPerCell(gridSize, topFace, sideFace);
-
-  float * formFactorPtr = new float [model.nfaces()+1];
+  // Hemicubes are drawn on worker threads while rows are gathered here
+#ifdef OPENGL
+  int nthreads = 0;
+#else
+  int nthreads = std::max(1u, std::thread::hardware_concurrency());
+#endif
+  FormFactorRowCache cache(model, gridSize, std::size_t(FORM_FACTOR_ROW_CACHE_MB)*1024*1024);
+  HemicubeRowPipeline pipeline(cache, nthreads, PIPELINE_ROWS_PER_THREAD*std::max(1, nthreads));
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence;
+  convergence.start(radiosity);
   for(int passes=0; passes<MAX_PASSES; ++passes) {
-    std::cerr << "Pass: " << passes << std::endl;
     for(int i=0; i<model.nfaces(); ++i) {
-      for(int j=0; j<model.nfaces()+1; ++j) {
-        formFactorPtr[j] = 0.f;
-      }
-      calcFormFactorsSingleFace(model, i, formFactorPtr, gridSize,topFace, sideFace);
-      gatherRadiositySingleFace(model, gridSize, radiosity, radiosityGathered, radiosityDiff, i, formFactorPtr);
+      diffChannels.set(i, radiosityDiff[i]);
+    }
+    // Alternating directions, the rows most recently cached come first
+    pipeline.beginPass(passes%2 == 1);
+    for(int k=0; k<model.nfaces(); ++k) {
+      int i = passes%2 == 1 ? model.nfaces()-1-k : k;
+      Vec3f gathered = gatherRow(diffChannels, i, pipeline.acquire(i));
+      pipeline.release(i);
+      radiosityGathered[i] = gathered.piecewise(model.getFaceReflectivity(i));
     }
     for(int i=0; i<model.nfaces(); ++i) {
+      radiosity[i] += radiosityGathered[i];
       radiosityDiff[i] = radiosityGathered[i];
-      radiosityGathered[i] = Vec3f(0,0,0);
+      convergence.apply(radiosityGathered[i]);
     }
-    if(isRadiosityDistributed(radiosity, radiosityDiff)) {
+    bool converged = convergence.endPass();
+    std::cerr << convergence.last() << std::endl;
+    if(converged) {
       break;
     }
-    std::stringstream iss;
-    iss << "output" << passes << ".tga";
-    renderFaceRadiosityToTexture(model, radiosity, 1200, iss.str());
+    snapshots.offer(passes, radiosity);
   }
+  std::cerr << "Row cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << std::endl;
 }
 
 void radiosityFaceToVertex(std::vector<Vec3f>& vertexRadiosity, const Model& model, const std::vector<Vec3f>& faceRadiosity) {
-  std::vector<std::vector<Vec3f>> tempRadiosity(model.nverts());
+  std::vector<int> counts(vertexRadiosity.size(), 0);
+  for(int i=0; i<(int)vertexRadiosity.size(); ++i) {
+    vertexRadiosity[i] = Vec3f(0,0,0);
+  }
   for(int i=0; i<model.nfaces(); ++i) {
-    Face face = model.face(i);
+    const Face& face = model.face(i);
     for(int j=0; j<face.size(); ++j) {
-      tempRadiosity[face[j].ivert].push_back(faceRadiosity[i]);
+      vertexRadiosity[face[j].ivert] += faceRadiosity[i];
+      counts[face[j].ivert] += 1;
     }
   }
   for(int i=0; i<(int)vertexRadiosity.size(); ++i) {
-    vertexRadiosity[i] = Vec3f(0,0,0);
-    for(int j=0; j<(int)tempRadiosity[i].size(); ++j) {
-      vertexRadiosity[i] += tempRadiosity[i][j];
-    }
-    vertexRadiosity[i] = vertexRadiosity[i] * (1.f/tempRadiosity[i].size());
+    vertexRadiosity[i] = vertexRadiosity[i] * (1.f/counts[i]);
   }
 }
 
@@ -0,0 +1,281 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/stat.h>
+
+#include "scene_cache.hpp"
+#include "mapped_file.hpp"
+
+const char SCENE_CACHE_MAGIC[4] = {'R', 'S', 'C', 'N'};
+
+// FNV-1a
+uint64_t hashBytes(const char* data, std::size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for(std::size_t i=0; i<size; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool stampSource(const char* filename, SourceStamp& stamp, bool withHash) {
+  struct stat info;
+  if(stat(filename, &info) != 0) {
+    return false;
+  }
+  stamp.size = info.st_size;
+  stamp.mtime = int64_t(info.st_mtim.tv_sec)*1000000000 + info.st_mtim.tv_nsec;
+  stamp.hash = 0;
+  if(withHash) {
+    MappedFile file(filename);
+    if(not file.valid()) {
+      return false;
+    }
+    stamp.hash = hashBytes(file.data(), file.size());
+  }
+  return true;
+}
+
+// Brings cached's mtime up to date when only that had changed
+bool sourceUnchanged(const char* filename, SourceStamp& cached, bool& restamped) {
+  SourceStamp current;
+  if(not stampSource(filename, current, false) or current.size != cached.size) {
+    return false;
+  }
+  if(current.mtime == cached.mtime) {
+    return true;
+  }
+  if(not stampSource(filename, current, true) or current.hash != cached.hash) {
+    return false;
+  }
+  cached.mtime = current.mtime;
+  restamped = true;
+  return true;
+}
+
+template <class T>
+bool allBelow(const std::vector<T>& values, std::size_t count) {
+  for(std::size_t i=0; i<values.size(); ++i) {
+    if(std::size_t(values[i]) >= count) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Arrays are written as a 64 bit element count followed by the elements
+class CacheWriter {
+  public:
+    CacheWriter(const std::string& filename): out(filename.c_str(), std::ios::binary) {}
+    // Flushes, so a failed final write shows
+    bool close() {
+      out.close();
+      return not out.fail();
+    }
+
+    template <class T>
+    void write(const T& value) {
+      out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+    template <class T>
+    void writeArray(const std::vector<T>& values) {
+      write(uint64_t(values.size()));
+      out.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(T));
+    }
+    // Without Vec3f's padding
+    void writeVecs(const std::vector<Vec3f>& values) {
+      std::vector<float> packed(3*values.size());
+      for(std::size_t i=0; i<values.size(); ++i) {
+        for(int k=0; k<3; ++k) {
+          packed[3*i+k] = values[i][k];
+        }
+      }
+      writeArray(packed);
+    }
+  private:
+    std::ofstream out;
+};
+
+class CacheReader {
+  public:
+    CacheReader(const char* begin, std::size_t size): p(begin), end(begin + size) {}
+
+    template <class T>
+    bool read(T& value) {
+      if(std::size_t(end - p) < sizeof(T)) return false;
+      std::memcpy(&value, p, sizeof(T));
+      p += sizeof(T);
+      return true;
+    }
+    template <class T>
+    bool readArray(std::vector<T>& values) {
+      uint64_t count;
+      if(not read(count) or count > std::size_t(end - p)/sizeof(T)) return false;
+      values.resize(count);
+      std::memcpy(values.data(), p, count*sizeof(T));
+      p += count*sizeof(T);
+      return true;
+    }
+    bool readVecs(std::vector<Vec3f>& values) {
+      std::vector<float> packed;
+      if(not readArray(packed) or packed.size()%3 != 0) return false;
+      values.resize(packed.size()/3);
+      for(std::size_t i=0; i<values.size(); ++i) {
+        values[i] = Vec3f(packed[3*i], packed[3*i+1], packed[3*i+2]);
+      }
+      return true;
+    }
+  private:
+    const char* p;
+    const char* end;
+};
+
+bool readSceneCache(const char* cacheFilename, const char* objFilename, const char* mtlFilename, std::vector<Material>& materials, ObjData& data, TriangleMesh& mesh) {
+  MappedFile file(cacheFilename);
+  if(not file.valid()) {
+    return false;
+  }
+  CacheReader in(file.data(), file.size());
+  SceneCacheHeader header;
+  bool restamped = false;
+  if(not in.read(header)
+      or std::memcmp(header.magic, SCENE_CACHE_MAGIC, 4) != 0
+      or header.version != SCENE_CACHE_VERSION
+      or not sourceUnchanged(objFilename, header.obj, restamped)
+      or not sourceUnchanged(mtlFilename, header.mtl, restamped)) {
+    return false;
+  }
+
+  std::vector<Vec3f> reflectivity, emissivity;
+  ObjData loaded;
+  std::vector<uint32_t> faceStart;
+  std::vector<int> matIdx;
+  std::vector<int> corners;
+  TriangleMesh loadedMesh;
+  bool ok = in.readVecs(reflectivity) and in.readVecs(emissivity)
+    and in.readVecs(loaded.verts) and in.readVecs(loaded.norms) and in.readVecs(loaded.uvs)
+    and in.readArray(faceStart) and in.readArray(matIdx) and in.readArray(corners)
+    and in.readArray(loadedMesh.indices)
+    and in.readArray(loadedMesh.nx) and in.readArray(loadedMesh.ny) and in.readArray(loadedMesh.nz)
+    and in.readArray(loadedMesh.cx) and in.readArray(loadedMesh.cy) and in.readArray(loadedMesh.cz)
+    and in.readArray(loadedMesh.planeD) and in.readArray(loadedMesh.areas);
+  std::size_t nfaces = matIdx.size();
+  if(not ok or reflectivity.size() != emissivity.size()
+      or faceStart.size() != nfaces+1 or faceStart.back()*3 != corners.size()
+      or loadedMesh.areas.size() != nfaces) {
+    return false;
+  }
+  // Everything indexed later must be in range: corners (vertex, then uv
+  // and normal, which may be missing), triangles and materials
+  const std::size_t counts[3] = {loaded.verts.size(), loaded.uvs.size(), loaded.norms.size()};
+  for(std::size_t c=0; c<corners.size(); ++c) {
+    int lowest = c%3 == 0 ? 0 : -1;
+    if(corners[c] < lowest or corners[c] >= (int)counts[c%3]) {
+      return false;
+    }
+  }
+  for(std::size_t i=0; i<nfaces; ++i) {
+    if(faceStart[i+1] < faceStart[i] or matIdx[i] < 0 or matIdx[i] >= (int)reflectivity.size()) {
+      return false;
+    }
+  }
+  const std::vector<float>* perFace[7] = {&loadedMesh.nx, &loadedMesh.ny, &loadedMesh.nz, &loadedMesh.cx, &loadedMesh.cy, &loadedMesh.cz, &loadedMesh.planeD};
+  for(int k=0; k<7; ++k) {
+    if(perFace[k]->size() != nfaces) {
+      return false;
+    }
+  }
+  if(loadedMesh.indices.size() != 3*nfaces or not allBelow(loadedMesh.indices, loaded.verts.size())) {
+    return false;
+  }
+
+  materials.clear();
+  for(std::size_t i=0; i<reflectivity.size(); ++i) {
+    materials.push_back(Material(reflectivity[i], emissivity[i]));
+  }
+  loaded.faces.resize(nfaces);
+  for(std::size_t i=0; i<nfaces; ++i) {
+    Face& f = loaded.faces[i];
+    f.matIdx = matIdx[i];
+    f.area = loadedMesh.areas[i];
+    for(uint32_t c=faceStart[i]; c<faceStart[i+1]; ++c) {
+      f.push_back(corners[3*c], corners[3*c+1], corners[3*c+2]);
+    }
+  }
+  loadedMesh.vx.resize(loaded.verts.size());
+  loadedMesh.vy.resize(loaded.verts.size());
+  loadedMesh.vz.resize(loaded.verts.size());
+  for(std::size_t i=0; i<loaded.verts.size(); ++i) {
+    loadedMesh.vx[i] = loaded.verts[i].x;
+    loadedMesh.vy[i] = loaded.verts[i].y;
+    loadedMesh.vz[i] = loaded.verts[i].z;
+  }
+
+  std::swap(data, loaded);
+  std::swap(mesh, loadedMesh);
+
+  // Saves hashing the sources again on every later load
+  if(restamped) {
+    std::fstream out(cacheFilename, std::ios::in | std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+  return true;
+}
+
+bool writeSceneCache(const char* cacheFilename, const char* objFilename, const char* mtlFilename, const std::vector<Material>& materials, const ObjData& data, const TriangleMesh& mesh) {
+  SceneCacheHeader header;
+  std::memcpy(header.magic, SCENE_CACHE_MAGIC, 4);
+  header.version = SCENE_CACHE_VERSION;
+  if(not stampSource(objFilename, header.obj, true) or not stampSource(mtlFilename, header.mtl, true)) {
+    return false;
+  }
+
+  std::vector<Vec3f> reflectivity, emissivity;
+  for(std::size_t i=0; i<materials.size(); ++i) {
+    reflectivity.push_back(materials[i].reflectivity);
+    emissivity.push_back(materials[i].emissivity);
+  }
+  std::vector<uint32_t> faceStart(1, 0);
+  std::vector<int> matIdx;
+  std::vector<int> corners;
+  for(std::size_t i=0; i<data.faces.size(); ++i) {
+    const Face& f = data.faces[i];
+    matIdx.push_back(f.matIdx);
+    for(int j=0; j<f.size(); ++j) {
+      corners.push_back(f[j].ivert);
+      corners.push_back(f[j].iuv);
+      corners.push_back(f[j].inorm);
+    }
+    faceStart.push_back(faceStart.back() + f.size());
+  }
+
+  // Written aside and renamed into place, so a reader never sees half a file
+  std::string tempFilename = std::string(cacheFilename) + ".tmp";
+  {
+    CacheWriter out(tempFilename);
+    out.write(header);
+    out.writeVecs(reflectivity);
+    out.writeVecs(emissivity);
+    out.writeVecs(data.verts);
+    out.writeVecs(data.norms);
+    out.writeVecs(data.uvs);
+    out.writeArray(faceStart);
+    out.writeArray(matIdx);
+    out.writeArray(corners);
+    out.writeArray(mesh.indices);
+    out.writeArray(mesh.nx);
+    out.writeArray(mesh.ny);
+    out.writeArray(mesh.nz);
+    out.writeArray(mesh.cx);
+    out.writeArray(mesh.cy);
+    out.writeArray(mesh.cz);
+    out.writeArray(mesh.planeD);
+    out.writeArray(mesh.areas);
+    if(not out.close()) {
+      std::remove(tempFilename.c_str());
+      return false;
+    }
+  }
+  return std::rename(tempFilename.c_str(), cacheFilename) == 0;
+}
@@ -0,0 +1,70 @@
+#include "shooting.hpp"
+
+ShootingLanes::ShootingLanes(const Model& model, int nlanes):
+  model(model),
+  inverseAreas(model.nfaces()),
+  lanes(nlanes, RadiosityChannels(model.nfaces()))
+{
+  for(int i=0; i<model.nfaces(); ++i) {
+    inverseAreas[i] = 1.f/model.area(i);
+  }
+}
+
+// Indices within a row are distinct, so the scatter vectorises
+void ShootingLanes::shoot(int lane, int faceIdx, const Vec3f& radiosityDiff, const SparseRow& formFactors) {
+  Vec3f flux = radiosityDiff*model.area(faceIdx);
+  float* r = lanes[lane].r.data();
+  float* g = lanes[lane].g.data();
+  float* b = lanes[lane].b.data();
+  const float* inverse = inverseAreas.data();
+  const int* indices = formFactors.indices;
+  const float* values = formFactors.values;
+  #pragma omp simd
+  for(int k=0; k<formFactors.size; ++k) {
+    int j = indices[k];
+    float weight = values[k]*inverse[j];
+    r[j] += flux.r*weight;
+    g[j] += flux.g*weight;
+    b[j] += flux.b*weight;
+  }
+}
+
+// Dense rows are indexed by item buffer id; the loop is split around the
+// source to skip its diagonal without a test per element
+void ShootingLanes::shoot(int lane, int faceIdx, const Vec3f& radiosityDiff, const float* formFactors) {
+  Vec3f flux = radiosityDiff*model.area(faceIdx);
+  float* r = lanes[lane].r.data();
+  float* g = lanes[lane].g.data();
+  float* b = lanes[lane].b.data();
+  const float* inverse = inverseAreas.data();
+  const float* values = formFactors + 1;
+  const int ranges[2][2] = {{0, faceIdx}, {faceIdx+1, model.nfaces()}};
+  for(int range=0; range<2; ++range) {
+    #pragma omp simd
+    for(int j=ranges[range][0]; j<ranges[range][1]; ++j) {
+      float weight = values[j]*inverse[j];
+      r[j] += flux.r*weight;
+      g[j] += flux.g*weight;
+      b[j] += flux.b*weight;
+    }
+  }
+}
+
+void ShootingLanes::deposit(int lane, int faceIdx, const Vec3f& flux) {
+  float inverse = inverseAreas[faceIdx];
+  lanes[lane].r[faceIdx] += flux.r*inverse;
+  lanes[lane].g[faceIdx] += flux.g*inverse;
+  lanes[lane].b[faceIdx] += flux.b*inverse;
+}
+
+void ShootingLanes::reduce(std::vector<Vec3f>& radiosityGathered) {
+  #pragma omp parallel for schedule(static)
+  for(int j=0; j<model.nfaces(); ++j) {
+    Vec3f sum(0,0,0);
+    for(int lane=0; lane<nlanes(); ++lane) {
+      sum += lanes[lane].get(j);
+      lanes[lane].set(j, Vec3f(0,0,0));
+    }
+    radiosityGathered[j] = sum.piecewise(model.getFaceReflectivity(j));
+  }
+}
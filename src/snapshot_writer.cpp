@@ -0,0 +1,113 @@
+#include <sstream>
+
+#include "snapshot_writer.hpp"
+#include "rendering.hpp"
+
+SnapshotWriter::SnapshotWriter(const Model& model, int size, int everyPasses, float everySeconds, int maxQueued, const std::string& prefix):
+  model(model),
+  size(size),
+  everyPasses(everyPasses),
+  everySeconds(everySeconds),
+  maxQueued(maxQueued),
+  prefix(prefix),
+  nwritten(0),
+  ndropped(0),
+  stopping(false)
+{
+  start();
+}
+
+SnapshotWriter::SnapshotWriter(const Model& model):
+  model(model),
+  size(1200),
+  everyPasses(SNAPSHOT_EVERY_PASSES),
+  everySeconds(SNAPSHOT_EVERY_SECONDS),
+  maxQueued(SNAPSHOT_QUEUE_DEPTH),
+  prefix("output"),
+  nwritten(0),
+  ndropped(0),
+  stopping(false)
+{
+  start();
+}
+
+void SnapshotWriter::start() {
+  lastQueued = std::chrono::steady_clock::now();
+  if(enabled()) {
+    writer = std::thread(&SnapshotWriter::work, this);
+  }
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if(writer.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    queued.notify_all();
+    writer.join();
+  }
+}
+
+void SnapshotWriter::offer(int pass, const std::vector<Vec3f>& radiosity) {
+  bool due = everyPasses > 0 and pass % everyPasses == 0;
+  if(everySeconds > 0.f) {
+    std::chrono::duration<float> sinceLast = std::chrono::steady_clock::now() - lastQueued;
+    due = due or sinceLast.count() >= everySeconds;
+  }
+  if(due) {
+    write(pass, radiosity);
+  }
+}
+
+void SnapshotWriter::write(int pass, const std::vector<Vec3f>& radiosity) {
+  if(not enabled()) {
+    return;
+  }
+  std::stringstream filename;
+  filename << prefix << pass << ".tga";
+  Snapshot snapshot;
+  snapshot.filename = filename.str();
+  snapshot.radiosity = radiosity;
+  lastQueued = std::chrono::steady_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if((int)queue.size() >= maxQueued and not queue.empty()) {
+      std::swap(queue.back(), snapshot);
+      ++ndropped;
+    } else {
+      queue.push_back(Snapshot());
+      std::swap(queue.back(), snapshot);
+    }
+  }
+  queued.notify_one();
+}
+
+int SnapshotWriter::written() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return nwritten;
+}
+
+int SnapshotWriter::dropped() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return ndropped;
+}
+
+void SnapshotWriter::work() {
+  std::unique_lock<std::mutex> lock(mutex);
+  while(true) {
+    while(queue.empty() and not stopping) {
+      queued.wait(lock);
+    }
+    if(queue.empty()) {
+      return;
+    }
+    Snapshot snapshot;
+    std::swap(snapshot, queue.front());
+    queue.pop_front();
+    lock.unlock();
+    renderFaceRadiosityToTexture(model, snapshot.radiosity, size, snapshot.filename);
+    lock.lock();
+    ++nwritten;
+  }
+}
@@ -0,0 +1,125 @@
+#include <algorithm>
+#include <iostream>
+
+#include "southwell.hpp"
+#include "hemicube.hpp"
+#include "rendering.hpp"
+#include "snapshot_writer.hpp"
+#include "form_factor_row_cache.hpp"
+
+// Rows rendered one hemicube at a time, through the row cache so a face
+// shot again doesn't need its hemicube again
+class HemicubeRows {
+  public:
+    HemicubeRows(FormFactorRowCache& cache):
+      cache(cache),
+      scratch(cache.getGridSize(), cache.getModel().nfaces())
+    {}
+
+    SparseRow getRow(int i) {
+      current = cache.getRow(i, scratch);
+      return current->row();
+    }
+  private:
+    FormFactorRowCache& cache;
+    HemicubeScratch scratch;
+    CachedRowPtr current;
+};
+
+inline float unshotFlux(const Vec3f& unshot, float area) {
+  return (unshot.r + unshot.g + unshot.b)*area;
+}
+
+void FluxQueue::set(int i, float flux) {
+  current[i] = flux;
+  if(flux > 0.f) {
+    heap.push_back(Entry(flux, i));
+    std::push_heap(heap.begin(), heap.end());
+  }
+  if(heap.size() > SOUTHWELL_HEAP_SLACK*current.size()) {
+    heap.clear();
+    for(std::size_t j=0; j<current.size(); ++j) {
+      if(current[j] > 0.f) {
+        heap.push_back(Entry(current[j], (int)j));
+      }
+    }
+    std::make_heap(heap.begin(), heap.end());
+  }
+}
+
+int FluxQueue::pop() {
+  while(not heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end());
+    Entry top = heap.back();
+    heap.pop_back();
+    if(top.first > 0.f and top.first == current[top.second]) {
+      current[top.second] = 0.f;
+      return top.second;
+    }
+  }
+  return -1;
+}
+
+template <class FormFactorRows>
+int southwellShoot(std::vector<Vec3f>& radiosity, const Model& model, FormFactorRows& rows, float energyCutoff) {
+  const float* areas = model.mesh().areas.data();
+  int nfaces = model.nfaces();
+  std::vector<Vec3f> unshot(nfaces);
+  FluxQueue queue(nfaces);
+  double emitted = 0;
+  for(int i=0; i<nfaces; ++i) {
+    radiosity[i] = unshot[i] = model.getFaceEmissivity(i);
+    queue.set(i, unshotFlux(unshot[i], areas[i]));
+    emitted += queue.flux(i);
+  }
+
+  double remaining = emitted;
+  int maxShots = MAX_PASSES*nfaces;
+  int shots = 0;
+  int nextSnapshot = 1;
+  SnapshotWriter snapshots(model);
+  while(shots < maxShots and remaining > energyCutoff*emitted) {
+    int i = queue.pop();
+    if(i < 0) {
+      break;
+    }
+    Vec3f shooting = unshot[i];
+    unshot[i] = Vec3f(0,0,0);
+    remaining -= unshotFlux(shooting, areas[i]);
+
+    SparseRow row = rows.getRow(i);
+    for(int k=0; k<row.size; ++k) {
+      int j = row.indices[k];
+      Vec3f radiosityOut = shooting.piecewise(model.getFaceReflectivity(j))
+                           *(row.values[k]*areas[i]/areas[j]);
+      radiosity[j] += radiosityOut;
+      unshot[j] += radiosityOut;
+      float jFlux = unshotFlux(unshot[j], areas[j]);
+      remaining += jFlux - queue.flux(j);
+      queue.set(j, jFlux);
+    }
+
+    // Shots double between progress reports, each offered to the snapshot
+    // writer as a pass so its cadence (or its being off) still applies
+    ++shots;
+    if(shots == nextSnapshot) {
+      std::cerr << "Shot " << shots << ", unshot flux " << remaining/emitted << std::endl;
+      snapshots.offer(shots, radiosity);
+      nextSnapshot *= 2;
+    }
+  }
+  std::cerr << "Shots: " << shots << ", unshot flux " << remaining/emitted << std::endl;
+  return shots;
+}
+
+int southwellRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, float energyCutoff) {
+  FormFactorRowCache cache(model, gridSize, std::size_t(FORM_FACTOR_ROW_CACHE_MB)*1024*1024);
+  HemicubeRows rows(cache);
+  int shots = southwellShoot(radiosity, model, rows, energyCutoff);
+  std::cerr << "Row cache: " << cache.hits() << " hits, " << cache.misses() << " misses" << std::endl;
+  return shots;
+}
+
+int southwellRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int gridSize, const SparseMatrix& totalFormFactors, float energyCutoff) {
+  return southwellShoot(radiosity, model, totalFormFactors, energyCutoff);
+}
@@ -0,0 +1,111 @@
+#include <cassert>
+
+#include "sparse_matrix.hpp"
+
+SparseMatrix::SparseMatrix():
+  rowStart(1, 0)
+{
+  refreshView();
+}
+
+SparseMatrix::SparseMatrix(const SparseMatrix& m):
+  rowStart(m.rowStart),
+  indices(m.indices),
+  values(m.values),
+  owner(m.owner),
+  nrowsView(m.nrowsView),
+  rowStartView(m.rowStartView),
+  indicesView(m.indicesView),
+  valuesView(m.valuesView)
+{
+  refreshView();
+}
+
+SparseMatrix& SparseMatrix::operator=(const SparseMatrix& m) {
+  rowStart = m.rowStart;
+  indices = m.indices;
+  values = m.values;
+  owner = m.owner;
+  nrowsView = m.nrowsView;
+  rowStartView = m.rowStartView;
+  indicesView = m.indicesView;
+  valuesView = m.valuesView;
+  refreshView();
+  return *this;
+}
+
+SparseMatrix SparseMatrix::view(std::shared_ptr<const void> owner, int nrows, const std::size_t* rowStart, const int* indices, const float* values) {
+  SparseMatrix m;
+  m.owner = owner;
+  m.nrowsView = nrows;
+  m.rowStartView = rowStart;
+  m.indicesView = indices;
+  m.valuesView = values;
+  return m;
+}
+
+void SparseMatrix::refreshView() {
+  if(owner) {
+    return;
+  }
+  nrowsView = (int)rowStart.size() - 1;
+  rowStartView = rowStart.data();
+  indicesView = indices.data();
+  valuesView = values.data();
+}
+
+std::size_t SparseMatrix::memoryUsage() const {
+  return (nrowsView+1)*sizeof(std::size_t)
+    + nonZeros()*(sizeof(int) + sizeof(float));
+}
+
+void SparseMatrix::reserve(int nrows, std::size_t nonZeros) {
+  rowStart.reserve(nrows+1);
+  indices.reserve(nonZeros);
+  values.reserve(nonZeros);
+  refreshView();
+}
+
+void SparseMatrix::appendRow(const std::vector<int>& rowIndices, const std::vector<float>& rowValues) {
+  assert(rowIndices.size() == rowValues.size());
+  assert(not owner);
+  indices.insert(indices.end(), rowIndices.begin(), rowIndices.end());
+  values.insert(values.end(), rowValues.begin(), rowValues.end());
+  rowStart.push_back(values.size());
+  refreshView();
+}
+
+SparseRow SparseMatrix::getRow(int i) const {
+  assert(i < nrows());
+  SparseRow row;
+  row.size = rowStartView[i+1] - rowStartView[i];
+  row.indices = indicesView + rowStartView[i];
+  row.values = valuesView + rowStartView[i];
+  return row;
+}
+
+float SparseMatrix::get(int i, int j) const {
+  SparseRow row = getRow(i);
+  for(int k=0; k<row.size; ++k) {
+    if(row.indices[k] == j) {
+      return row.values[k];
+    }
+  }
+  return 0.f;
+}
+
+// Pulls the non-zero entries out of a hemicube row (indexed by item buffer
+// id, so face j lives at j+1) and resets the row to zero for reuse
+void SparseMatrix::compressRow(float* formFactors, int nfaces, int faceIdx, std::vector<int>& rowIndices, std::vector<float>& rowValues) {
+  rowIndices.clear();
+  rowValues.clear();
+  formFactors[0] = 0.f;
+  for(int j=0; j<nfaces; ++j) {
+    float formFactor = formFactors[j+1];
+    if(formFactor != 0.f and j != faceIdx) {
+      rowIndices.push_back(j);
+      rowValues.push_back(formFactor);
+    }
+    formFactors[j+1] = 0.f;
+  }
+}
@@ -0,0 +1,148 @@
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "stochastic.hpp"
+#include "ray_cast.hpp"
+#include "shooting.hpp"
+#include "hemicube_scheduler.hpp"
+#include "snapshot_writer.hpp"
+
+// Steps of the 4D Kronecker sequence, the powers of 1/phi_4 where phi_4 is
+// the real root of x^5 = x + 1 (Roberts' generalised golden ratio)
+const double KRONECKER_STEPS[4] = {0.8566748838545029, 0.7338918566271260, 0.6287067210378086, 0.5385972572236101};
+
+// SplitMix64
+inline uint64_t nextRandom(uint64_t& state) {
+  uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27))*0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// In [0, 1)
+inline double uniformRandom(uint64_t& state) {
+  return (nextRandom(state) >> 11)*(1.0/9007199254740992.0);
+}
+
+double allocateRays(const Model& model, const std::vector<Vec3f>& diff, int nrays, double offset, std::vector<int>& rays) {
+  int nfaces = model.nfaces();
+  rays.assign(nfaces, 0);
+  double total = 0.0;
+  for(int i=0; i<nfaces; ++i) {
+    total += model.area(i)*(diff[i].r + diff[i].g + diff[i].b);
+  }
+  if(total <= 0.0) {
+    return 0.0;
+  }
+  double share = offset;
+  long before = 0;
+  for(int i=0; i<nfaces; ++i) {
+    share += nrays*model.area(i)*(diff[i].r + diff[i].g + diff[i].b)/total;
+    long after = std::min((long)std::floor(share), (long)nrays);
+    rays[i] = (int)(after - before);
+    before = after;
+  }
+  return total;
+}
+
+// Each lane shoots the rays of its blocks of faces
+class StochasticLaneJob: public HemicubeJob {
+  public:
+    StochasticLaneJob(const Model& model, const RayCaster& caster, ShootingLanes& lanes, const std::vector<Vec3f>& diff, const std::vector<int>& rays, double powerPerRay, uint64_t seed):
+      model(model), caster(caster), lanes(lanes), diff(diff), rays(rays), powerPerRay(powerPerRay), seed(seed) {}
+    void run(int lane, HemicubeScratch&) {
+      for(int block=lane; block<lanes.nblocks(); block+=lanes.nlanes()) {
+        int end = std::min((block+1)*SHOOTING_BLOCK, model.nfaces());
+        for(int i=block*SHOOTING_BLOCK; i<end; ++i) {
+          if(rays[i] > 0) {
+            shootFace(lane, i);
+          }
+        }
+      }
+    }
+  private:
+    const Model& model;
+    const RayCaster& caster;
+    ShootingLanes& lanes;
+    const std::vector<Vec3f>& diff;
+    const std::vector<int>& rays;
+    double powerPerRay;
+    uint64_t seed;
+
+    void shootFace(int lane, int i) {
+      const TriangleMesh& mesh = model.mesh();
+      Vec3f a = mesh.corner(i, 0);
+      Vec3f b = mesh.corner(i, 1);
+      Vec3f c = mesh.corner(i, 2);
+      Vec3f n = mesh.normal(i);
+      Vec3f tangent = n.cross(std::abs(n.x) > 0.9f ? Vec3f(0,1,0) : Vec3f(1,0,0)).normalise();
+      Vec3f bitangent = n.cross(tangent);
+      // Each ray carries A_i diff_i over the face's expected share of rays
+      Vec3f flux = diff[i]*float(powerPerRay/(diff[i].r + diff[i].g + diff[i].b));
+
+      uint64_t state = seed + uint64_t(i)*0xD1B54A32D192ED03ull;
+      double shift[4];
+      for(int d=0; d<4; ++d) {
+        shift[d] = uniformRandom(state);
+      }
+      for(int k=0; k<rays[i]; ++k) {
+        float u[4];
+        for(int d=0; d<4; ++d) {
+          double x = shift[d] + (k+1)*KRONECKER_STEPS[d];
+          u[d] = float(x - std::floor(x));
+        }
+        float s = std::sqrt(u[0]);
+        Vec3f origin = a*(1.f - s) + b*(s*(1.f - u[1])) + c*(s*u[1]);
+        float r = std::sqrt(u[2]);
+        float phi = 2.f*float(M_PI)*u[3];
+        Vec3f dir = tangent*(r*std::cos(phi)) + bitangent*(r*std::sin(phi)) + n*std::sqrt(1.f - u[2]);
+        float t;
+        int hit = caster.firstHit(origin, dir, i, t);
+        // Light reaching the back of a face is lost
+        if(hit >= 0 and mesh.normal(hit).dot(dir) < 0.f) {
+          lanes.deposit(lane, hit, flux);
+        }
+      }
+    }
+};
+
+ConvergenceReport stochasticRadiosity(std::vector<Vec3f>& radiosity, const Model& model, int raysPerPass, uint64_t seed) {
+  int nfaces = model.nfaces();
+  std::vector<Vec3f> diff(nfaces);
+  std::vector<Vec3f> gathered(nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    radiosity[i] = model.getFaceEmissivity(i);
+    diff[i] = radiosity[i];
+  }
+
+  RayCaster caster(model);
+  ShootingLanes lanes(model, SHOOTING_LANES);
+  // Rays need no hemicube, so the threads get the smallest scratch there is
+  HemicubeScheduler scheduler(hemicubeThreads(), 2, 0);
+  std::vector<float> laneCosts;
+  std::vector<int> rays;
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence("Stochastic Jacobi");
+  convergence.start(radiosity);
+  for(int passes=0; passes<MAX_PASSES; ++passes) {
+    uint64_t state = seed + uint64_t(passes)*0xA0761D6478BD642Full;
+    uint64_t passSeed = nextRandom(state);
+    double power = allocateRays(model, diff, raysPerPass, uniformRandom(state), rays);
+    StochasticLaneJob job(model, caster, lanes, diff, rays, power/raysPerPass, passSeed);
+    scheduler.run(job, 0, lanes.nlanes(), laneCosts);
+    lanes.reduce(gathered);
+    for(int i=0; i<nfaces; ++i) {
+      radiosity[i] += gathered[i];
+      diff[i] = gathered[i];
+      convergence.apply(gathered[i]);
+    }
+    bool converged = convergence.endPass();
+    std::cerr << convergence.last() << std::endl;
+    if(converged) {
+      break;
+    }
+    snapshots.offer(passes, radiosity);
+  }
+  return convergence.report();
+}
@@ -0,0 +1,163 @@
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+
+#include "substructure.hpp"
+#include "hemicube.hpp"
+#include "hemicube_scheduler.hpp"
+#include "snapshot_writer.hpp"
+
+// Faces count as coplanar within these
+const float COPLANAR_COSINE = 0.9999f;
+const float COPLANAR_DISTANCE = 1e-3f; // relative to the face's size
+
+inline uint64_t edgeKey(int a, int b) {
+  return (uint64_t(std::min(a, b)) << 32) | uint32_t(std::max(a, b));
+}
+
+inline bool coplanar(const Model& model, int i, int j) {
+  const TriangleMesh& mesh = model.mesh();
+  if(model.face(i).matIdx != model.face(j).matIdx or mesh.normal(i).dot(mesh.normal(j)) < COPLANAR_COSINE) {
+    return false;
+  }
+  float distance = std::abs(mesh.normal(i).dot(mesh.centroid(j)) + mesh.planeD[i]);
+  return distance <= COPLANAR_DISTANCE*std::sqrt(std::max(mesh.areas[i], mesh.areas[j]));
+}
+
+void groupCoplanarFaces(const Model& model, int maxFaces, Patches& patches) {
+  const TriangleMesh& mesh = model.mesh();
+  int nfaces = mesh.nfaces();
+  std::unordered_map<uint64_t, std::vector<int>> edgeFaces;
+  for(int i=0; i<nfaces; ++i) {
+    for(int j=0; j<3; ++j) {
+      edgeFaces[edgeKey(mesh.indices[3*i+j], mesh.indices[3*i+(j+1)%3])].push_back(i);
+    }
+  }
+
+  patches.patchOf.assign(nfaces, -1);
+  patches.start.assign(1, 0);
+  patches.faces.clear();
+  patches.areas.clear();
+  patches.centres.clear();
+  patches.normals.clear();
+  for(int seed=0; seed<nfaces; ++seed) {
+    if(patches.patchOf[seed] >= 0) {
+      continue;
+    }
+    // Breadth first from the seed, so patches stay compact
+    int p = patches.npatches();
+    int count = 0;
+    float area = 0.f;
+    Vec3f centre(0,0,0);
+    std::deque<int> frontier(1, seed);
+    patches.patchOf[seed] = p;
+    while(not frontier.empty() and count < maxFaces) {
+      int i = frontier.front();
+      frontier.pop_front();
+      patches.faces.push_back(i);
+      ++count;
+      area += mesh.areas[i];
+      centre += mesh.centroid(i)*mesh.areas[i];
+      for(int j=0; j<3; ++j) {
+        const std::vector<int>& neighbours = edgeFaces[edgeKey(mesh.indices[3*i+j], mesh.indices[3*i+(j+1)%3])];
+        for(std::size_t k=0; k<neighbours.size(); ++k) {
+          int n = neighbours[k];
+          if(patches.patchOf[n] < 0 and coplanar(model, seed, n)) {
+            patches.patchOf[n] = p;
+            frontier.push_back(n);
+          }
+        }
+      }
+    }
+    // Anything queued past maxFaces is left for a later patch
+    for(std::size_t k=0; k<frontier.size(); ++k) {
+      patches.patchOf[frontier[k]] = -1;
+    }
+    patches.start.push_back((int)patches.faces.size());
+    patches.areas.push_back(area);
+    patches.centres.push_back(centre*(1.f/area));
+    patches.normals.push_back(mesh.normal(seed));
+  }
+}
+
+class PatchRowsJob: public HemicubeJob {
+  public:
+    PatchRowsJob(const Model& model, const Patches& patches, std::vector<std::vector<int>>& indices, std::vector<std::vector<float>>& values, const Buffer<float>& topFace, const Buffer<float>& sideFace):
+      model(model), patches(patches), indices(indices), values(values), topFace(topFace), sideFace(sideFace) {}
+    void run(int p, HemicubeScratch& scratch) {
+      // The patch's own faces lie in the hemicube's base plane, so are clipped
+      scratch.rasteriser.render(model, patches.centres[p], patches.normals[p], -1);
+      scratch.rasteriser.accumulateFormFactors(topFace, sideFace, scratch.row.data());
+      SparseMatrix::compressRow(scratch.row.data(), model.nfaces(), -1, indices[p], values[p]);
+    }
+  private:
+    const Model& model;
+    const Patches& patches;
+    std::vector<std::vector<int>>& indices;
+    std::vector<std::vector<float>>& values;
+    const Buffer<float>& topFace;
+    const Buffer<float>& sideFace;
+};
+
+void calcPatchFormFactors(const Model& model, const Patches& patches, SparseMatrix& formFactors, int gridSize) {
+  Buffer<float> topFace(gridSize, gridSize, 0);
+  Buffer<float> sideFace(gridSize, gridSize/2, 0);
+  calcFormFactorPerCell(gridSize, topFace, sideFace);
+
+  int npatches = patches.npatches();
+  std::vector<std::vector<int>> indices(npatches);
+  std::vector<std::vector<float>> values(npatches);
+  HemicubeScheduler scheduler(hemicubeThreads(), gridSize, model.nfaces());
+  PatchRowsJob job(model, patches, indices, values, topFace, sideFace);
+  std::vector<float> costs;
+  scheduler.run(job, 0, npatches, costs);
+
+  std::size_t nonZeros = 0;
+  for(int p=0; p<npatches; ++p) {
+    nonZeros += indices[p].size();
+  }
+  formFactors.reserve(npatches, nonZeros);
+  for(int p=0; p<npatches; ++p) {
+    formFactors.appendRow(indices[p], values[p]);
+  }
+}
+
+ConvergenceReport substructuredRadiosity(std::vector<Vec3f>& radiosity, const Model& model, const Patches& patches, const SparseMatrix& patchFormFactors) {
+  int nfaces = model.nfaces();
+  const float* areas = model.mesh().areas.data();
+  for(int i=0; i<nfaces; ++i) {
+    radiosity[i] = model.getFaceEmissivity(i);
+  }
+
+  std::vector<Vec3f> gathered(nfaces);
+  SnapshotWriter snapshots(model);
+  ConvergenceTracker convergence("Substructured");
+  convergence.start(radiosity);
+  for(int passes=0; passes<MAX_PASSES; ++passes) {
+    std::fill(gathered.begin(), gathered.end(), Vec3f(0,0,0));
+    for(int p=0; p<patches.npatches(); ++p) {
+      Vec3f patchRadiosity(0,0,0);
+      for(int k=patches.start[p]; k<patches.start[p+1]; ++k) {
+        int i = patches.faces[k];
+        patchRadiosity += radiosity[i]*areas[i];
+      }
+      SparseRow row = patchFormFactors.getRow(p);
+      for(int k=0; k<row.size; ++k) {
+        int i = row.indices[k];
+        gathered[i] += patchRadiosity*(row.values[k]/areas[i]);
+      }
+    }
+    for(int i=0; i<nfaces; ++i) {
+      Vec3f next = model.getFaceEmissivity(i) + gathered[i].piecewise(model.getFaceReflectivity(i));
+      convergence.apply(next - radiosity[i]);
+      radiosity[i] = next;
+    }
+    if(convergence.endPass()) {
+      break;
+    }
+    snapshots.offer(passes, radiosity);
+  }
+  return convergence.report();
+}
@@ -16,3 +16,30 @@ TEST_CASE("fillAll works", "[buffer]") {
     }
   }
 }
+
+TEST_CASE("Chunked buffer set and get works across blocks", "[buffer]") {
+  ChunkedBuffer<int> buffer(10, 7, 0, 3);
+  REQUIRE(buffer.rowsPerBlock == 3);
+  for(int j=0; j<buffer.height; ++j) {
+    for(int i=0; i<buffer.width; ++i) {
+      buffer.set(i, j, j*buffer.width + i);
+    }
+  }
+  for(int j=0; j<buffer.height; ++j) {
+    int* row = buffer.getRow(j);
+    for(int i=0; i<buffer.width; ++i) {
+      REQUIRE(row[i] == j*buffer.width + i);
+      REQUIRE(buffer.get(i, j) == j*buffer.width + i);
+    }
+  }
+}
+
+TEST_CASE("Chunked buffer fills every block", "[buffer]") {
+  ChunkedBuffer<float> buffer(5, 9, 1.f, 2);
+  buffer.fillAll(3.f);
+  for(int j=0; j<buffer.height; ++j) {
+    for(int i=0; i<buffer.width; ++i) {
+      REQUIRE(buffer.get(i, j) == 3.f);
+    }
+  }
+}
@@ -0,0 +1,200 @@
+#include <cstdint>
+#include <random>
+#include <string>
+#include <algorithm>
+#include <limits>
+#include "catch.hpp"
+#include "model.hpp"
+#include "bvh.hpp"
+
+Vec3f randomPoint(std::mt19937& random, const Vec3f& lo, const Vec3f& hi) {
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+  return Vec3f(lo.x + unit(random)*(hi.x - lo.x), lo.y + unit(random)*(hi.y - lo.y), lo.z + unit(random)*(hi.z - lo.z));
+}
+
+bool contains(const BVHNode& outer, const Vec3f& p) {
+  for(int a=0; a<3; ++a) {
+    if(p[a] < outer.lo[a] or p[a] > outer.hi[a]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+class SkipNone {
+  public:
+    bool operator()(int) const { return false; }
+};
+
+int bruteForceHit(const TriangleMesh& mesh, const Vec3f& from, const Vec3f& dir, float tMax, float& t) {
+  int hit = -1;
+  t = tMax;
+  for(int i=0; i<mesh.nfaces(); ++i) {
+    Vec3f v0 = mesh.corner(i, 0);
+    float tFace;
+    if(intersect(from, dir, v0, mesh.corner(i, 1) - v0, mesh.corner(i, 2) - v0, tFace) and tFace > 0.f and tFace < t) {
+      t = tFace;
+      hit = i;
+    }
+  }
+  return hit;
+}
+
+float halfArea(const Vec3f& lo, const Vec3f& hi) {
+  Vec3f d = hi - lo;
+  return d.x*d.y + d.y*d.z + d.z*d.x;
+}
+
+// Expected box and face tests per ray, relative to the root's area
+float sahCost(const FaceBVH& bvh) {
+  float cost = 0.f;
+  for(int i=0; i<bvh.nnodes(); ++i) {
+    const BVHNode& node = bvh.node(i);
+    cost += halfArea(node.lower(), node.upper())*(node.leaf() ? node.count : 1);
+  }
+  return cost/halfArea(bvh.node(0).lower(), bvh.node(0).upper());
+}
+
+class CentroidBelow {
+  public:
+    CentroidBelow(const TriangleMesh& mesh, int axis): mesh(mesh), axis(axis) {}
+    bool operator()(int a, int b) const { return mesh.centroid(a)[axis] < mesh.centroid(b)[axis]; }
+  private:
+    const TriangleMesh& mesh;
+    int axis;
+};
+
+// The same cost, unnormalised, for a tree split at the median centroid
+// along the longest axis down to four faces a leaf
+float medianSplitCost(const TriangleMesh& mesh, std::vector<int>& faces, int begin, int end) {
+  Vec3f lo = mesh.corner(faces[begin], 0), hi = lo;
+  Vec3f centreLo = mesh.centroid(faces[begin]), centreHi = centreLo;
+  for(int k=begin; k<end; ++k) {
+    for(int a=0; a<3; ++a) {
+      for(int j=0; j<3; ++j) {
+        lo[a] = std::min(lo[a], mesh.corner(faces[k], j)[a]);
+        hi[a] = std::max(hi[a], mesh.corner(faces[k], j)[a]);
+      }
+      centreLo[a] = std::min(centreLo[a], mesh.centroid(faces[k])[a]);
+      centreHi[a] = std::max(centreHi[a], mesh.centroid(faces[k])[a]);
+    }
+  }
+  if(end - begin <= 4) {
+    return halfArea(lo, hi)*(end - begin);
+  }
+  Vec3f extent = centreHi - centreLo;
+  int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+  int middle = (begin + end)/2;
+  std::nth_element(faces.begin()+begin, faces.begin()+middle, faces.begin()+end, CentroidBelow(mesh, axis));
+  return halfArea(lo, hi) + medianSplitCost(mesh, faces, begin, middle) + medianSplitCost(mesh, faces, middle, end);
+}
+
+TEST_CASE("BVH splits by surface area beat median splits", "[bvh]") {
+  const char* scenes[] = {"test/scene_subdivided", "test/simple_box_subdivided", "test/scene"};
+  for(int s=0; s<3; ++s) {
+    std::string name(scenes[s]);
+    Model model((name + ".obj").c_str(), (name + ".mtl").c_str());
+    const FaceBVH& bvh = model.bvh();
+    std::vector<int> faces(bvh.faces());
+    float median = medianSplitCost(model.mesh(), faces, 0, model.nfaces())/halfArea(bvh.node(0).lower(), bvh.node(0).upper());
+    REQUIRE(sahCost(bvh) < median);
+  }
+}
+
+TEST_CASE("BVH nodes cover every face once and nest", "[bvh]") {
+  Model model("test/scene_subdivided.obj", "test/scene_subdivided.mtl");
+  const FaceBVH& bvh = model.bvh();
+  const TriangleMesh& mesh = model.mesh();
+
+  REQUIRE(sizeof(BVHNode) == 32);
+  REQUIRE(reinterpret_cast<uintptr_t>(&bvh.node(0))%CACHE_LINE == 0);
+
+  std::vector<int> seen(model.nfaces(), 0);
+  for(std::size_t k=0; k<bvh.faces().size(); ++k) {
+    ++seen[bvh.faces()[k]];
+  }
+  REQUIRE(bvh.faces().size() == std::size_t(model.nfaces()));
+  REQUIRE(std::count(seen.begin(), seen.end(), 1) == model.nfaces());
+
+  int leafFaces = 0;
+  for(int i=0; i<bvh.nnodes(); ++i) {
+    const BVHNode& node = bvh.node(i);
+    if(node.leaf()) {
+      leafFaces += node.count;
+      for(int k=node.first; k<node.first+node.count; ++k) {
+        for(int j=0; j<3; ++j) {
+          REQUIRE(contains(node, mesh.corner(bvh.faces()[k], j)));
+        }
+      }
+    } else {
+      REQUIRE(node.first > i+1);
+      REQUIRE(node.first < bvh.nnodes());
+      const BVHNode* children[2] = {&bvh.node(i+1), &bvh.node(node.first)};
+      for(int c=0; c<2; ++c) {
+        REQUIRE(contains(node, children[c]->lower()));
+        REQUIRE(contains(node, children[c]->upper()));
+      }
+    }
+  }
+  REQUIRE(leafFaces == model.nfaces());
+}
+
+TEST_CASE("BVH ray queries agree with testing every face", "[bvh]") {
+  Model model("test/scene_subdivided.obj", "test/scene_subdivided.mtl");
+  const FaceBVH& bvh = model.bvh();
+  const BVHNode& root = bvh.node(0);
+  std::mt19937 random(5);
+
+  int hits = 0;
+  for(int r=0; r<200; ++r) {
+    Vec3f from = randomPoint(random, root.lower(), root.upper());
+    Vec3f dir = randomPoint(random, Vec3f(-1,-1,-1), Vec3f(1,1,1));
+    float expectedT;
+    int expected = bruteForceHit(model.mesh(), from, dir, std::numeric_limits<float>::max(), expectedT);
+    float t;
+    int hit = bvh.firstHit(from, dir, 0.f, std::numeric_limits<float>::max(), SkipNone(), t);
+    REQUIRE((hit < 0) == (expected < 0));
+    if(expected >= 0) {
+      ++hits;
+      REQUIRE(t == Approx(expectedT));
+      // Short of the nearest hit nothing is in the way; just past it, it is
+      REQUIRE_FALSE(bvh.anyHit(from, dir, 0.f, expectedT*0.999f, SkipNone()));
+      REQUIRE(bvh.anyHit(from, dir, 0.f, expectedT*1.001f, SkipNone()));
+    }
+  }
+  REQUIRE(hits > 100);
+}
+
+TEST_CASE("BVH frustum query returns every face reaching inside", "[bvh]") {
+  Model model("test/scene_subdivided.obj", "test/scene_subdivided.mtl");
+  const TriangleMesh& mesh = model.mesh();
+  const BVHNode& root = model.bvh().node(0);
+  std::mt19937 random(11);
+
+  for(int q=0; q<8; ++q) {
+    Vec3f eye = randomPoint(random, root.lower(), root.upper());
+    Vec3f n = randomPoint(random, Vec3f(-1,-1,-1), Vec3f(1,1,1)).normalise();
+    Vec4f plane(n.x, n.y, n.z, -n.dot(eye));
+    std::vector<int> faces;
+    model.bvh().frustumQuery(&plane, 1, faces);
+
+    std::vector<int> returned(model.nfaces(), 0);
+    for(std::size_t k=0; k<faces.size(); ++k) {
+      ++returned[faces[k]];
+    }
+    int reaching = 0;
+    for(int i=0; i<model.nfaces(); ++i) {
+      REQUIRE(returned[i] <= 1);
+      bool inside = false;
+      for(int j=0; j<3; ++j) {
+        inside = inside or n.dot(mesh.corner(i, j) - eye) > 1e-4f;
+      }
+      if(inside) {
+        ++reaching;
+        REQUIRE(returned[i] == 1);
+      }
+    }
+    REQUIRE(reaching > 0);
+    REQUIRE((int)faces.size() < model.nfaces());
+  }
+}
@@ -1,8 +1,15 @@
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include "catch.hpp"
 #include "hemicube.hpp"
 #include "colours.hpp"
 #include "buffer.hpp"
 #include "rendering.hpp"
+#include "hemicube_rasteriser.hpp"
+#include "hemicube_pipeline.hpp"
+#include "hemicube_scheduler.hpp"
 
 void renderViewFromFace(int faceIdx, int gridSize, const Model& model, std::string filename) {
   Buffer<unsigned int> buffer(gridSize, gridSize, 0);
@@ -315,3 +322,270 @@ TEST_CASE("Compare two side by side faces", "[faces]") {
 
   //renderColourBuffer(buffer, "test/radiosity_box.tga");
 //}
+
+long countNonZero(const Buffer<unsigned int>& buffer) {
+  long count = 0;
+  for(int j=0; j<buffer.height; ++j) {
+    for(int i=0; i<buffer.width; ++i) {
+      count += buffer.get(i, j) != 0;
+    }
+  }
+  return count;
+}
+
+TEST_CASE("Single pass hemicube conserves energy inside a closed box", "[hemicube]") {
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  int gridSize = 256;
+  int nfaces = model.nfaces();
+  Buffer<float> topFace(gridSize, gridSize, 0);
+  Buffer<float> sideFace(gridSize, gridSize/2, 0);
+  calcFormFactorPerCell(gridSize, topFace, sideFace);
+
+  std::vector<float> formFactors(nfaces+1);
+  HemicubeRasteriser hemicube(gridSize);
+  for(int faceIdx=0; faceIdx<nfaces; faceIdx+=97) {
+    std::fill(formFactors.begin(), formFactors.end(), 0.f);
+    hemicube.render(model, faceIdx);
+    hemicube.accumulateFormFactors(topFace, sideFace, formFactors.data());
+
+    float sum = 0.f;
+    for(int i=1; i<nfaces+1; ++i) {
+      REQUIRE(formFactors[i] >= 0.f);
+      REQUIRE(formFactors[i] <= 1.f);
+      sum += formFactors[i];
+    }
+    REQUIRE(formFactors[faceIdx+1] == 0.f);
+    REQUIRE(sum == Approx(1.f).epsilon(0.01));
+  }
+}
+
+TEST_CASE("Single pass hemicube rasterises nothing below the horizon", "[hemicube]") {
+  // Faces on top of the boxes see the floor below their horizon
+  Model model("test/scene.obj", "test/scene.mtl");
+  int gridSize = 128;
+  HemicubeRasteriser hemicube(gridSize);
+  Buffer<unsigned int> fiveRenderBuffer(gridSize, gridSize, 0);
+  long unfoldedPixels = 0;
+  long fiveRenderPixels = 0;
+  for(int faceIdx=0; faceIdx<model.nfaces(); ++faceIdx) {
+    hemicube.render(model, faceIdx);
+    unfoldedPixels += countNonZero(hemicube.items());
+
+    // The same hemicube as five full renders, whose side faces also take
+    // in whatever lies below the patch
+    Vec3f n = model.norm(faceIdx, 0);
+    Vec3f up = getUp(n);
+    Vec3f side = n.cross(up);
+    Vec3f eye = model.centreOf(faceIdx);
+    Vec3f dirs[5] = {n, up, up*-1.f, side, side*-1.f};
+    Vec3f ups[5] = {up, n, n, n, n};
+    for(int k=0; k<5; ++k) {
+      fiveRenderBuffer.fillAll(0);
+      renderHemicube(fiveRenderBuffer, model, faceIdx, eye, dirs[k], ups[k]);
+      fiveRenderPixels += countNonZero(fiveRenderBuffer);
+    }
+  }
+  REQUIRE(unfoldedPixels > 0);
+  REQUIRE(unfoldedPixels <= 0.8*fiveRenderPixels);
+  // Each of the five renders transforms every triangle of the model
+  long fiveRenderVertices = 5*3*long(model.nfaces())*model.nfaces();
+  REQUIRE(hemicube.transformedVertices > 0);
+  REQUIRE(3*hemicube.transformedVertices <= fiveRenderVertices);
+}
+
+void requireSameRow(const SparseRow& actual, const std::vector<int>& indices, const std::vector<float>& values) {
+  REQUIRE(actual.size == (int)indices.size());
+  for(int k=0; k<actual.size; ++k) {
+    REQUIRE(actual.indices[k] == indices[k]);
+    REQUIRE(actual.values[k] == values[k]);
+  }
+}
+
+TEST_CASE("Pipelined hemicube rows match rows rendered in turn", "[hemicube]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  int gridSize = 32;
+  Buffer<float> topFace(gridSize, gridSize, 0);
+  Buffer<float> sideFace(gridSize, gridSize/2, 0);
+  calcFormFactorPerCell(gridSize, topFace, sideFace);
+  std::vector<std::vector<int>> indices(model.nfaces());
+  std::vector<std::vector<float>> values(model.nfaces());
+  std::vector<float> row(model.nfaces()+1, 0.f);
+  for(int i=0; i<model.nfaces(); ++i) {
+    calcFormFactorsSingleFace(model, i, row.data(), gridSize, topFace, sideFace);
+    SparseMatrix::compressRow(row.data(), model.nfaces(), i, indices[i], values[i]);
+  }
+
+  // Fewer ring slots than threads, so workers have to wait for the consumer
+  for(int nthreads=0; nthreads<=3; nthreads+=3) {
+    FormFactorRowCache cache(model, gridSize, 0);
+    HemicubeRowPipeline pipeline(cache, nthreads, 2);
+    for(int pass=0; pass<2; ++pass) {
+      bool reverse = pass == 1;
+      pipeline.beginPass(reverse);
+      for(int k=0; k<model.nfaces(); ++k) {
+        int i = reverse ? model.nfaces()-1-k : k;
+        requireSameRow(pipeline.acquire(i), indices[i], values[i]);
+        pipeline.release(i);
+      }
+    }
+    REQUIRE(cache.hits() == 0);
+  }
+}
+
+TEST_CASE("Form factor row cache evicts the least recently used rows", "[hemicube]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  int gridSize = 32;
+  HemicubeScratch scratch(gridSize, model.nfaces());
+  std::size_t rowBytes = 0;
+  {
+    FormFactorRowCache everything(model, gridSize, std::size_t(1) << 30);
+    for(int i=0; i<model.nfaces(); ++i) {
+      everything.getRow(i, scratch);
+    }
+    rowBytes = everything.memoryUsage()/model.nfaces();
+    for(int i=0; i<model.nfaces(); ++i) {
+      everything.getRow(i, scratch);
+    }
+    REQUIRE(everything.hits() == model.nfaces());
+    REQUIRE(everything.misses() == model.nfaces());
+  }
+
+  // Room for about a quarter of the rows
+  FormFactorRowCache cache(model, gridSize, rowBytes*model.nfaces()/4);
+  CachedRowPtr first = cache.getRow(0, scratch);
+  for(int i=0; i<model.nfaces(); ++i) {
+    cache.getRow(i, scratch);
+  }
+  REQUIRE(cache.memoryUsage() <= rowBytes*model.nfaces()/4);
+  // Row 0 has been evicted but is still usable by whoever holds it
+  REQUIRE(first->row().size > 0);
+  std::size_t misses = cache.misses();
+  cache.getRow(model.nfaces()-1, scratch);
+  REQUIRE(cache.misses() == misses);
+  cache.getRow(0, scratch);
+  REQUIRE(cache.misses() == misses+1);
+
+  // Sweeping back, the rows just cached are hits
+  std::size_t hits = cache.hits();
+  for(int i=model.nfaces()-1; i>=0; --i) {
+    cache.getRow(i, scratch);
+  }
+  REQUIRE(cache.hits() - hits > std::size_t(model.nfaces()/8));
+  for(std::size_t k=0; k<scratch.row.size(); ++k) {
+    REQUIRE(scratch.row[k] == 0.f);
+  }
+}
+
+// Counts each run
+class CountingJob: public HemicubeJob {
+  public:
+    CountingJob(int nitems): runs(nitems, 0) {}
+    void run(int item, HemicubeScratch& scratch) {
+      ++runs[item];
+    }
+    std::vector<int> runs;
+};
+
+TEST_CASE("Hemicube scheduler runs every item once on any number of threads", "[hemicube]") {
+  int nitems = 200;
+  for(int nthreads=1; nthreads<=4; ++nthreads) {
+    HemicubeScheduler scheduler(nthreads, 8, 1);
+    // The first few items estimated far dearer than the rest, which leaves
+    // most chunks to the cheap items; the back half is unmeasured
+    std::vector<float> costs(nitems/2, 1e-3f);
+    std::fill(costs.begin(), costs.begin()+4, 1.f);
+    CountingJob job(nitems);
+    scheduler.run(job, 0, nitems/2, costs);
+    scheduler.run(job, nitems/2, nitems, costs);
+    // Again, chunked by the costs measured the first time
+    scheduler.run(job, 0, nitems, costs);
+    REQUIRE(costs.size() == nitems);
+    for(int i=0; i<nitems; ++i) {
+      REQUIRE(job.runs[i] == 2);
+      // Overwritten with the time counting took
+      REQUIRE(costs[i] > 0.f);
+      REQUIRE(costs[i] < 1.f);
+    }
+  }
+}
+
+// Records which thread ran each item, and holds up the calling thread on
+// the first item it runs until another thread has run one of items 0 to
+// held-1 (for at most 5 seconds)
+class StealingJob: public HemicubeJob {
+  public:
+    StealingJob(int nitems, int held): ran(nitems), caller(std::this_thread::get_id()), held(held), waited(false) {}
+    void run(int item, HemicubeScratch& scratch) {
+      std::unique_lock<std::mutex> lock(mutex);
+      ran[item] = std::this_thread::get_id();
+      if(ran[item] == caller and not waited) {
+        waited = true;
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while(not taken() and changed.wait_until(lock, deadline) == std::cv_status::no_timeout) {
+        }
+      }
+      changed.notify_all();
+    }
+    // Whether a thread other than the caller has run one of the held items
+    bool taken() const {
+      for(int i=0; i<held; ++i) {
+        if(ran[i] != std::thread::id() and ran[i] != caller) {
+          return true;
+        }
+      }
+      return false;
+    }
+    std::vector<std::thread::id> ran;
+  private:
+    std::thread::id caller;
+    int held;
+    bool waited;
+    std::mutex mutex;
+    std::condition_variable changed;
+};
+
+TEST_CASE("Hemicube scheduler deals out dear items thinly and steals from a stuck thread", "[hemicube]") {
+  int nitems = 200;
+  HemicubeScheduler scheduler(4, 8, 1);
+  // Items 0-9 are estimated 100 times dearer than the rest, so each is a
+  // chunk of its own and the calling thread's quarter of the cost is
+  // items 0-2 alone
+  std::vector<float> costs(nitems, 0.1f);
+  std::fill(costs.begin(), costs.begin()+10, 10.f);
+  // Stuck on its first item, the calling thread only gets on once another
+  // thread has stolen from its share
+  StealingJob job(nitems, 3);
+  scheduler.run(job, 0, nitems, costs);
+  REQUIRE(job.taken());
+  for(int i=0; i<nitems; ++i) {
+    REQUIRE(job.ran[i] != std::thread::id());
+  }
+}
+
+TEST_CASE("Scheduled whole model form factors match single faces", "[hemicube]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  int gridSize = 32;
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, gridSize);
+
+  Buffer<float> topFace(gridSize, gridSize, 0);
+  Buffer<float> sideFace(gridSize, gridSize/2, 0);
+  calcFormFactorPerCell(gridSize, topFace, sideFace);
+  std::vector<float> row(model.nfaces()+1, 0.f);
+  for(int i=0; i<model.nfaces(); ++i) {
+    std::fill(row.begin(), row.end(), 0.f);
+    calcFormFactorsSingleFace(model, i, row.data(), gridSize, topFace, sideFace);
+    SparseRow sparse = formFactors.getRow(i);
+    int k = 0;
+    for(int j=0; j<model.nfaces(); ++j) {
+      if(j == i or row[j+1] == 0.f) {
+        continue;
+      }
+      REQUIRE(k < sparse.size);
+      REQUIRE(sparse.indices[k] == j);
+      REQUIRE(sparse.values[k] == row[j+1]);
+      ++k;
+    }
+    REQUIRE(k == sparse.size);
+  }
+}
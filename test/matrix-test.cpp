@@ -32,3 +32,24 @@ TEST_CASE("Ensure matrix multiplacation works 2", "[matrix]") {
   Vec4f result = m*v;
   REQUIRE(result == Vec4f(17, 8, 12, 18));
 }
+
+TEST_CASE("Mat4 products match Matrix", "[matrix]") {
+  Matrix a = Matrix::identity(4);
+  Matrix b = Matrix::identity(4);
+  for(int i=0; i<4; ++i) {
+    for(int j=0; j<4; ++j) {
+      a.set(i, j, 0.1f*(i*4+j) - 0.7f);
+      b.set(i, j, 1.3f - 0.2f*(j*4+i));
+    }
+  }
+  Mat4 product = Mat4(a)*Mat4(b);
+  Matrix expected = a*b;
+  for(int i=0; i<4; ++i) {
+    for(int j=0; j<4; ++j) {
+      REQUIRE(product.get(i, j) == expected.get(i, j));
+    }
+  }
+
+  Vec4f v(0.3f, -2.f, 5.5f, 1.f);
+  REQUIRE(Mat4(a)*v == a*v);
+}
@@ -57,3 +57,27 @@ TEST_CASE("Test viewing two boxes with different normals", "[model]") {
 
   renderColourBuffer(buffer, "test/dual_cube_different_normals.tga");
 }
+
+TEST_CASE("Triangle mesh view matches the model", "[model]") {
+  Model model("test/scene.obj", "test/scene.mtl");
+  const TriangleMesh& mesh = model.mesh();
+  REQUIRE(mesh.nfaces() == model.nfaces());
+  REQUIRE(mesh.nverts() == model.nverts());
+
+  for(int i=0; i<model.nfaces(); ++i) {
+    const Face& face = model.face(i);
+    for(int j=0; j<3; ++j) {
+      REQUIRE(mesh.corner(i, j) == model.vert(face[j].ivert));
+    }
+    Vec3f n = mesh.normal(i);
+    REQUIRE(n == model.norm(i, 0));
+    // Half the cross product of two edges, from the model's own vertices
+    Vec3f a = model.vert(face[0].ivert);
+    float area = 0.5f*(model.vert(face[1].ivert) - a).cross(model.vert(face[2].ivert) - a).norm();
+    REQUIRE(mesh.areas[i] == Approx(area).epsilon(1e-4));
+    // Every corner lies on the face's plane
+    for(int j=0; j<3; ++j) {
+      REQUIRE(n.dot(mesh.corner(i, j)) + mesh.planeD[i] == Approx(0.f).margin(1e-4));
+    }
+  }
+}
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include "catch.hpp"
+#include "obj_parser.hpp"
+#include "mapped_file.hpp"
+
+const char* OBJ_TEST_FILES[] = {
+  "test/box_one_light_wall", "test/dual_cube_different_normals", "test/red_green_walls",
+  "test/scene", "test/scene_basic", "test/scene_subdivided", "test/scene_subdivide_6",
+  "test/simple_box", "test/simple_box_subdivided"
+};
+
+void loadMaterials(const std::string& name, MaterialTable& materialsTable) {
+  MappedFile mtl((name + ".mtl").c_str());
+  REQUIRE(mtl.valid());
+  std::vector<Material> materials;
+  parseMtl(mtl.data(), mtl.data() + mtl.size(), materials, materialsTable);
+}
+
+TEST_CASE("Mapped parser matches the line by line parser", "[obj]") {
+  for(const char* name : OBJ_TEST_FILES) {
+    MaterialTable materialsTable;
+    loadMaterials(name, materialsTable);
+
+    std::string objFilename = std::string(name) + ".obj";
+    ObjData expected;
+    std::ifstream in(objFilename.c_str());
+    parseObjLegacy(in, materialsTable, expected);
+    MappedFile obj(objFilename.c_str());
+    ObjData actual;
+    parseObj(obj.data(), obj.data() + obj.size(), materialsTable, actual);
+
+    REQUIRE(actual.verts.size() == expected.verts.size());
+    REQUIRE(actual.uvs.size() == expected.uvs.size());
+    REQUIRE(actual.norms.size() == expected.norms.size());
+    REQUIRE(actual.faces.size() == expected.faces.size());
+    for(size_t i=0; i<expected.verts.size(); ++i) {
+      REQUIRE(actual.verts[i] == expected.verts[i]);
+    }
+    for(size_t i=0; i<expected.uvs.size(); ++i) {
+      REQUIRE(actual.uvs[i] == expected.uvs[i]);
+    }
+    for(size_t i=0; i<expected.norms.size(); ++i) {
+      REQUIRE(actual.norms[i] == expected.norms[i]);
+    }
+    for(size_t i=0; i<expected.faces.size(); ++i) {
+      REQUIRE(actual.faces[i].matIdx == expected.faces[i].matIdx);
+      REQUIRE(actual.faces[i].size() == expected.faces[i].size());
+      for(int j=0; j<expected.faces[i].size(); ++j) {
+        REQUIRE(actual.faces[i][j] == expected.faces[i][j]);
+      }
+    }
+  }
+}
+
+TEST_CASE("Relative indices and materials carry across chunks", "[obj]") {
+  // Several megabytes, so the text is split into multiple chunks
+  MaterialTable materialsTable({{"a", 0}, {"b", 1}});
+  std::ostringstream text;
+  int nfaces = 40000;
+  for(int i=0; i<nfaces; ++i) {
+    if(i%1000 == 0) {
+      text << "usemtl " << (i%2000 == 0 ? "a" : "b") << "\n";
+    }
+    for(int k=0; k<3; ++k) {
+      text << "v " << i << ".5 " << k << " -1.25e-1\n";
+    }
+    text << "vn 0 0 1\n";
+    text << "f -3//-1 -2//-1 -1//-1\n";
+  }
+  std::string obj = text.str();
+  ObjData data;
+  parseObj(obj.data(), obj.data() + obj.size(), materialsTable, data);
+
+  REQUIRE(data.verts.size() == 3*nfaces);
+  REQUIRE(data.norms.size() == nfaces);
+  REQUIRE(data.faces.size() == nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    const Face& f = data.faces[i];
+    REQUIRE(f.size() == 3);
+    REQUIRE(f.matIdx == (i/1000)%2);
+    for(int k=0; k<3; ++k) {
+      REQUIRE(f[k].ivert == 3*i+k);
+      REQUIRE(f[k].iuv == -1);
+      REQUIRE(f[k].inorm == i);
+    }
+    REQUIRE(data.verts[3*i+2] == Vec3f(i+0.5f, 2.f, -0.125f));
+  }
+}
+
+TEST_CASE("Parser throughput", "[.benchmark]") {
+  for(const char* name : OBJ_TEST_FILES) {
+    MaterialTable materialsTable;
+    loadMaterials(name, materialsTable);
+    std::string objFilename = std::string(name) + ".obj";
+
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(objFilename.c_str());
+    ObjData legacy;
+    parseObjLegacy(in, materialsTable, legacy);
+    auto middle = std::chrono::steady_clock::now();
+    MappedFile obj(objFilename.c_str());
+    ObjData mapped;
+    parseObj(obj.data(), obj.data() + obj.size(), materialsTable, mapped);
+    auto end = std::chrono::steady_clock::now();
+
+    double megabytes = obj.size()/1e6;
+    double legacySeconds = std::chrono::duration<double>(middle - start).count();
+    double mappedSeconds = std::chrono::duration<double>(end - middle).count();
+    std::cout << objFilename << ": " << megabytes << "MB, line by line "
+      << megabytes/legacySeconds << "MB/s, mapped " << megabytes/mappedSeconds << "MB/s" << std::endl;
+  }
+}
@@ -2,6 +2,10 @@
 
 #include <vector>
 #include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <chrono>
+#include <thread>
 
 #include "geometry.hpp"
 #include "model.hpp"
@@ -9,6 +13,7 @@
 #include "colours.hpp"
 #include "buffer.hpp"
 #include "rendering.hpp"
+#include "snapshot_writer.hpp"
 
 void outputRadiosity(const std::vector<TGAColor>& radiosity, const std::string& filename) {
   std::ofstream file(filename.c_str());
@@ -55,3 +60,78 @@ TEST_CASE("Output texture based on input uv coords", "[output]") {
 
   renderColourBuffer(buffer, "test/simple_box_texture.tga");
 }
+
+bool snapshotExists(int pass) {
+  std::stringstream filename;
+  filename << "test/snapshot_test_" << pass << ".tga";
+  std::ifstream file(filename.str().c_str());
+  bool exists = file.good();
+  file.close();
+  std::remove(filename.str().c_str());
+  return exists;
+}
+
+TEST_CASE("Snapshots are written in the background every N passes", "[output]") {
+  Model model("test/simple_box.obj", "test/simple_box.mtl");
+  std::vector<Vec3f> radiosity(model.nfaces(), Vec3f(0.5f, 0.5f, 0.5f));
+  {
+    SnapshotWriter disabled(model, 64, 0, 0.f, 2, "test/snapshot_test_");
+    REQUIRE_FALSE(disabled.enabled());
+    disabled.offer(0, radiosity);
+    disabled.write(1, radiosity);
+    REQUIRE(disabled.written() == 0);
+  }
+  REQUIRE_FALSE(snapshotExists(0));
+  REQUIRE_FALSE(snapshotExists(1));
+
+  // Plenty of room in the queue, so every due pass is written
+  {
+    SnapshotWriter snapshots(model, 64, 2, 0.f, 8, "test/snapshot_test_");
+    for(int pass=0; pass<6; ++pass) {
+      snapshots.offer(pass, radiosity);
+    }
+  }
+  for(int pass=0; pass<6; ++pass) {
+    REQUIRE(snapshotExists(pass) == (pass%2 == 0));
+  }
+}
+
+TEST_CASE("Snapshots past a full queue replace the newest waiting one", "[output]") {
+  Model model("test/simple_box.obj", "test/simple_box.mtl");
+  std::vector<Vec3f> radiosity(model.nfaces(), Vec3f(0.5f, 0.5f, 0.5f));
+  int npasses = 50;
+  int written, dropped;
+  {
+    // Queueing is far quicker than a 1200 pixel render, so the queue fills
+    SnapshotWriter snapshots(model, 1200, 1, 0.f, 1, "test/snapshot_test_");
+    for(int pass=0; pass<npasses; ++pass) {
+      snapshots.offer(pass, radiosity);
+    }
+    dropped = snapshots.dropped();
+  }
+  REQUIRE(dropped > 0);
+  written = 0;
+  for(int pass=0; pass<npasses-1; ++pass) {
+    written += snapshotExists(pass);
+  }
+  // The latest pass is never the one dropped
+  REQUIRE(snapshotExists(npasses-1));
+  REQUIRE(written + 1 + dropped == npasses);
+}
+
+TEST_CASE("Snapshots are written every N seconds", "[output]") {
+  Model model("test/simple_box.obj", "test/simple_box.mtl");
+  std::vector<Vec3f> radiosity(model.nfaces(), Vec3f(0.5f, 0.5f, 0.5f));
+  {
+    SnapshotWriter snapshots(model, 64, 0, 0.2f, 8, "test/snapshot_test_");
+    REQUIRE(snapshots.enabled());
+    snapshots.offer(0, radiosity);
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    snapshots.offer(1, radiosity);
+    // The clock restarts from the pass just queued
+    snapshots.offer(2, radiosity);
+  }
+  REQUIRE_FALSE(snapshotExists(0));
+  REQUIRE(snapshotExists(1));
+  REQUIRE_FALSE(snapshotExists(2));
+}
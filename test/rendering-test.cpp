@@ -1,4 +1,5 @@
 #include <iostream>
+#include <cstdlib>
 
 #include "catch.hpp"
 #include "rendering.hpp"
@@ -177,6 +178,32 @@ TEST_CASE("rasteriser & z-buffer works with intersecting tris", "[renderer]") {
   }
 }
 
+TEST_CASE("Edge function rasteriser matches barycentric rasteriser", "[renderer]") {
+  // Integer vertices so coverage is exact in both, spanning several tiles
+  // and hanging off every side of the buffer
+  int size = 37;
+  Buffer<float> zExpected(size, size, 0.f);
+  Buffer<unsigned int> expected(size, size, 0);
+  Buffer<float> zActual(size, size, 0.f);
+  Buffer<unsigned int> actual(size, size, 0);
+  srand(1);
+  for(unsigned int id=1; id<=200; ++id) {
+    std::vector<Vec3f> pts;
+    for(int k=0; k<3; ++k) {
+      pts.push_back(Vec3f(rand()%(size+10) - 5, rand()%(size+10) - 5, (rand()%1000)/100.f));
+    }
+    renderTriangle<unsigned int, float>(pts, zExpected, expected, id);
+    rasteriseTriangle(pts.data(), zActual, actual, id, 0, size-1);
+  }
+
+  for(int j=0; j<size; ++j) {
+    for(int i=0; i<size; ++i) {
+      REQUIRE(actual.get(i, j) == expected.get(i, j));
+      REQUIRE(zActual.get(i, j) == zExpected.get(i, j));
+    }
+  }
+}
+
 TEST_CASE("Test calculation of form factors per cell", "[form_factors]") {
   int size = 512;
   Buffer<float> topFace(size, size);
@@ -0,0 +1,164 @@
+#include <cstdio>
+#include <fstream>
+#include "catch.hpp"
+#include "model.hpp"
+#include "scene_cache.hpp"
+
+void requireSameModel(const Model& a, const Model& b) {
+  REQUIRE(a.nfaces() == b.nfaces());
+  REQUIRE(a.nverts() == b.nverts());
+  for(int i=0; i<a.nverts(); ++i) {
+    REQUIRE(a.vert(i) == b.vert(i));
+  }
+  for(int i=0; i<a.nfaces(); ++i) {
+    REQUIRE(a.face(i).size() == b.face(i).size());
+    for(int j=0; j<a.face(i).size(); ++j) {
+      REQUIRE(a.face(i)[j] == b.face(i)[j]);
+      REQUIRE(a.uv(i, j) == b.uv(i, j));
+    }
+    REQUIRE(a.norm(i, 0) == b.norm(i, 0));
+    REQUIRE(a.area(i) == b.area(i));
+    REQUIRE(a.centreOf(i) == b.centreOf(i));
+    REQUIRE(a.getFaceReflectivity(i) == b.getFaceReflectivity(i));
+    REQUIRE(a.getFaceEmissivity(i) == b.getFaceEmissivity(i));
+  }
+  REQUIRE(a.mesh().planeD == b.mesh().planeD);
+  REQUIRE(a.mesh().indices == b.mesh().indices);
+}
+
+TEST_CASE("Scene cache reloads the same model", "[scene_cache]") {
+  const char* cache = "test/scene_cache_test.scene";
+  std::remove(cache);
+
+  Model parsed("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  Model written("test/red_green_walls.obj", "test/red_green_walls.mtl", cache);
+  requireSameModel(parsed, written);
+
+  std::vector<Material> materials;
+  ObjData data;
+  TriangleMesh mesh;
+  REQUIRE(readSceneCache(cache, "test/red_green_walls.obj", "test/red_green_walls.mtl", materials, data, mesh));
+  Model reloaded("test/red_green_walls.obj", "test/red_green_walls.mtl", cache);
+  requireSameModel(parsed, reloaded);
+
+  std::remove(cache);
+}
+
+TEST_CASE("Scene cache is rejected when a source changes", "[scene_cache]") {
+  const char* cache = "test/scene_cache_stale.scene";
+  const char* obj = "test/scene_cache_stale.obj";
+  {
+    std::ifstream in("test/scene.obj");
+    std::ofstream out(obj);
+    out << in.rdbuf();
+  }
+  Model first(obj, "test/scene.mtl", cache);
+
+  std::vector<Material> materials;
+  ObjData data;
+  TriangleMesh mesh;
+  REQUIRE(readSceneCache(cache, obj, "test/scene.mtl", materials, data, mesh));
+  // A different model must not be served from the cache
+  REQUIRE_FALSE(readSceneCache(cache, "test/simple_box.obj", "test/scene.mtl", materials, data, mesh));
+
+  {
+    std::ofstream out(obj, std::ios::app);
+    out << "v 0 0 0\n";
+  }
+  REQUIRE_FALSE(readSceneCache(cache, obj, "test/scene.mtl", materials, data, mesh));
+  Model second(obj, "test/scene.mtl", cache);
+  REQUIRE(second.nverts() == first.nverts() + 1);
+
+  std::remove(cache);
+  std::remove(obj);
+}
+
+TEST_CASE("Scene cache takes the new mtime of a touched source", "[scene_cache]") {
+  const char* cache = "test/scene_cache_touched.scene";
+  std::remove(cache);
+  Model written("test/red_green_walls.obj", "test/red_green_walls.mtl", cache);
+
+  SceneCacheHeader header;
+  {
+    std::ifstream in(cache, std::ios::binary);
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+  }
+  // As if the source had been checked out again
+  header.obj.mtime -= 1000000000;
+  {
+    std::fstream out(cache, std::ios::in | std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  }
+
+  std::vector<Material> materials;
+  ObjData data;
+  TriangleMesh mesh;
+  REQUIRE(readSceneCache(cache, "test/red_green_walls.obj", "test/red_green_walls.mtl", materials, data, mesh));
+  SceneCacheHeader restamped;
+  {
+    std::ifstream in(cache, std::ios::binary);
+    in.read(reinterpret_cast<char*>(&restamped), sizeof(restamped));
+  }
+  SourceStamp current;
+  REQUIRE(stampSource("test/red_green_walls.obj", current, false));
+  REQUIRE(restamped.obj.mtime == current.mtime);
+  REQUIRE(restamped.obj.hash == header.obj.hash);
+
+  std::remove(cache);
+}
+
+TEST_CASE("Scene cache is rejected when it indexes out of range", "[scene_cache]") {
+  const char* cache = "test/scene_cache_corrupt.scene";
+  const char* obj = "test/red_green_walls.obj";
+  const char* mtl = "test/red_green_walls.mtl";
+  Model model(obj, mtl);
+  std::vector<Material> materials;
+  materials.push_back(Material(Vec3f(0.5f, 0.5f, 0.5f), Vec3f(0,0,0)));
+  ObjData data;
+  for(int i=0; i<model.nverts(); ++i) {
+    data.verts.push_back(model.vert(i));
+  }
+  Face face;
+  face.matIdx = 0;
+  face.push_back(0, -1, -1);
+  face.push_back(1, -1, -1);
+  face.push_back(2, -1, -1);
+  data.faces.push_back(face);
+  TriangleMesh mesh = model.mesh();
+
+  std::vector<Material> readMaterials;
+  ObjData readData;
+  TriangleMesh readMesh;
+  // One face, and a mesh with the model's many
+  REQUIRE(writeSceneCache(cache, obj, mtl, materials, data, mesh));
+  REQUIRE_FALSE(readSceneCache(cache, obj, mtl, readMaterials, readData, readMesh));
+
+  mesh.indices.assign(3, 0);
+  mesh.nx.assign(1, 0.f); mesh.ny.assign(1, 0.f); mesh.nz.assign(1, 1.f);
+  mesh.cx.assign(1, 0.f); mesh.cy.assign(1, 0.f); mesh.cz.assign(1, 0.f);
+  mesh.planeD.assign(1, 0.f);
+  mesh.areas.assign(1, 1.f);
+  REQUIRE(writeSceneCache(cache, obj, mtl, materials, data, mesh));
+  REQUIRE(readSceneCache(cache, obj, mtl, readMaterials, readData, readMesh));
+
+  ObjData bad = data;
+  bad.faces[0].push_back((int)data.verts.size(), -1, -1);
+  REQUIRE(writeSceneCache(cache, obj, mtl, materials, bad, mesh));
+  REQUIRE_FALSE(readSceneCache(cache, obj, mtl, readMaterials, readData, readMesh));
+
+  bad = data;
+  bad.faces[0].push_back(0, 0, -1);
+  REQUIRE(writeSceneCache(cache, obj, mtl, materials, bad, mesh));
+  REQUIRE_FALSE(readSceneCache(cache, obj, mtl, readMaterials, readData, readMesh));
+
+  bad = data;
+  bad.faces[0].matIdx = 1;
+  REQUIRE(writeSceneCache(cache, obj, mtl, materials, bad, mesh));
+  REQUIRE_FALSE(readSceneCache(cache, obj, mtl, readMaterials, readData, readMesh));
+
+  mesh.indices[1] = (int)data.verts.size();
+  REQUIRE(writeSceneCache(cache, obj, mtl, materials, data, mesh));
+  REQUIRE_FALSE(readSceneCache(cache, obj, mtl, readMaterials, readData, readMesh));
+
+  std::remove(cache);
+}
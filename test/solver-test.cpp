@@ -0,0 +1,651 @@
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include "catch.hpp"
+#include "model.hpp"
+#include "hemicube.hpp"
+#include "sparse_matrix.hpp"
+#include "southwell.hpp"
+#include "gauss_seidel.hpp"
+#include "krylov.hpp"
+#include "convergence.hpp"
+#include "hierarchical.hpp"
+#include "substructure.hpp"
+#include "stochastic.hpp"
+#include "form_factor_rows.hpp"
+#include "form_factor_cache.hpp"
+#include "form_factor_stream.hpp"
+#include "shooting.hpp"
+#include "rendering.hpp"
+#include <cstdio>
+
+// Shooting fixed point B_j = E_j + rho_j sum_i B_i F_ij A_i/A_j, iterated
+// well past convergence
+std::vector<Vec3f> referenceShootingRadiosity(const Model& model, const SparseMatrix& formFactors) {
+  const float* areas = model.mesh().areas.data();
+  std::vector<Vec3f> radiosity(model.nfaces());
+  for(int i=0; i<model.nfaces(); ++i) {
+    radiosity[i] = model.getFaceEmissivity(i);
+  }
+  for(int pass=0; pass<200; ++pass) {
+    std::vector<Vec3f> next(model.nfaces(), Vec3f(0,0,0));
+    for(int i=0; i<model.nfaces(); ++i) {
+      SparseRow row = formFactors.getRow(i);
+      for(int k=0; k<row.size; ++k) {
+        int j = row.indices[k];
+        next[j] += radiosity[i]*(row.values[k]*areas[i]/areas[j]);
+      }
+    }
+    for(int j=0; j<model.nfaces(); ++j) {
+      radiosity[j] = model.getFaceEmissivity(j) + next[j].piecewise(model.getFaceReflectivity(j));
+    }
+  }
+  return radiosity;
+}
+
+float maxRelativeError(const std::vector<Vec3f>& actual, const std::vector<Vec3f>& expected) {
+  Vec3f total(0,0,0);
+  for(size_t i=0; i<expected.size(); ++i) {
+    total += expected[i];
+  }
+  float mean = (total.r + total.g + total.b)/(3*expected.size());
+  float worst = 0.f;
+  for(size_t i=0; i<expected.size(); ++i) {
+    for(int k=0; k<3; ++k) {
+      worst = std::max(worst, std::abs(actual[i][k] - expected[i][k])/mean);
+    }
+  }
+  return worst;
+}
+
+TEST_CASE("Southwell shooting converges to the shooting fixed point", "[solver]") {
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  int gridSize = 64;
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, gridSize);
+  std::vector<Vec3f> expected = referenceShootingRadiosity(model, formFactors);
+
+  std::vector<Vec3f> loose(model.nfaces());
+  std::vector<Vec3f> tight(model.nfaces());
+  int looseShots = southwellRadiosity(loose, model, gridSize, formFactors, 0.05f);
+  int tightShots = southwellRadiosity(tight, model, gridSize, formFactors, 1e-4f);
+  REQUIRE(looseShots < tightShots);
+  REQUIRE(maxRelativeError(tight, expected) < 1e-2f);
+  REQUIRE(maxRelativeError(tight, expected) < maxRelativeError(loose, expected));
+}
+
+TEST_CASE("Southwell hemicubes on demand match precalculated rows", "[solver]") {
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  int gridSize = 64;
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, gridSize);
+
+  std::vector<Vec3f> precalculated(model.nfaces());
+  std::vector<Vec3f> onDemand(model.nfaces());
+  int shots = southwellRadiosity(precalculated, model, gridSize, formFactors, 0.05f);
+  REQUIRE(southwellRadiosity(onDemand, model, gridSize, 0.05f) == shots);
+  REQUIRE(maxRelativeError(onDemand, precalculated) < 1e-3f);
+}
+
+TEST_CASE("Southwell flux queue stays bounded by the face count", "[solver]") {
+  int nfaces = 10;
+  FluxQueue queue(nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    queue.set(i, float(i));
+  }
+  // Face 0 creeping up leaves a stale entry every time
+  for(int k=1; k<=1000; ++k) {
+    queue.set(0, 0.01f*k);
+    REQUIRE(queue.size() <= std::size_t(SOUTHWELL_HEAP_SLACK*nfaces));
+  }
+  // Largest current flux first, stale entries skipped, each face once
+  int expected[] = {0, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+  for(int k=0; k<nfaces; ++k) {
+    REQUIRE(queue.pop() == expected[k]);
+    REQUIRE(queue.flux(expected[k]) == 0.f);
+  }
+  REQUIRE(queue.pop() == -1);
+}
+
+// Jacobi gathering B_i = E_i + rho_i sum_j F_ij B_j from the previous
+// pass, counting passes to the same cutoff as the solvers
+std::vector<Vec3f> jacobiGatheringRadiosity(const Model& model, const SparseMatrix& formFactors, int maxPasses, float cutoff, int& passes) {
+  std::vector<Vec3f> radiosity(model.nfaces());
+  for(int i=0; i<model.nfaces(); ++i) {
+    radiosity[i] = model.getFaceEmissivity(i);
+  }
+  for(passes=1; passes<=maxPasses; ++passes) {
+    std::vector<Vec3f> next(model.nfaces());
+    Vec3f sumChange(0,0,0);
+    Vec3f sumRadiosity(0,0,0);
+    for(int i=0; i<model.nfaces(); ++i) {
+      SparseRow row = formFactors.getRow(i);
+      Vec3f gathered(0,0,0);
+      for(int k=0; k<row.size; ++k) {
+        gathered += radiosity[row.indices[k]]*row.values[k];
+      }
+      next[i] = model.getFaceEmissivity(i) + gathered.piecewise(model.getFaceReflectivity(i));
+      for(int c=0; c<3; ++c) {
+        sumChange[c] += std::abs(next[i][c] - radiosity[i][c]);
+      }
+      sumRadiosity += next[i];
+    }
+    radiosity.swap(next);
+    if(sumChange.r/sumRadiosity.r < cutoff and sumChange.g/sumRadiosity.g < cutoff and sumChange.b/sumRadiosity.b < cutoff) {
+      break;
+    }
+  }
+  return radiosity;
+}
+
+TEST_CASE("Gauss-Seidel and SOR converge in fewer passes than Jacobi", "[solver]") {
+  Model model("test/box_one_light_wall.obj", "test/box_one_light_wall.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  int referencePasses;
+  std::vector<Vec3f> expected = jacobiGatheringRadiosity(model, formFactors, 500, 1e-6f, referencePasses);
+  // Jacobi needs 42 passes here, more than MAX_PASSES allows the solvers
+  int jacobiPasses;
+  std::vector<Vec3f> jacobi = jacobiGatheringRadiosity(model, formFactors, 100, DIFF_TO_TOTAL_CUTOFF, jacobiPasses);
+  REQUIRE(jacobiPasses <= 100);
+
+  std::vector<Vec3f> gaussSeidel(model.nfaces());
+  ConvergenceReport gaussSeidelReport = sorRadiosity(gaussSeidel, model, formFactors, 1.f);
+  REQUIRE(gaussSeidelReport.converged);
+  REQUIRE(gaussSeidelReport.passes < jacobiPasses);
+  REQUIRE(gaussSeidelReport.history.size() == gaussSeidelReport.passes);
+
+  std::vector<Vec3f> sor(model.nfaces());
+  ConvergenceReport sorReport = sorRadiosity(sor, model, formFactors, 1.3f);
+  REQUIRE(sorReport.converged);
+  REQUIRE(sorReport.passes <= gaussSeidelReport.passes);
+  // Over-relaxing by 1.7, the best measured here, does better still
+  std::vector<Vec3f> sorBest(model.nfaces());
+  ConvergenceReport sorBestReport = sorRadiosity(sorBest, model, formFactors, 1.7f);
+  REQUIRE(sorBestReport.converged);
+  REQUIRE(sorBestReport.passes < sorReport.passes);
+  REQUIRE(maxRelativeError(sorBest, expected) <= maxRelativeError(sor, expected));
+
+  // Stopping at DIFF_TO_TOTAL_CUTOFF leaves some light undistributed, but
+  // no more than Jacobi leaves
+  float jacobiError = maxRelativeError(jacobi, expected);
+  REQUIRE(maxRelativeError(gaussSeidel, expected) <= jacobiError);
+  REQUIRE(maxRelativeError(sor, expected) <= jacobiError);
+}
+
+TEST_CASE("Convergence tracker keeps running totals per channel", "[solver]") {
+  // Red and green lit, blue black throughout
+  std::vector<Vec3f> radiosity(4, Vec3f(1.f, 2.f, 0.f));
+  ConvergenceTracker convergence(Vec3f(0.1f, 0.01f, 0.01f));
+  convergence.start(radiosity);
+
+  convergence.apply(Vec3f(0.25f, 0.f, 0.f));
+  convergence.apply(Vec3f(-0.25f, 0.5f, 0.f));
+  REQUIRE_FALSE(convergence.endPass());
+  const PassMetrics& first = convergence.last();
+  REQUIRE(first.pass == 0);
+  REQUIRE(first.total == Vec3f(4.f, 8.5f, 0.f));
+  REQUIRE(first.change == Vec3f(0.5f, 0.5f, 0.f));
+  REQUIRE(first.maxResidual == Vec3f(0.25f, 0.5f, 0.f));
+  REQUIRE(first.relativeChange() == Approx(0.125f));
+
+  // Red is within its looser tolerance, green isn't within its own
+  convergence.apply(Vec3f(0.3f, 0.1f, 0.f));
+  REQUIRE_FALSE(convergence.endPass());
+  convergence.apply(Vec3f(0.3f, 0.05f, 0.f));
+  REQUIRE(convergence.endPass());
+  REQUIRE(convergence.passes().size() == 3);
+  REQUIRE(convergence.last().total.g == Approx(8.65f));
+  // The report is the tracker's own record of the passes
+  const ConvergenceReport& report = convergence.report();
+  REQUIRE(report.converged);
+  REQUIRE(report.passes == 3);
+  REQUIRE(&report.history == &convergence.passes());
+}
+
+TEST_CASE("Krylov solvers reach the gathering fixed point", "[solver]") {
+  Model model("test/box_one_light_wall.obj", "test/box_one_light_wall.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  int referencePasses;
+  std::vector<Vec3f> expected = jacobiGatheringRadiosity(model, formFactors, 500, 1e-6f, referencePasses);
+
+  std::vector<Vec3f> biCGStab(model.nfaces());
+  ConvergenceReport biCGStabReport = biCGStabRadiosity(biCGStab, model, formFactors);
+  REQUIRE(biCGStabReport.converged);
+  REQUIRE(biCGStabReport.history.back().relativeChange() < KRYLOV_TOLERANCE);
+  REQUIRE(maxRelativeError(biCGStab, expected) < 1e-3f);
+
+  // Symmetrising averages away the hemicube's reciprocity error, so this
+  // is close to rather than at the fixed point
+  std::vector<Vec3f> conjugateGradient(model.nfaces());
+  ConvergenceReport conjugateGradientReport = conjugateGradientRadiosity(conjugateGradient, model, formFactors);
+  REQUIRE(conjugateGradientReport.converged);
+  REQUIRE(maxRelativeError(conjugateGradient, expected) < 0.1f);
+
+  std::vector<Vec3f> gaussSeidel(model.nfaces());
+  ConvergenceReport gaussSeidelReport = sorRadiosity(gaussSeidel, model, formFactors, 1.f);
+  REQUIRE(biCGStabReport.passes < gaussSeidelReport.passes);
+  REQUIRE(conjugateGradientReport.passes < gaussSeidelReport.passes);
+}
+
+TEST_CASE("BiCGSTAB reports a breakdown rather than stalling", "[solver]") {
+  // Two lights lit only by each other, with a form factor of 1/rho each
+  // way: the first residual r satisfies r.(I - RF)r = 0
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  std::vector<int> lights;
+  for(int i=0; i<model.nfaces() and lights.size()<2; ++i) {
+    if(model.getFaceEmissivity(i).r > 0.f) {
+      lights.push_back(i);
+    }
+  }
+  REQUIRE(lights.size() == 2);
+  float formFactor = 1.f/model.getFaceReflectivity(lights[0]).r;
+  SparseMatrix formFactors;
+  formFactors.reserve(model.nfaces(), 2);
+  for(int i=0; i<model.nfaces(); ++i) {
+    std::vector<int> indices;
+    std::vector<float> values;
+    if(i == lights[0] or i == lights[1]) {
+      indices.push_back(i == lights[0] ? lights[1] : lights[0]);
+      values.push_back(formFactor);
+    }
+    formFactors.appendRow(indices, values);
+  }
+
+  std::vector<Vec3f> radiosity(model.nfaces());
+  ConvergenceReport report = biCGStabRadiosity(radiosity, model, formFactors);
+  REQUIRE_FALSE(report.converged);
+  REQUIRE(report.passes < MAX_PASSES);
+}
+
+Vec3f totalFlux(const Model& model, const std::vector<Vec3f>& radiosity) {
+  Vec3f flux(0,0,0);
+  for(int i=0; i<model.nfaces(); ++i) {
+    flux += radiosity[i]*model.area(i);
+  }
+  return flux;
+}
+
+TEST_CASE("Hierarchical refinement approaches the hemicube solution", "[solver]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  int passes;
+  Vec3f expected = totalFlux(model, jacobiGatheringRadiosity(model, formFactors, 500, 1e-6f, passes));
+
+  // Face to face links only
+  HierarchicalRadiosity unrefined(model, 1.f, 1.f);
+  unrefined.linkRoots();
+  REQUIRE(unrefined.solve(MAX_PASSES).converged);
+  REQUIRE(unrefined.nelements() == model.nfaces());
+  std::vector<Vec3f> radiosity;
+  unrefined.faceRadiosity(radiosity);
+  Vec3f unrefinedFlux = totalFlux(model, radiosity);
+
+  HierarchicalRadiosity refined(model, 0.01f, 0.0001f);
+  refined.linkRoots();
+  refined.solve(MAX_PASSES);
+  for(int k=0; k<4 and refined.refineLinks(); ++k) {
+    REQUIRE(refined.solve(MAX_PASSES).converged);
+  }
+  refined.faceRadiosity(radiosity);
+  Vec3f refinedFlux = totalFlux(model, radiosity);
+  REQUIRE(refined.nleaves() > 4*model.nfaces());
+  // Far fewer interactions than every leaf with every other
+  REQUIRE(refined.nlinks() < refined.nleaves()*refined.nleaves()/100);
+  for(int k=0; k<3; ++k) {
+    REQUIRE(std::abs(refinedFlux[k] - expected[k]) < 0.01f*expected[k]);
+    REQUIRE(std::abs(refinedFlux[k] - expected[k]) < std::abs(unrefinedFlux[k] - expected[k]));
+  }
+
+  // Each element's radiosity is the area weighted mean of its children's
+  for(int e=0; e<refined.nelements(); ++e) {
+    const Element& element = refined.element(e);
+    if(element.firstChild >= 0) {
+      REQUIRE(element.nchildren == 4);
+      Vec3f mean(0,0,0);
+      for(int c=0; c<4; ++c) {
+        mean += refined.element(refined.child(e, c)).radiosity*0.25f;
+      }
+      for(int k=0; k<3; ++k) {
+        REQUIRE(element.radiosity[k] == Approx(mean[k]));
+      }
+    }
+  }
+}
+
+// The subdivided box with a grid of small grey boxes, open underneath,
+// on its floor
+void writeClutteredBox(const char* filename, int grid) {
+  std::ifstream in("test/simple_box_subdivided.obj");
+  std::ofstream out(filename);
+  out << in.rdbuf() << "\nusemtl Grey\n";
+  const int axes[3][2] = {{1, 2}, {2, 0}, {0, 1}};
+  float half = 0.4f/grid;
+  for(int a=0; a<grid; ++a) {
+    for(int b=0; b<grid; ++b) {
+      Vec3f centre(-1.f + (2*a + 1.f)/grid, -1.f + half, -1.f + (2*b + 1.f)/grid);
+      for(int axis=0; axis<3; ++axis) {
+        for(int side=-1; side<=1; side+=2) {
+          if(axis == 1 and side < 0) {
+            continue;
+          }
+          Vec3f n(0,0,0), u(0,0,0), v(0,0,0);
+          n[axis] = side;
+          u[axes[axis][0]] = half;
+          v[axes[axis][1]] = half;
+          Vec3f c = centre + n*half;
+          Vec3f corners[4] = {c - u - v, c + u - v, c + u + v, c - u + v};
+          for(int k=0; k<4; ++k) {
+            out << "v " << corners[k].x << " " << corners[k].y << " " << corners[k].z << "\n";
+          }
+          out << "vn " << n.x << " " << n.y << " " << n.z << "\n";
+          out << "f -4//-1 -3//-1 -2//-1\nf -4//-1 -2//-1 -1//-1\n";
+        }
+      }
+    }
+  }
+}
+
+TEST_CASE("Clustering links distant groups of faces as one", "[solver]") {
+  const char* obj = "test/cluttered_box_test.obj";
+  writeClutteredBox(obj, 4);
+  Model model(obj, "test/simple_box_subdivided.mtl");
+  std::remove(obj);
+  REQUIRE(model.nfaces() == 192 + 4*4*10);
+
+  HierarchicalRadiosity faces(model, 0.01f, 0.0001f);
+  faces.linkRoots();
+  faces.solve(MAX_PASSES);
+  std::vector<Vec3f> radiosity;
+  faces.faceRadiosity(radiosity);
+  Vec3f expected = totalFlux(model, radiosity);
+
+  HierarchicalRadiosity clustered(model, 0.01f, 0.0001f);
+  clustered.linkClusters();
+  int root = clustered.rootCluster();
+  REQUIRE(root >= 0);
+  REQUIRE(clustered.element(root).faceEnd - clustered.element(root).faceBegin == model.nfaces());
+  int clusterLinks = 0;
+  for(int k=0; k<clustered.nlinks(); ++k) {
+    const Link& l = clustered.linkAt(k);
+    clusterLinks += clustered.element(l.receiver).face < 0 or clustered.element(l.source).face < 0;
+  }
+  REQUIRE(clusterLinks > 0);
+  REQUIRE(clustered.nlinks() < faces.nlinks()/2);
+
+  REQUIRE(clustered.solve(MAX_PASSES).converged);
+  for(int k=0; k<4 and clustered.refineLinks(); ++k) {
+    REQUIRE(clustered.solve(MAX_PASSES).converged);
+  }
+  clustered.faceRadiosity(radiosity);
+  Vec3f flux = totalFlux(model, radiosity);
+  for(int k=0; k<3; ++k) {
+    REQUIRE(std::abs(flux[k] - expected[k]) < 0.05f*expected[k]);
+  }
+
+  // Every face is in exactly one leaf cluster, and clusters hold the area
+  // of their children
+  std::vector<int> seen(model.nfaces(), 0);
+  for(int e=0; e<clustered.nelements(); ++e) {
+    const Element& element = clustered.element(e);
+    if(element.face >= 0) {
+      continue;
+    }
+    float area = 0.f;
+    for(int c=0; c<element.nchildren; ++c) {
+      const Element& member = clustered.element(clustered.child(e, c));
+      REQUIRE(member.parent == e);
+      area += member.area;
+      if(member.face >= 0) {
+        ++seen[member.face];
+      }
+    }
+    REQUIRE(element.area == Approx(area));
+  }
+  for(int i=0; i<model.nfaces(); ++i) {
+    REQUIRE(seen[i] == 1);
+  }
+}
+
+TEST_CASE("Substructured gathering draws a hemicube per patch", "[solver]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  const TriangleMesh& mesh = model.mesh();
+  int maxFaces = 8;
+  Patches patches;
+  groupCoplanarFaces(model, maxFaces, patches);
+  REQUIRE(patches.npatches() < model.nfaces()/4);
+  REQUIRE(patches.faces.size() == model.nfaces());
+  for(int p=0; p<patches.npatches(); ++p) {
+    REQUIRE(patches.start[p+1] - patches.start[p] <= maxFaces);
+    float area = 0.f;
+    for(int k=patches.start[p]; k<patches.start[p+1]; ++k) {
+      int i = patches.faces[k];
+      REQUIRE(patches.patchOf[i] == p);
+      REQUIRE(model.face(i).matIdx == model.face(patches.faces[patches.start[p]]).matIdx);
+      REQUIRE(mesh.normal(i).dot(patches.normals[p]) > 0.999f);
+      area += mesh.areas[i];
+    }
+    REQUIRE(patches.areas[p] == Approx(area));
+  }
+
+  int gridSize = 64;
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, gridSize);
+  int passes;
+  std::vector<Vec3f> expected = jacobiGatheringRadiosity(model, formFactors, 500, 1e-6f, passes);
+
+  SparseMatrix patchFormFactors;
+  calcPatchFormFactors(model, patches, patchFormFactors, gridSize);
+  REQUIRE(patchFormFactors.nrows() == patches.npatches());
+  std::vector<Vec3f> substructured(model.nfaces());
+  REQUIRE(substructuredRadiosity(substructured, model, patches, patchFormFactors).converged);
+  Vec3f expectedFlux = totalFlux(model, expected);
+  Vec3f actualFlux = totalFlux(model, substructured);
+  for(int k=0; k<3; ++k) {
+    REQUIRE(std::abs(actualFlux[k] - expectedFlux[k]) < 0.03f*expectedFlux[k]);
+  }
+  // Patch centres are a coarse view of the patch close up, so faces next to
+  // another wall's patch are off, but not on average
+  float error = 0.f;
+  float total = 0.f;
+  for(int i=0; i<model.nfaces(); ++i) {
+    for(int k=0; k<3; ++k) {
+      error += std::abs(substructured[i][k] - expected[i][k]);
+      total += expected[i][k];
+    }
+  }
+  REQUIRE(error < 0.15f*total);
+
+  // Faces sharing a patch still get radiosities of their own
+  int distinct = 0;
+  for(int p=0; p<patches.npatches(); ++p) {
+    int first = patches.faces[patches.start[p]];
+    for(int k=patches.start[p]+1; k<patches.start[p+1]; ++k) {
+      distinct += substructured[patches.faces[k]] != substructured[first];
+    }
+  }
+  REQUIRE(distinct > model.nfaces()/2);
+}
+
+TEST_CASE("Channel gather matches the padded gather", "[solver]") {
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  std::vector<Vec3f> x(model.nfaces());
+  RadiosityChannels channels(model.nfaces());
+  for(int i=0; i<model.nfaces(); ++i) {
+    x[i] = Vec3f(i%7, i%5, i%3)*0.1f;
+    channels.set(i, x[i]);
+  }
+  for(int i=0; i<model.nfaces(); ++i) {
+    Vec3f expected = gatherRow(x, i, formFactors.getRow(i));
+    Vec3f actual = gatherRow(channels, i, formFactors.getRow(i));
+    for(int k=0; k<3; ++k) {
+      REQUIRE(actual[k] == Approx(expected[k]).epsilon(1e-5));
+    }
+  }
+}
+
+TEST_CASE("Channel gather over dense rows matches the padded gather", "[solver]") {
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  int nfaces = model.nfaces();
+  std::vector<Vec3f> x(nfaces);
+  RadiosityChannels channels(nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    x[i] = Vec3f(i%7, i%5, i%3)*0.1f;
+    channels.set(i, x[i]);
+  }
+  std::vector<float> dense(nfaces+1);
+  for(int i=0; i<nfaces; ++i) {
+    SparseRow row = formFactors.getRow(i);
+    std::fill(dense.begin(), dense.end(), 0.f);
+    for(int k=0; k<row.size; ++k) {
+      dense[row.indices[k]+1] = row.values[k];
+    }
+    // Background and diagonal entries, which must not be gathered
+    dense[0] = 0.5f;
+    dense[i+1] = 0.25f;
+
+    Vec3f expected = gatherRow(x, i, row);
+    Vec3f padded = gatherRow(x, i, dense.data());
+    Vec3f actual = gatherRow(channels, i, dense.data());
+    for(int k=0; k<3; ++k) {
+      REQUIRE(padded[k] == Approx(expected[k]).epsilon(1e-5));
+      REQUIRE(actual[k] == Approx(expected[k]).epsilon(1e-5).margin(1e-6));
+    }
+  }
+}
+
+TEST_CASE("Gather pass throughput", "[.benchmark]") {
+  Model model("test/scene_subdivide_4.obj", "test/scene_subdivide_4.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  std::vector<Vec3f> x(model.nfaces(), Vec3f(1,1,1));
+  std::vector<Vec3f> y(model.nfaces());
+  RadiosityChannels channels(model.nfaces());
+  for(int i=0; i<model.nfaces(); ++i) {
+    channels.set(i, x[i]);
+  }
+  int repeats = 50;
+  auto start = std::chrono::steady_clock::now();
+  for(int pass=0; pass<repeats; ++pass) {
+    for(int i=0; i<model.nfaces(); ++i) {
+      y[i] = gatherRow(x, i, formFactors.getRow(i));
+    }
+  }
+  auto middle = std::chrono::steady_clock::now();
+  for(int pass=0; pass<repeats; ++pass) {
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int i=0; i<model.nfaces(); ++i) {
+      y[i] = gatherRow(channels, i, formFactors.getRow(i));
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  double gigabytes = repeats*formFactors.nonZeros()*(sizeof(int) + sizeof(float))/1e9;
+  std::cout << formFactors.nonZeros() << " non-zeros, padded "
+    << gigabytes/std::chrono::duration<double>(middle - start).count() << "GB/s, channels "
+    << gigabytes/std::chrono::duration<double>(end - middle).count() << "GB/s" << std::endl;
+}
+
+TEST_CASE("Shooting lanes sum to the same pass for any lane count", "[solver]") {
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  std::vector<Vec3f> diff(model.nfaces());
+  for(int i=0; i<model.nfaces(); ++i) {
+    diff[i] = model.getFaceEmissivity(i) + Vec3f(i%7, i%5, i%3)*0.01f;
+  }
+
+  std::vector<Vec3f> expected(model.nfaces(), Vec3f(0,0,0));
+  for(int i=0; i<model.nfaces(); ++i) {
+    SparseRow row = formFactors.getRow(i);
+    for(int k=0; k<row.size; ++k) {
+      int j = row.indices[k];
+      expected[j] += diff[i].piecewise(model.getFaceReflectivity(j))*(row.values[k]*model.area(i)/model.area(j));
+    }
+  }
+  for(int nlanes=1; nlanes<=16; nlanes*=4) {
+    ShootingLanes lanes(model, nlanes);
+    for(int i=0; i<model.nfaces(); ++i) {
+      lanes.shoot(lanes.laneOf(i), i, diff[i], formFactors.getRow(i));
+    }
+    std::vector<Vec3f> gathered(model.nfaces());
+    lanes.reduce(gathered);
+    REQUIRE(maxRelativeError(gathered, expected) < 1e-5f);
+  }
+}
+
+TEST_CASE("Streamed shooting matches in memory shooting exactly", "[solver]") {
+  const char* file = "test/shooting_stream_test.ff";
+  Model model("test/red_green_walls.obj", "test/red_green_walls.mtl");
+  int gridSize = 64;
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, gridSize);
+  uint64_t key = formFactorCacheKey(model, gridSize, 0.01f);
+  REQUIRE(writeFormFactorCache(file, key, formFactors));
+  FormFactorStream stream(file, key, 4096);
+
+  std::vector<Vec3f> expected(model.nfaces());
+  std::vector<Vec3f> actual(model.nfaces());
+  shootRadiosity(expected, model, gridSize, formFactors);
+  shootRadiosity(actual, model, gridSize, stream);
+  REQUIRE(actual == expected);
+  std::remove(file);
+}
+
+TEST_CASE("Rays are shared out by unshot power", "[solver]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  std::vector<Vec3f> diff(model.nfaces());
+  double total = 0.0;
+  for(int i=0; i<model.nfaces(); ++i) {
+    diff[i] = model.getFaceEmissivity(i)*(1.f + i%3);
+    total += model.area(i)*(diff[i].r + diff[i].g + diff[i].b);
+  }
+  int nrays = 1000;
+  std::vector<int> rays;
+  REQUIRE(allocateRays(model, diff, nrays, 0.37, rays) == Approx(total));
+  int sum = 0;
+  for(int i=0; i<model.nfaces(); ++i) {
+    double share = nrays*model.area(i)*(diff[i].r + diff[i].g + diff[i].b)/total;
+    REQUIRE(std::abs(rays[i] - share) < 1.0);
+    sum += rays[i];
+  }
+  REQUIRE(sum == nrays);
+}
+
+TEST_CASE("Stochastic Jacobi approaches the hemicube solution", "[solver]") {
+  Model model("test/simple_box_subdivided.obj", "test/simple_box_subdivided.mtl");
+  SparseMatrix formFactors;
+  calcFormFactorsWholeModel(model, formFactors, 64);
+  int passes;
+  std::vector<Vec3f> expected = jacobiGatheringRadiosity(model, formFactors, 500, 1e-6f, passes);
+  Vec3f expectedFlux = totalFlux(model, expected);
+
+  std::vector<Vec3f> radiosity(model.nfaces());
+  REQUIRE(stochasticRadiosity(radiosity, model, 50000, 7).converged);
+  Vec3f flux = totalFlux(model, radiosity);
+  for(int k=0; k<3; ++k) {
+    REQUIRE(std::abs(flux[k] - expectedFlux[k]) < 0.02f*expectedFlux[k]);
+  }
+  Vec3f error(0,0,0);
+  for(int i=0; i<model.nfaces(); ++i) {
+    for(int k=0; k<3; ++k) {
+      error[k] += std::abs(radiosity[i][k] - expected[i][k])*model.area(i);
+    }
+  }
+  for(int k=0; k<3; ++k) {
+    REQUIRE(error[k] < 0.05f*expectedFlux[k]);
+  }
+
+  // The same seed gives the same answer
+  std::vector<Vec3f> again(model.nfaces());
+  stochasticRadiosity(again, model, 50000, 7);
+  for(int i=0; i<model.nfaces(); ++i) {
+    REQUIRE(again[i] == radiosity[i]);
+  }
+}
@@ -0,0 +1,177 @@
+#include "catch.hpp"
+#include "sparse_matrix.hpp"
+#include "hemicube.hpp"
+#include "buffer.hpp"
+#include "model.hpp"
+#include "form_factor_cache.hpp"
+#include "form_factor_stream.hpp"
+#include "rendering.hpp"
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <iterator>
+
+TEST_CASE("Compressing a row drops zeros and the diagonal", "[sparse]") {
+  int nfaces = 5;
+  float formFactors[] = {0.3f, 0.f, 0.1f, 0.2f, 0.f, 0.4f};
+  std::vector<int> indices;
+  std::vector<float> values;
+
+  SparseMatrix::compressRow(formFactors, nfaces, 2, indices, values);
+
+  REQUIRE(indices.size() == 2);
+  REQUIRE(indices[0] == 1);
+  REQUIRE(values[0] == 0.1f);
+  REQUIRE(indices[1] == 4);
+  REQUIRE(values[1] == 0.4f);
+  for(int i=0; i<nfaces+1; ++i) {
+    REQUIRE(formFactors[i] == 0.f);
+  }
+}
+
+TEST_CASE("Sparse rows are appended in order", "[sparse]") {
+  SparseMatrix matrix;
+  matrix.appendRow({1, 3}, {0.5f, 0.25f});
+  matrix.appendRow({}, {});
+  matrix.appendRow({0}, {1.f});
+
+  REQUIRE(matrix.nrows() == 3);
+  REQUIRE(matrix.nonZeros() == 3);
+  REQUIRE(matrix.getRow(1).size == 0);
+  REQUIRE(matrix.get(0, 3) == 0.25f);
+  REQUIRE(matrix.get(0, 2) == 0.f);
+  REQUIRE(matrix.get(2, 0) == 1.f);
+}
+
+TEST_CASE("Sparse form factors match dense form factors", "[sparse]") {
+  Model model("test/scene.obj", "test/scene.mtl");
+  int gridSize = 64;
+  int nfaces = model.nfaces();
+
+  Buffer<float> dense(nfaces+1, nfaces+1, 0.f);
+  calcFormFactorsWholeModel(model, dense, gridSize);
+  SparseMatrix sparse;
+  calcFormFactorsWholeModel(model, sparse, gridSize);
+
+  REQUIRE(sparse.nrows() == nfaces);
+  for(int i=0; i<nfaces; ++i) {
+    for(int j=0; j<nfaces; ++j) {
+      float expected = i==j ? 0.f : dense.get(j+1, i);
+      REQUIRE(sparse.get(i, j) == expected);
+    }
+  }
+}
+
+TEST_CASE("Form factor cache maps back the same matrix", "[sparse]") {
+  const char* cache = "test/form_factor_cache_test.ff";
+  Model model("test/scene.obj", "test/scene.mtl");
+  int gridSize = 64;
+  SparseMatrix computed;
+  calcFormFactorsWholeModel(model, computed, gridSize);
+
+  uint64_t key = formFactorCacheKey(model, gridSize, 0.01f);
+  REQUIRE(key != formFactorCacheKey(model, gridSize*2, 0.01f));
+  REQUIRE(key != formFactorCacheKey(model, gridSize, 0.02f));
+  REQUIRE(writeFormFactorCache(cache, key, computed));
+
+  SparseMatrix mapped;
+  REQUIRE_FALSE(readFormFactorCache(cache, key+1, model.nfaces(), mapped));
+  REQUIRE(readFormFactorCache(cache, key, model.nfaces(), mapped));
+  // Copies share the mapping, which outlives the original
+  SparseMatrix copy = mapped;
+  mapped = SparseMatrix();
+
+  REQUIRE(copy.nrows() == computed.nrows());
+  REQUIRE(copy.nonZeros() == computed.nonZeros());
+  for(int i=0; i<computed.nrows(); ++i) {
+    SparseRow expected = computed.getRow(i);
+    SparseRow actual = copy.getRow(i);
+    REQUIRE(actual.size == expected.size);
+    for(int k=0; k<expected.size; ++k) {
+      REQUIRE(actual.indices[k] == expected.indices[k]);
+      REQUIRE(actual.values[k] == expected.values[k]);
+    }
+  }
+  std::remove(cache);
+}
+
+// A copy of filename with one value overwritten at offset
+template <class T>
+void writeCorrupted(const char* filename, const char* corrupted, std::size_t offset, T value) {
+  std::ifstream in(filename, std::ios::binary);
+  std::string bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  std::memcpy(&bytes[offset], &value, sizeof(T));
+  std::ofstream out(corrupted, std::ios::binary);
+  out << bytes;
+}
+
+TEST_CASE("Form factor cache rejects corrupt files", "[sparse]") {
+  const char* cache = "test/form_factor_corrupt_test.ff";
+  const char* corrupted = "test/form_factor_corrupted_test.ff";
+  Model model("test/scene.obj", "test/scene.mtl");
+  int gridSize = 64;
+  SparseMatrix computed;
+  calcFormFactorsWholeModel(model, computed, gridSize);
+  uint64_t key = formFactorCacheKey(model, gridSize, 0.01f);
+  REQUIRE(writeFormFactorCache(cache, key, computed));
+
+  SparseMatrix mapped;
+  REQUIRE(readFormFactorCache(cache, key, model.nfaces(), mapped));
+  REQUIRE_FALSE(readFormFactorCache(cache, key, model.nfaces()+1, mapped));
+
+  std::size_t rowStarts = sizeof(FormFactorCacheHeader);
+  std::size_t indices = rowStarts + (model.nfaces()+1)*sizeof(std::size_t);
+  // Row 1 starting after row 2
+  writeCorrupted(cache, corrupted, rowStarts + sizeof(std::size_t), std::size_t(computed.getRow(0).size + computed.getRow(1).size + 1));
+  REQUIRE_FALSE(readFormFactorCache(corrupted, key, model.nfaces(), mapped));
+  // Columns past the last face, or negative
+  writeCorrupted(cache, corrupted, indices, model.nfaces());
+  REQUIRE_FALSE(readFormFactorCache(corrupted, key, model.nfaces(), mapped));
+  writeCorrupted(cache, corrupted, indices + 3*sizeof(int), -1);
+  REQUIRE_FALSE(readFormFactorCache(corrupted, key, model.nfaces(), mapped));
+
+  std::remove(cache);
+  std::remove(corrupted);
+}
+
+TEST_CASE("Streamed form factors match the in memory matrix", "[sparse]") {
+  const char* file = "test/form_factor_stream_test.ff";
+  Model model("test/scene.obj", "test/scene.mtl");
+  int gridSize = 64;
+  SparseMatrix computed;
+  calcFormFactorsWholeModel(model, computed, gridSize);
+
+  uint64_t key = formFactorCacheKey(model, gridSize, 0.01f);
+  {
+    FormFactorFileWriter writer(file, key, model.nfaces());
+    calcFormFactorsWholeModel(model, writer, gridSize);
+    REQUIRE(writer.finish());
+  }
+  REQUIRE_FALSE(FormFactorStream(file, key+1, 1024).valid());
+  // Small blocks, so the rows span several of them
+  FormFactorStream stream(file, key, 1024);
+  REQUIRE(stream.valid());
+  REQUIRE(stream.nrows() == computed.nrows());
+  REQUIRE(stream.nonZeros() == computed.nonZeros());
+  REQUIRE(stream.nblocks() > 2);
+
+  for(int pass=0; pass<2; ++pass) {
+    for(int i=0; i<computed.nrows(); ++i) {
+      SparseRow expected = computed.getRow(i);
+      SparseRow actual = stream.getRow(i);
+      REQUIRE(actual.size == expected.size);
+      for(int k=0; k<expected.size; ++k) {
+        REQUIRE(actual.indices[k] == expected.indices[k]);
+        REQUIRE(actual.values[k] == expected.values[k]);
+      }
+    }
+  }
+
+  std::vector<Vec3f> expected(model.nfaces());
+  std::vector<Vec3f> actual(model.nfaces());
+  gatherRadiosity(expected, model, gridSize, computed);
+  gatherRadiosity(actual, model, gridSize, stream);
+  REQUIRE(actual == expected);
+  std::remove(file);
+}